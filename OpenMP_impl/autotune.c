@@ -0,0 +1,213 @@
+/*
+ * autotune.c
+ *
+ * Schedule and chunk-size autotuner for simulate().
+ *
+ * The first run for an (i_max bucket, num_threads) key times a few steps
+ * under every candidate schedule and appends the winner to a small tuning
+ * file. Later runs with the same key only read that file, so they pay no
+ * measurement overhead. An explicit OMP_SCHEDULE always wins.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "autotune.h"
+#include "simulate.h"
+#include "timer.h"
+
+#define DEFAULT_TUNING_FILE "omp_tuning.txt"
+
+/* Roughly how many point updates a single trial should take. */
+#define TRIAL_POINT_UPDATES 2000000
+
+static const struct {
+    const char *name;
+    omp_sched_t kind;
+} kinds[] = {
+    { "static", omp_sched_static },
+    { "dynamic", omp_sched_dynamic },
+    { "guided", omp_sched_guided },
+};
+static const int num_kinds = sizeof(kinds) / sizeof(kinds[0]);
+
+/* Chunk 0 selects the implementation default for that kind. */
+static const int chunks[] = { 0, 64, 1024, 16384 };
+static const int num_chunks = sizeof(chunks) / sizeof(chunks[0]);
+
+
+/*
+ * Grids within a factor two of each other share their tuning.
+ */
+static int i_max_bucket(long i_max)
+{
+    int bucket = 0;
+
+    while (i_max > 1) {
+        i_max >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static const char *tuning_file(void)
+{
+    const char *path = getenv("WAVE_TUNING_FILE");
+
+    return path != NULL ? path : DEFAULT_TUNING_FILE;
+}
+
+/*
+ * Looks up the schedule stored for a key. The last matching line wins, so
+ * re-tuning only needs to append. Returns 0 when the key was found.
+ */
+static int tuning_load(int bucket, int num_threads, int *kind, int *chunk)
+{
+    FILE *fp = fopen(tuning_file(), "r");
+    char line[256];
+    int found = -1;
+
+    if (!fp)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        int b, t, k, ch;
+        char name[32];
+
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%d %d %31s %d", &b, &t, name, &ch) != 4)
+            continue;
+        if (b != bucket || t != num_threads)
+            continue;
+
+        for (k = 0; k < num_kinds; k++) {
+            if (strcmp(name, kinds[k].name) == 0) {
+                *kind = k;
+                *chunk = ch;
+                found = 0;
+            }
+        }
+    }
+
+    fclose(fp);
+    return found;
+}
+
+static void tuning_store(int bucket, int num_threads, int kind, int chunk,
+        double seconds_per_step)
+{
+    const char *path = tuning_file();
+    FILE *fp = fopen(path, "a");
+
+    if (!fp) {
+        fprintf(stderr, "autotune: could not write %s\n", path);
+        return;
+    }
+
+    if (ftell(fp) == 0)
+        fprintf(fp, "# i_max_bucket num_threads schedule chunk seconds_per_step\n");
+    fprintf(fp, "%d %d %s %d %g\n", bucket, num_threads, kinds[kind].name,
+            chunk, seconds_per_step);
+
+    fclose(fp);
+}
+
+/*
+ * Times `steps' steps of simulate() under the current runtime schedule on
+ * scratch copies of the initial data. Returns the best of two repetitions.
+ */
+static double time_trial(long i_max, int steps, int num_threads,
+        const double *old_array, const double *current_array, double **scratch)
+{
+    double best = -1;
+    int rep;
+
+    for (rep = 0; rep < 2; rep++) {
+        double elapsed;
+
+        memcpy(scratch[0], old_array, i_max * sizeof(double));
+        memcpy(scratch[1], current_array, i_max * sizeof(double));
+
+        timer_start();
+        simulate(i_max, steps, num_threads, scratch[0], scratch[1], scratch[2]);
+        elapsed = timer_end();
+
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+/*
+ * Sets the runtime schedule for simulate(), tuning and persisting it first
+ * if this (i_max bucket, num_threads) pair has not been seen before.
+ */
+void autotune_schedule(const long i_max, const int num_threads,
+        const double *old_array, const double *current_array)
+{
+    const int bucket = i_max_bucket(i_max);
+    double *scratch[3];
+    double best_time = -1;
+    int best_kind = 0, best_chunk = 0;
+    int kind, chunk, k, ch, steps;
+
+    if (getenv("OMP_SCHEDULE") != NULL)
+        return;
+
+    if (tuning_load(bucket, num_threads, &kind, &chunk) == 0) {
+        omp_set_schedule(kinds[kind].kind, chunk);
+        return;
+    }
+
+    scratch[0] = malloc(i_max * sizeof(double));
+    scratch[1] = malloc(i_max * sizeof(double));
+    scratch[2] = calloc(i_max, sizeof(double));
+    if (!scratch[0] || !scratch[1] || !scratch[2]) {
+        fprintf(stderr, "autotune: out of memory, keeping default schedule\n");
+        free(scratch[0]);
+        free(scratch[1]);
+        free(scratch[2]);
+        return;
+    }
+
+    steps = TRIAL_POINT_UPDATES / i_max;
+    if (steps < 2)
+        steps = 2;
+    if (steps > 50)
+        steps = 50;
+
+    /* Warm up the thread pool and the pages before measuring anything. */
+    omp_set_schedule(omp_sched_static, 0);
+    time_trial(i_max, 1, num_threads, old_array, current_array, scratch);
+
+    for (k = 0; k < num_kinds; k++) {
+        for (ch = 0; ch < num_chunks; ch++) {
+            double elapsed;
+
+            if (chunks[ch] >= i_max)
+                continue;
+
+            omp_set_schedule(kinds[k].kind, chunks[ch]);
+            elapsed = time_trial(i_max, steps, num_threads, old_array,
+                                 current_array, scratch);
+
+            if (best_time < 0 || elapsed < best_time) {
+                best_time = elapsed;
+                best_kind = k;
+                best_chunk = chunks[ch];
+            }
+        }
+    }
+
+    free(scratch[0]);
+    free(scratch[1]);
+    free(scratch[2]);
+
+    printf("Autotuned schedule: %s,%d\n", kinds[best_kind].name, best_chunk);
+    tuning_store(bucket, num_threads, best_kind, best_chunk, best_time / steps);
+    omp_set_schedule(kinds[best_kind].kind, best_chunk);
+}
@@ -0,0 +1,11 @@
+/*
+ * autotune.h
+ *
+ * Picks the OpenMP schedule used by simulate()'s schedule(runtime) loop.
+ *
+ */
+
+#pragma once
+
+void autotune_schedule(const long i_max, const int num_threads,
+        const double *old_array, const double *current_array);
@@ -1,7 +1,28 @@
+/*
+ * generatedata.h
+ *
+ * Parallel first-touch initialisation of the wave buffers.
+ *
+ */
+
 #pragma once
 
-typedef double (*func_t)(double x);
+#include "arena.h"
+
+/* Sampled functions for init_fill_t. */
+enum { INIT_ZERO, INIT_SIN, INIT_GAUSS };
+
+/*
+ * Describes the contents of one buffer: `range' samples of `func' taken
+ * between `sample_start' and `sample_end', placed from index `offset' on.
+ * Everything else is zero.
+ */
+typedef struct {
+    int func;
+    long offset, range;
+    double sample_start, sample_end;
+} init_fill_t;
 
-double gauss(double x);
-void fill(double *array, int offset, int range, double sample_start,
-        double sample_end, func_t f);
+int init_buffers(arena_t *arena, long i_max, int num_threads,
+        const init_fill_t fills[3], double *buffers[3]);
+int init_mode_fills(const char *mode, long i_max, init_fill_t fills[3]);
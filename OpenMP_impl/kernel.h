@@ -0,0 +1,30 @@
+/*
+ * kernel.h
+ *
+ * The stencil kernels the engines sweep with, and the large-grid switch
+ * between them.
+ *
+ */
+
+#pragma once
+
+/* The wave speed constant c of the update; every engine uses this one. */
+#define STENCIL_C 0.15
+
+enum { KERNEL_AUTO, KERNEL_PLAIN, KERNEL_STREAM };
+
+/* next[i] for start <= i < end; the three arrays must not overlap. */
+typedef void (*stencil_func_t)(double *restrict next,
+        const double *restrict cur, const double *restrict old,
+        long start, long end);
+
+void stencil_plain(double *restrict next, const double *restrict cur,
+        const double *restrict old, long start, long end);
+void stencil_stream(double *restrict next, const double *restrict cur,
+        const double *restrict old, long start, long end);
+
+long kernel_llc_bytes(void);
+int kernel_parse(const char *name);
+void kernel_set_mode(int mode);
+void kernel_set_prefetch(long distance);
+stencil_func_t kernel_select(long i_max);
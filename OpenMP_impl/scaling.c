@@ -0,0 +1,519 @@
+/*
+ * scaling.c
+ *
+ * wave_scaling: strong and weak scaling sweeps of simulate() under each
+ * OpenMP schedule.
+ *
+ * Every design point (study, backend, i_max, t_max, threads) is run a few
+ * times after untimed warm-up runs, each time on freshly first-touched
+ * buffers, and summarised as mean, standard deviation, 95% confidence
+ * interval (Student t) and minimum. Strong scaling keeps i_max fixed;
+ * weak scaling takes i_max per thread, so the grid grows with the thread
+ * count. Speedup is against a plain serial loop on the same grid, never a
+ * one-thread run of the parallel region being measured, and efficiency is the
+ * speedup per thread; for weak scaling that is the usual weak efficiency
+ * since the sequential cost is linear in i_max.
+ *
+ * Threads are bound one per place with OMP_PROC_BIND=close, the places
+ * being single logical CPUs listed one per physical core (package by
+ * package) before any SMT siblings. Both are set before the runtime
+ * starts and left alone if already in the environment.
+ *
+ * The output is one CSV row per design point; '#' lines on top record the
+ * host topology, the compiler and build flags, and the command line.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <omp.h>
+
+#include "simulate.h"
+#include "autotune.h"
+#include "generatedata.h"
+#include "arena.h"
+#include "kernel.h"
+#include "timer.h"
+
+#ifndef WAVE_CFLAGS
+#define WAVE_CFLAGS "unknown"
+#endif
+
+/* Longest list an option takes. */
+#define MAX_LIST 32
+
+/* "tuned" is whatever autotune_schedule() picks, outside the timed run. */
+enum { SERIAL = -1, TUNED = -2 };
+
+static const struct {
+    const char *name;
+    int kind;
+} backends[] = {
+    { "static", omp_sched_static },
+    { "dynamic", omp_sched_dynamic },
+    { "guided", omp_sched_guided },
+    { "tuned", TUNED },
+    { "serial", SERIAL },
+};
+static const int num_backends = sizeof(backends) / sizeof(backends[0]);
+
+/* The baseline every speedup is measured against. */
+#define BASELINE 4
+
+typedef struct {
+    int id, package, core, sibling;
+} Cpu;
+
+typedef struct {
+    int reps;
+    double mean, stddev, ci95, min;
+} Summary;
+
+/* Sequential timings, one per grid, shared by both studies. */
+typedef struct {
+    long i_max, t_max;
+    Summary summary;
+    int written[2];
+} Baseline;
+
+static Cpu cpus[CPU_SETSIZE];
+static int num_cpus, num_packages, num_cores;
+static int pin = 1;
+
+
+static int read_topology(int cpu, const char *name)
+{
+    char path[96];
+    FILE *fp;
+    int value = 0;
+
+    snprintf(path, sizeof(path),
+            "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    fp = fopen(path, "r");
+    if (fp) {
+        if (fscanf(fp, "%d", &value) != 1)
+            value = 0;
+        fclose(fp);
+    }
+    return value;
+}
+
+/* First cores, then packages, then SMT siblings vary slowest. */
+static int by_placement(const void *a, const void *b)
+{
+    const Cpu *x = a, *y = b;
+
+    if (x->sibling != y->sibling)
+        return x->sibling - y->sibling;
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->id - y->id;
+}
+
+/* Lists the CPUs we may run on in the order threads are bound to them. */
+static void scan_topology(void)
+{
+    cpu_set_t allowed;
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        for (int cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN) &&
+                cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &allowed);
+    }
+
+    num_cpus = num_packages = num_cores = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        Cpu *c;
+
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        c = &cpus[num_cpus++];
+        c->id = cpu;
+        c->package = read_topology(cpu, "physical_package_id");
+        c->core = read_topology(cpu, "core_id");
+        c->sibling = 0;
+        for (int k = 0; k < num_cpus - 1; k++) {
+            if (cpus[k].package == c->package && cpus[k].core == c->core)
+                c->sibling++;
+        }
+        if (c->sibling == 0)
+            num_cores++;
+        if (c->package + 1 > num_packages)
+            num_packages = c->package + 1;
+    }
+    qsort(cpus, num_cpus, sizeof(Cpu), by_placement);
+}
+
+/* Hands the placement to the runtime; call before any OpenMP construct. */
+static void bind_places(void)
+{
+    char *places = malloc(num_cpus * 16 + 1), *p = places;
+
+    if (!pin || places == NULL) {
+        free(places);
+        return;
+    }
+    for (int k = 0; k < num_cpus; k++)
+        p += sprintf(p, "%s{%d}", k > 0 ? "," : "", cpus[k].id);
+    setenv("OMP_PLACES", places, 0);
+    setenv("OMP_PROC_BIND", "close", 0);
+    free(places);
+}
+
+/* The serial reference: the stencil sweep with no parallel region. */
+static double *serial(long i_max, long t_max, double *old_array,
+        double *current_array, double *next_array)
+{
+    for (long t = 0; t < t_max; t++) {
+        double *tmp = old_array;
+
+        stencil_plain(next_array, current_array, old_array, 1, i_max - 1);
+        old_array = current_array;
+        current_array = next_array;
+        next_array = tmp;
+    }
+    return current_array;
+}
+
+/* Two-sided 95% quantiles of Student's t for 1 .. 30 degrees of freedom. */
+static double t95(int df)
+{
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+
+    return df < 1 ? 0 : df <= 30 ? table[df - 1] : 1.960;
+}
+
+static void summarise(const double *samples, int n, Summary *s)
+{
+    double sum = 0, sq = 0;
+
+    s->reps = n;
+    s->min = samples[0];
+    for (int k = 0; k < n; k++) {
+        sum += samples[k];
+        s->min = fmin(s->min, samples[k]);
+    }
+    s->mean = sum / n;
+    for (int k = 0; k < n; k++)
+        sq += (samples[k] - s->mean) * (samples[k] - s->mean);
+    s->stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+    s->ci95 = t95(n - 1) * s->stddev / sqrt(n);
+}
+
+/* One timed run on fresh buffers; returns its seconds, or -1. */
+static double run_once(int kind, long i_max, long t_max, int threads)
+{
+    init_fill_t fills[3];
+    double *buffers[3], *ret, seconds;
+    struct timespec start;
+    arena_t arena;
+
+    init_mode_fills("sin", i_max, fills);
+    if (arena_init(&arena, 3 * arena_footprint(i_max * sizeof(double)), 0) != 0)
+        return -1;
+    if (init_buffers(&arena, i_max, threads, fills, buffers) != 0) {
+        arena_destroy(&arena);
+        return -1;
+    }
+
+    /* Streaming grids run static slices: there is nothing to tune. */
+    if (kind == TUNED && !simulate_streams(i_max))
+        autotune_schedule(i_max, threads, buffers[0], buffers[1]);
+    else if (kind != SERIAL)
+        omp_set_schedule(kind, 0);
+
+    timer_start_r(&start);
+    if (kind == SERIAL)
+        ret = serial(i_max, t_max, buffers[0], buffers[1], buffers[2]);
+    else
+        ret = simulate(i_max, t_max, threads, buffers[0], buffers[1], buffers[2]);
+    seconds = timer_end_r(&start);
+
+    if (ret == NULL || !isfinite(ret[i_max / 8]))
+        seconds = -1;
+    arena_destroy(&arena);
+    return seconds;
+}
+
+/* Returns the number of CPUs the threads were bound to, or -1. */
+static int measure(int kind, long i_max, long t_max, int threads,
+        int warmup, int reps, Summary *s)
+{
+    double samples[MAX_LIST * 4];
+    int used = !pin ? num_cpus : threads < num_cpus ? threads : num_cpus, k;
+
+    for (k = 0; k < warmup + reps; k++) {
+        double seconds = run_once(kind, i_max, t_max, threads);
+
+        if (seconds < 0)
+            break;
+        if (k >= warmup)
+            samples[k - warmup] = seconds;
+    }
+    if (k < warmup + reps)
+        return -1;
+    summarise(samples, reps, s);
+    return used;
+}
+
+/* Parses "a,b,c" into at most MAX_LIST positive numbers. */
+static int parse_list(const char *text, long *values)
+{
+    int n = 0;
+
+    while (*text != '\0' && n < MAX_LIST) {
+        char *end;
+
+        values[n] = strtol(text, &end, 10);
+        if (end == text || values[n] < 1 || (*end != ',' && *end != '\0'))
+            return -1;
+        n++;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return *text == '\0' && n > 0 ? n : -1;
+}
+
+static void write_metadata(FILE *fp, int argc, char *argv[], int warmup)
+{
+    char model[256] = "unknown", line[512], stamp[32];
+    struct utsname host;
+    time_t now = time(NULL);
+    FILE *info = fopen("/proc/cpuinfo", "r");
+
+    if (info) {
+        while (fgets(line, sizeof(line), info)) {
+            char *colon = strchr(line, ':');
+
+            if (strncmp(line, "model name", 10) == 0 && colon != NULL) {
+                snprintf(model, sizeof(model), "%s", colon + 2);
+                model[strcspn(model, "\n")] = '\0';
+                break;
+            }
+        }
+        fclose(info);
+    }
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(fp, "# wave_scaling %s\n", stamp);
+    if (uname(&host) == 0)
+        fprintf(fp, "# host: %s, %s %s %s\n", host.nodename, host.sysname,
+                host.release, host.machine);
+    fprintf(fp, "# cpu: %s\n", model);
+    fprintf(fp, "# topology: %d packages, %d cores, %d logical CPUs available, "
+            "last-level cache %ld bytes\n", num_packages, num_cores, num_cpus,
+            kernel_llc_bytes());
+    fprintf(fp, "# placement: OMP_PLACES=%s OMP_PROC_BIND=%s\n",
+            getenv("OMP_PLACES") ? getenv("OMP_PLACES") : "unset",
+            getenv("OMP_PROC_BIND") ? getenv("OMP_PROC_BIND") : "unset");
+    fprintf(fp, "# build: gcc %s, %s\n", __VERSION__, WAVE_CFLAGS);
+    fprintf(fp, "# warmup: %d runs per point\n", warmup);
+    fprintf(fp, "# command:");
+    for (int k = 0; k < argc; k++)
+        fprintf(fp, " %s", argv[k]);
+    fprintf(fp, "\n");
+    fprintf(fp, "study,backend,i_max,t_max,threads,cpus,reps,mean_seconds,"
+            "stddev_seconds,ci95_seconds,min_seconds,normalized,speedup,"
+            "efficiency\n");
+}
+
+static void write_row(FILE *fp, const char *study, const char *backend,
+        long i_max, long t_max, int threads, int used, const Summary *s,
+        double baseline)
+{
+    const double speedup = baseline / s->mean;
+
+    fprintf(fp, "%s,%s,%ld,%ld,%d,%d,%d,%.6g,%.6g,%.6g,%.6g,%.6g,%.4f,%.4f\n",
+            study, backend, i_max, t_max, threads, used, s->reps, s->mean,
+            s->stddev, s->ci95, s->min, s->mean / (1. * i_max * t_max),
+            speedup, speedup / threads);
+    fflush(fp);
+    printf("%-6s %-10s i_max=%-9ld t_max=%-6ld threads=%-3d %10.4g s "
+            "+- %-9.2g speedup %6.2f efficiency %.2f\n", study, backend, i_max,
+            t_max, threads, s->mean, s->ci95, speedup, speedup / threads);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf(" - options:\n");
+    printf("    * --study=strong|weak|both: which sweeps to run "
+            "(default both).\n");
+    printf("    * --backends=NAME,...: engines to sweep, from");
+    for (int b = 0; b < num_backends; b++)
+        printf(" %s", backends[b].name);
+    printf(" (default static,dynamic,guided).\n");
+    printf("    * --threads=N,...: thread counts (default powers of two up "
+            "to the available CPUs, and their number).\n");
+    printf("    * --i-max=N,...: grid sizes, per thread for weak scaling "
+            "(default 100000,1000000,10000000).\n");
+    printf("    * --t-max=N,...: step counts (default 100).\n");
+    printf("    * --reps=N: timed runs per point, 2 to %d (default 5).\n",
+            MAX_LIST * 4);
+    printf("    * --warmup=N: untimed runs per point (default 1).\n");
+    printf("    * --no-pin: do not bind threads to CPUs.\n");
+    printf("    * --out=FILE: the dataset (default scaling.csv).\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *out = "scaling.csv";
+    long i_list[MAX_LIST] = { 100000, 1000000, 10000000 }, t_list[MAX_LIST] = { 100 };
+    long thread_list[MAX_LIST], backend_list[MAX_LIST] = { 0, 1, 2 };
+    int num_i = 3, num_t = 1, num_threads = 0, num_used = 3;
+    int studies[2] = { 1, 1 }, reps = 5, warmup = 1, num_baselines = 0;
+    Baseline *baselines;
+    FILE *fp;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if (strncmp(arg, "--study=", 8) == 0) {
+            studies[0] = strcmp(arg + 8, "weak") != 0;
+            studies[1] = strcmp(arg + 8, "strong") != 0;
+            if (strcmp(arg + 8, "strong") != 0 && strcmp(arg + 8, "weak") != 0 &&
+                    strcmp(arg + 8, "both") != 0) {
+                printf("Unknown study: %s.\n", arg + 8);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(arg, "--backends=", 11) == 0) {
+            char names[256], *name, *rest;
+
+            snprintf(names, sizeof(names), "%s", arg + 11);
+            num_used = 0;
+            for (name = strtok_r(names, ",", &rest); name != NULL && num_used < MAX_LIST;
+                    name = strtok_r(NULL, ",", &rest)) {
+                int b;
+
+                for (b = 0; b < num_backends; b++) {
+                    if (strcmp(name, backends[b].name) == 0)
+                        break;
+                }
+                if (b == num_backends) {
+                    printf("Unknown backend: %s.\n", name);
+                    return EXIT_FAILURE;
+                }
+                backend_list[num_used++] = b;
+            }
+        } else if (strncmp(arg, "--threads=", 10) == 0) {
+            num_threads = parse_list(arg + 10, thread_list);
+        } else if (strncmp(arg, "--i-max=", 8) == 0) {
+            num_i = parse_list(arg + 8, i_list);
+        } else if (strncmp(arg, "--t-max=", 8) == 0) {
+            num_t = parse_list(arg + 8, t_list);
+        } else if (strncmp(arg, "--reps=", 7) == 0) {
+            reps = atoi(arg + 7);
+        } else if (strncmp(arg, "--warmup=", 9) == 0) {
+            warmup = atoi(arg + 9);
+        } else if (strcmp(arg, "--no-pin") == 0) {
+            pin = 0;
+        } else if (strncmp(arg, "--out=", 6) == 0) {
+            out = arg + 6;
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (num_threads < 0 || num_i < 0 || num_t < 0 || num_used < 1 ||
+                reps < 2 || reps > MAX_LIST * 4 || warmup < 0) {
+            printf("argument error: %s.\n", arg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    scan_topology();
+    bind_places();
+    if (num_threads == 0) {
+        for (long p = 1; p < num_cpus && num_threads < MAX_LIST - 1; p *= 2)
+            thread_list[num_threads++] = p;
+        thread_list[num_threads++] = num_cpus;
+    }
+    for (int k = 0; k < num_i; k++) {
+        if (i_list[k] < 3) {
+            printf("argument error: i_max should be >2.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* A grid per (i_max, t_max), and per thread count for weak scaling. */
+    baselines = malloc((num_i * num_t * (num_threads + 1)) * sizeof(Baseline));
+    fp = fopen(out, "w");
+    if (!baselines || !fp) {
+        perror(out);
+        return EXIT_FAILURE;
+    }
+    write_metadata(fp, argc, argv, warmup);
+
+    for (int study = 0; study < 2; study++) {
+        const char *name = study == 0 ? "strong" : "weak";
+
+        if (!studies[study])
+            continue;
+        for (int a = 0; a < num_i; a++) {
+            for (int b = 0; b < num_t; b++) {
+                for (int u = 0; u < num_used; u++) {
+                    for (int p = 0; p < num_threads; p++) {
+                        const int threads = thread_list[p];
+                        const long i_max = study == 0 ? i_list[a] : i_list[a] * threads;
+                        const long t_max = t_list[b];
+                        Baseline *base = NULL;
+                        Summary s;
+                        int used;
+
+                        for (int k = 0; k < num_baselines; k++) {
+                            if (baselines[k].i_max == i_max && baselines[k].t_max == t_max)
+                                base = &baselines[k];
+                        }
+                        if (base == NULL) {
+                            base = &baselines[num_baselines++];
+                            memset(base, 0, sizeof(*base));
+                            base->i_max = i_max;
+                            base->t_max = t_max;
+                            if (measure(backends[BASELINE].kind, i_max, t_max, 1,
+                                        warmup, reps, &base->summary) < 0)
+                                goto failed;
+                        }
+                        if (!base->written[study]) {
+                            write_row(fp, name, backends[BASELINE].name, i_max,
+                                      t_max, 1, 1, &base->summary,
+                                      base->summary.mean);
+                            base->written[study] = 1;
+                        }
+
+                        used = measure(backends[backend_list[u]].kind, i_max,
+                                       t_max, threads, warmup, reps, &s);
+                        if (used < 0)
+                            goto failed;
+                        write_row(fp, name, backends[backend_list[u]].name,
+                                  i_max, t_max, threads, used, &s,
+                                  base->summary.mean);
+                    }
+                }
+            }
+        }
+    }
+
+    fclose(fp);
+    free(baselines);
+    printf("All results saved to %s\n", out);
+    return EXIT_SUCCESS;
+
+failed:
+    fclose(fp);
+    free(baselines);
+    fprintf(stderr, "A run failed (out of memory?), aborting.\n");
+    return EXIT_FAILURE;
+}
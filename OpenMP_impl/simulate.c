@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <omp.h>
 #include "simulate.h"
+#include "kernel.h"
+#include "trace.h"
 
 
 /*
@@ -23,7 +25,7 @@
  * next_array: array of size i_max. You should fill this with t+1
  */
 
-static const double c = 0.15;
+static const double c = STENCIL_C;
 
 void rotate_arrays(double **old_array, double **current_array, double **next_array) {
     double *temp = *old_array;
@@ -32,22 +34,62 @@ void rotate_arrays(double **old_array, double **current_array, double **next_arr
     *next_array = temp;
 }
 
-double *simulate(const int i_max, const int t_max, const int num_threads,
+/*
+ * Whether simulate() sweeps a grid of i_max points with the streaming
+ * kernel. That kernel wants long contiguous runs to keep its stores
+ * line-aligned, so it bypasses the runtime schedule: each thread sweeps one
+ * static slice per step. An explicit OMP_SCHEDULE keeps the scheduled loop.
+ */
+int simulate_streams(long i_max)
+{
+    return kernel_select(i_max) == stencil_stream && getenv("OMP_SCHEDULE") == NULL;
+}
+
+double *simulate(const long i_max, const long t_max, const int num_threads,
                  double *old_array, double *current_array, double *next_array)
 {
+    const int streaming = simulate_streams(i_max);
+
     #pragma omp parallel num_threads(num_threads)
     {
-        for (int t = 0; t < t_max; t++) {
-            #pragma omp for schedule(runtime)
-            for (int i = 1; i < i_max - 1; i++) {
-                next_array[i] = 2 * current_array[i]
-                                - old_array[i]
-                                + c * (current_array[i-1]
-                                - 2 * current_array[i]
-                                + current_array[i+1]);
+        const int id = omp_get_thread_num(), n = omp_get_num_threads();
+        const long start = 1 + (i_max - 2) * id / n;
+        const long end = 1 + (i_max - 2) * (id + 1) / n;
+
+        TRACE_THREAD("omp", id);
+
+        for (long t = 0; t < t_max; t++) {
+            // explicit barriers (instead of the implied ones) so they can be traced
+            TRACE_BEGIN(compute);
+            if (streaming) {
+                stencil_stream(next_array, current_array, old_array,
+                               start, end);
+            } else {
+                #pragma omp for schedule(runtime) nowait
+                for (long i = 1; i < i_max - 1; i++) {
+                    next_array[i] = 2 * current_array[i]
+                                    - old_array[i]
+                                    + c * (current_array[i-1]
+                                    - 2 * current_array[i]
+                                    + current_array[i+1]);
+                }
+            }
+            TRACE_END(compute, "compute", t);
+
+            TRACE_BEGIN(wait);
+            #pragma omp barrier
+            TRACE_END(wait, "barrier", t);
+
+            #pragma omp single nowait
+            {
+                TRACE_BEGIN(rotate);
+                rotate_arrays(&old_array, &current_array, &next_array);
+                TRACE_END(rotate, "rotate", t);
             }
-            #pragma omp single
-                        rotate_arrays(&old_array, &current_array, &next_array);
+
+            TRACE_BEGIN(rotate_wait);
+            #pragma omp barrier
+            TRACE_END(rotate_wait, "barrier", t);
         }
     }
     return current_array;
@@ -4,5 +4,7 @@
 
 #pragma once
 
-double *simulate(const int i_max, const int t_max, const int num_threads,
+int simulate_streams(long i_max);
+
+double *simulate(const long i_max, const long t_max, const int num_threads,
         double *old_array, double *current_array, double *next_array);
@@ -2,14 +2,14 @@
 
 #include "timer.h"
 
-struct timespec start_time;
+static struct timespec start_time;
 
 /*
  * Starts the timing. Get a result by calling timer_end afterwards.
  */
 void timer_start(void)
 {
-    clock_gettime(CLOCK_REALTIME, &start_time);
+    timer_start_r(&start_time);
 }
 
 /*
@@ -17,12 +17,29 @@ void timer_start(void)
  * Results when calling this without calling timer_end are undefined.
  */
 double timer_end(void)
+{
+    return timer_end_r(&start_time);
+}
+
+/*
+ * Like timer_start, but records the start in `start' so independent
+ * timings (one per thread or session) do not interfere.
+ */
+void timer_start_r(struct timespec *start)
+{
+    clock_gettime(CLOCK_REALTIME, start);
+}
+
+/*
+ * Returns the elapsed time in seconds since timer_start_r(start).
+ */
+double timer_end_r(const struct timespec *start)
 {
     struct timespec end_time;
     clock_gettime(CLOCK_REALTIME, &end_time);
 
-    return difftime(end_time.tv_sec, start_time.tv_sec) +
-        (end_time.tv_nsec - start_time.tv_nsec) / 1000000000.;
+    return difftime(end_time.tv_sec, start->tv_sec) +
+        (end_time.tv_nsec - start->tv_nsec) / 1000000000.;
 }
 
 
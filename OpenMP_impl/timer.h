@@ -4,5 +4,11 @@
 
 #pragma once
 
+#include <time.h>
+
 void timer_start(void);
 double timer_end(void);
+
+/* Reentrant variants: the caller keeps the start time. */
+void timer_start_r(struct timespec *start);
+double timer_end_r(const struct timespec *start);
@@ -0,0 +1,91 @@
+/*
+ * adjoint.c
+ *
+ * dJ/dc for J = 1/2 |u^T - d|^2, u^T the last level of the run.
+ *
+ * Write a step as u^{t+1} = A u^t - u^{t-1} with A = 2 + c L, L the
+ * three-point Laplacian on the interior. The adjoint levels then satisfy
+ *
+ *     mu^T = u^T - d,   mu^{T+1} = 0,   mu^t = A mu^{t+1} - mu^{t+2},
+ *
+ * which is the forward stencil itself (A is symmetric) run on the mu
+ * levels, and
+ *
+ *     dJ/dc = sum over t = 1 .. T-1 of  mu^{t+1} . L u^t.
+ *
+ * The sweep needs u^t from T-1 down to 1, the current levels of the
+ * states revolve hands out after the last one, so the forward run is
+ * never stored. The mu levels run on a session of their own, one step
+ * per state, their boundaries held at zero.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adjoint.h"
+#include "revolve.h"
+#include "session.h"
+
+/*
+ * Runs t_max steps from the first two levels and the adjoint sweep back,
+ * with `slots' stored states. The last level is left in next_array, as
+ * the engines do. A NULL target is all zeros. Returns -1 on failure.
+ */
+int adjoint_gradient(long i_max, long t_max, int slots, int num_threads,
+        const double *old_array, const double *current_array,
+        double *next_array, const double *target, adjoint_result_t *result)
+{
+    revolve_t *rv;
+    sim_session_t *adjoint;
+    double *mu[3];
+    const double *previous, *current;
+    double misfit = 0, gradient = 0;
+    long t;
+
+    rv = revolve_create(i_max, t_max, slots, num_threads, old_array,
+                        current_array, next_array);
+    if (rv == NULL)
+        return -1;
+    for (int b = 0; b < 3; b++)
+        mu[b] = calloc(i_max, sizeof(double));
+    adjoint = mu[0] && mu[1] && mu[2] ?
+              session_wrap(i_max, num_threads, mu[0], mu[1], mu[2]) : NULL;
+    if (adjoint == NULL) {
+        for (int b = 0; b < 3; b++)
+            free(mu[b]);
+        revolve_destroy(rv);
+        return -1;
+    }
+
+    /* State t_max: the last level, and mu^T from it. */
+    revolve_prev(rv, &t, &previous, &current);
+    memcpy(next_array, current, i_max * sizeof(double));
+    for (long i = 1; i < i_max - 1; i++) {
+        mu[1][i] = current[i] - (target != NULL ? target[i] : 0);
+        misfit += mu[1][i] * mu[1][i];
+    }
+
+    /* State t holds u^{t+1} and meets mu^{t+2}. */
+    while (revolve_prev(rv, &t, &previous, &current) == 0) {
+        const double *lambda = session_peek(adjoint, NULL);
+
+        for (long i = 1; i < i_max - 1; i++)
+            gradient += lambda[i] * (current[i-1] - 2 * current[i] + current[i+1]);
+        if (t > 0)
+            session_step(adjoint, 1);
+    }
+
+    result->misfit = misfit / 2;
+    result->gradient = gradient;
+    result->forward_steps = revolve_forward_steps(rv);
+    result->optimum = revolve_optimum(t_max + 1, slots);
+
+    session_destroy(adjoint);
+    for (int b = 0; b < 3; b++)
+        free(mu[b]);
+    revolve_destroy(rv);
+
+    return 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * adjoint.h
+ *
+ * Gradient of a final-state misfit with respect to the wave speed
+ * constant c, by an adjoint sweep over checkpointed states.
+ *
+ */
+
+#pragma once
+
+typedef struct {
+    double misfit;        /* J = 1/2 sum (u_final - target)^2 over the interior */
+    double gradient;      /* dJ/dc */
+    long forward_steps;   /* including recomputation */
+    long optimum;         /* the fewest forward steps any schedule needs */
+} adjoint_result_t;
+
+int adjoint_gradient(long i_max, long t_max, int slots, int num_threads,
+        const double *old_array, const double *current_array,
+        double *next_array, const double *target, adjoint_result_t *result);
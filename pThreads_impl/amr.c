@@ -0,0 +1,476 @@
+/*
+ * amr.c
+ *
+ * Adaptive mesh refinement engine (Berger-Oliger, two levels).
+ *
+ * The caller's grid is the fine grid. The base grid keeps every ratio-th
+ * point and steps ratio fine steps at a time; since space and time are
+ * refined together, the Courant number c is the same on both levels.
+ * Patches of fine grid cover the cells flagged by a gradient indicator,
+ * widened so the wave cannot leave them before the next regrid.
+ *
+ * One coarse step:
+ *  1. all threads sweep the base grid, under the patches too;
+ *  2. the patches are tasks, largest first: each takes ratio fine steps,
+ *     its two end points interpolated (quadratic in time) from the three
+ *     coarse levels around the step, then injects its values into the
+ *     coarse points it covers;
+ *  3. thread 0 rotates the coarse levels and, every `regrid' steps,
+ *     rebuilds the patches. New fine points are copied from the old
+ *     patches where those overlap and interpolated from the base grid
+ *     (cubic in space, linear in time) elsewhere.
+ *
+ * The base grid needs a level ratio fine steps before the current one; it
+ * is extrapolated from old and current with the wave equation's Taylor
+ * series. Boundaries are held at the current level's values, so results
+ * match the uniform engines for data with fixed boundaries (sin, gauss).
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "amr.h"
+#include "kernel.h"
+
+static const double c = STENCIL_C;
+
+typedef struct {
+    long a, b;               /* coarse indices of the ends */
+    long n;                  /* fine points, (b - a) * ratio + 1 */
+    double *old, *cur, *next;
+    int owned;               /* arrays allocated here */
+} AmrPatch;
+
+typedef struct Amr Amr;
+
+typedef struct {
+    int id;
+    long start, end;         /* coarse interior chunk */
+    Amr *amr;
+} AmrWorker;
+
+struct Amr {
+    amr_params_t params;
+    long i_max, nc, steps;
+    double *coarse[3];       /* n-1, n, n+1 */
+
+    AmrPatch *patches;
+    int num_patches;
+
+    int num_threads;
+    AmrWorker *workers;
+    pthread_barrier_t barrier;
+    pthread_mutex_t claim_lock;
+    int next_patch;
+
+    amr_stats_t stats;
+    double covered;          /* sum of refined fraction over steps */
+    int failed;
+};
+
+
+static void coarse_sweep(Amr *amr, long start, long end)
+{
+    double *next = amr->coarse[2];
+    const double *cur = amr->coarse[1];
+    const double *old = amr->coarse[0];
+
+    for (long i = start; i < end; i++)
+        next[i] = 2 * cur[i] - old[i] + c * (cur[i-1] - 2 * cur[i] + cur[i+1]);
+}
+
+/* Coarse point J at fraction tau of the current coarse step. */
+static double coarse_at(const Amr *amr, long J, double tau)
+{
+    const double um = amr->coarse[0][J], u0 = amr->coarse[1][J],
+                 up = amr->coarse[2][J];
+
+    return u0 + tau * (up - um) / 2 + tau * tau * (up - 2 * u0 + um) / 2;
+}
+
+static void subcycle(Amr *amr, AmrPatch *p)
+{
+    const int r = amr->params.ratio;
+
+    for (int k = 1; k <= r; k++) {
+        double *next = p->next, *temp;
+        const double *cur = p->cur, *old = p->old;
+
+        for (long i = 1; i < p->n - 1; i++)
+            next[i] = 2 * cur[i] - old[i] + c * (cur[i-1] - 2 * cur[i] + cur[i+1]);
+        next[0] = coarse_at(amr, p->a, (double) k / r);
+        next[p->n - 1] = coarse_at(amr, p->b, (double) k / r);
+
+        temp = p->old;
+        p->old = p->cur;
+        p->cur = p->next;
+        p->next = temp;
+    }
+
+    /* The patch's own coarse points take the fine values. */
+    for (long J = p->a + 1; J < p->b; J++)
+        amr->coarse[2][J] = p->cur[(J - p->a) * r];
+}
+
+/*
+ * Base grid value at fine index f by cubic interpolation, linear next to
+ * the ends.
+ */
+static double interpolate(const double *u, long nc, int r, long f)
+{
+    long J = f / r;
+    double x = (double) (f - J * r) / r;
+
+    if (x == 0)
+        return u[J];
+    if (J < 1 || J + 2 > nc - 1)
+        return (1 - x) * u[J] + x * u[J + 1];
+    return u[J - 1] * (-x * (x - 1) * (x - 2) / 6)
+         + u[J] * ((x + 1) * (x - 1) * (x - 2) / 2)
+         + u[J + 1] * (-(x + 1) * x * (x - 2) / 2)
+         + u[J + 2] * ((x + 1) * x * (x - 1) / 6);
+}
+
+static int by_size(const void *x, const void *y)
+{
+    const AmrPatch *a = x, *b = y;
+
+    return (a->n < b->n) - (a->n > b->n);
+}
+
+static void free_patches(AmrPatch *patches, int count)
+{
+    for (int k = 0; k < count; k++) {
+        if (patches[k].owned) {
+            free(patches[k].old);
+            free(patches[k].cur);
+            free(patches[k].next);
+        }
+    }
+    free(patches);
+}
+
+/*
+ * Flags cells with a steep gradient at either of the last two levels,
+ * widens the flags by how far the wave travels until the next regrid and
+ * makes a patch of every run. Thread 0 only, between steps.
+ */
+static void regrid(Amr *amr)
+{
+    const int r = amr->params.ratio;
+    const long nc = amr->nc;
+    const double *cur = amr->coarse[1], *old = amr->coarse[0];
+    const long reach = (long) ceil(sqrt(c) * amr->params.regrid) + 2;
+    double gmax = 0;
+    char *flag = calloc(nc, 1);
+    AmrPatch *patches = NULL;
+    int count = 0, cap = 0;
+    long J, last = -1;
+
+    if (flag == NULL) {
+        amr->failed = 1;
+        return;
+    }
+
+    for (J = 0; J + 1 < nc; J++) {
+        double g = fmax(fabs(cur[J + 1] - cur[J]), fabs(old[J + 1] - old[J]));
+        gmax = fmax(gmax, g);
+    }
+    for (J = 0; J + 1 < nc && gmax > 0; J++) {
+        double g = fmax(fabs(cur[J + 1] - cur[J]), fabs(old[J + 1] - old[J]));
+
+        if (g > amr->params.tol * gmax) {
+            /* Cells J - reach .. J + reach, skipping those already set. */
+            long lo = J - reach > last + 1 ? J - reach : last + 1;
+            long hi = J + reach < nc - 2 ? J + reach : nc - 2;
+
+            for (long k = lo < 0 ? 0 : lo; k <= hi; k++)
+                flag[k] = 1;
+            if (hi > last)
+                last = hi;
+        }
+    }
+
+    /* Cells a .. b-1 make a patch from coarse point a to b. */
+    for (J = 0; J + 1 < nc; ) {
+        long a, b;
+
+        if (!flag[J]) {
+            J++;
+            continue;
+        }
+        a = J;
+        for (;;) {
+            while (J + 1 < nc && flag[J])
+                J++;
+            /* Bridge gaps of up to two cells: patches never touch. */
+            if (J + 3 < nc && (flag[J + 1] || flag[J + 2]))
+                J++;
+            else
+                break;
+        }
+        b = J;
+
+        if (count == cap) {
+            AmrPatch *grown;
+
+            cap = cap ? 2 * cap : 8;
+            grown = realloc(patches, cap * sizeof(AmrPatch));
+            if (grown == NULL) {
+                amr->failed = 1;
+                break;
+            }
+            patches = grown;
+        }
+        patches[count].a = a;
+        patches[count].b = b;
+        patches[count].n = (b - a) * r + 1;
+        patches[count].old = malloc(patches[count].n * sizeof(double));
+        patches[count].cur = malloc(patches[count].n * sizeof(double));
+        patches[count].next = malloc(patches[count].n * sizeof(double));
+        patches[count].owned = 1;
+        count++;
+        if (!patches[count - 1].old || !patches[count - 1].cur ||
+                !patches[count - 1].next) {
+            amr->failed = 1;
+            break;
+        }
+    }
+    free(flag);
+
+    if (amr->failed) {
+        free_patches(patches, count);
+        return;
+    }
+
+    /* Copy what the old patches cover, interpolate the rest. */
+    for (int k = 0; k < count; k++) {
+        AmrPatch *p = &patches[k];
+
+        for (long i = 0; i < p->n; i++) {
+            const long f = p->a * r + i;
+            const AmrPatch *src = NULL;
+
+            for (int q = 0; q < amr->num_patches; q++) {
+                const AmrPatch *o = &amr->patches[q];
+
+                if (f >= o->a * r && f <= o->b * r) {
+                    src = o;
+                    break;
+                }
+            }
+            if (src != NULL) {
+                p->cur[i] = src->cur[f - src->a * r];
+                p->old[i] = src->old[f - src->a * r];
+            } else {
+                double u0 = interpolate(cur, nc, r, f);
+                double um = interpolate(old, nc, r, f);
+
+                p->cur[i] = u0;
+                p->old[i] = u0 - (u0 - um) / r;
+            }
+        }
+        p->next[0] = p->cur[0];
+        p->next[p->n - 1] = p->cur[p->n - 1];
+    }
+
+    free_patches(amr->patches, amr->num_patches);
+    qsort(patches, count, sizeof(AmrPatch), by_size);
+    amr->patches = patches;
+    amr->num_patches = count;
+    if (count > amr->stats.max_patches)
+        amr->stats.max_patches = count;
+}
+
+static int claim_patch(Amr *amr)
+{
+    int k;
+
+    pthread_mutex_lock(&amr->claim_lock);
+    k = amr->next_patch < amr->num_patches ? amr->next_patch++ : -1;
+    pthread_mutex_unlock(&amr->claim_lock);
+    return k;
+}
+
+static void *amr_worker(void *arg)
+{
+    AmrWorker *w = (AmrWorker *) arg;
+    Amr *amr = w->amr;
+    const int r = amr->params.ratio;
+
+    for (long n = 0; n < amr->steps; n++) {
+        int k;
+
+        coarse_sweep(amr, w->start, w->end);
+        pthread_barrier_wait(&amr->barrier);
+
+        while ((k = claim_patch(amr)) >= 0)
+            subcycle(amr, &amr->patches[k]);
+        pthread_barrier_wait(&amr->barrier);
+
+        if (w->id == 0) {
+            double *temp = amr->coarse[0], refined = 0;
+
+            for (k = 0; k < amr->num_patches; k++) {
+                amr->stats.fine_updates += (double) r * (amr->patches[k].n - 2);
+                refined += amr->patches[k].b - amr->patches[k].a;
+            }
+            amr->stats.coarse_updates += amr->nc - 2;
+            amr->covered += refined / (amr->nc - 1);
+
+            amr->coarse[0] = amr->coarse[1];
+            amr->coarse[1] = amr->coarse[2];
+            amr->coarse[2] = temp;
+
+            if ((n + 1) % amr->params.regrid == 0 && n + 1 < amr->steps)
+                regrid(amr);
+            amr->next_patch = 0;
+        }
+        pthread_barrier_wait(&amr->barrier);
+    }
+
+    return NULL;
+}
+
+/*
+ * Checks that the grid and step count fit the refinement ratio. Returns 0
+ * if they do, and prints what is wrong otherwise.
+ */
+int amr_check(const amr_params_t *params, long i_max, long t_max)
+{
+    const int r = params->ratio;
+
+    if (r < 2 || params->regrid < 1 || !(params->tol > 0 && params->tol < 1)) {
+        printf("argument error: AMR needs ratio >= 2, regrid >= 1 and "
+                "0 < tol < 1.\n");
+        return -1;
+    }
+    if ((i_max - 1) % r != 0 || (i_max - 1) / r < 4 || t_max % r != 0) {
+        printf("argument error: AMR with ratio %d needs i_max = %d*k + 1 "
+                "(k >= 4) and t_max a multiple of %d.\n", r, r, r);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Runs t_max fine steps from old/current and writes the result, on the
+ * whole fine grid, to next_array. Returns next_array, or NULL on failure.
+ * The parameters must have passed amr_check().
+ */
+double *simulate_amr(const amr_params_t *params, long i_max, long t_max,
+        int num_threads, double *old_array, double *current_array,
+        double *next_array, amr_stats_t *stats)
+{
+    const int r = params->ratio;
+    pthread_t threads[num_threads];
+    AmrPatch initial;
+    Amr amr;
+    long J, f;
+    int thr;
+
+    memset(&amr, 0, sizeof(amr));
+    amr.params = *params;
+    amr.i_max = i_max;
+    amr.nc = (i_max - 1) / r + 1;
+    amr.steps = t_max / r;
+    amr.num_threads = num_threads;
+
+    for (int b = 0; b < 3; b++)
+        amr.coarse[b] = malloc(amr.nc * sizeof(double));
+    amr.workers = malloc(num_threads * sizeof(AmrWorker));
+    if (!amr.coarse[0] || !amr.coarse[1] || !amr.coarse[2] || !amr.workers) {
+        for (int b = 0; b < 3; b++)
+            free(amr.coarse[b]);
+        free(amr.workers);
+        return NULL;
+    }
+
+    /*
+     * Base levels: current, and the level ratio fine steps earlier from
+     * u(t - r dt) = u - r dt u_t + (r dt)^2 / 2 u_tt, with
+     * dt u_t = cur - old + lap / 2 and dt^2 u_tt = lap = c * (second difference).
+     */
+    for (J = 0; J < amr.nc; J++) {
+        const double *cur = current_array, *old = old_array;
+        const int interior = J > 0 && J < amr.nc - 1;
+        double lap;
+
+        f = J * r;
+        lap = interior ? c * (cur[f - 1] - 2 * cur[f] + cur[f + 1]) : 0;
+
+        amr.coarse[1][J] = cur[f];
+        amr.coarse[0][J] = interior ?
+            cur[f] - r * (cur[f] - old[f] + lap / 2) + r * r * lap / 2 : cur[f];
+        amr.coarse[2][J] = cur[f];
+    }
+
+    /* The first regrid copies from the input as if it were one patch. */
+    initial.a = 0;
+    initial.b = amr.nc - 1;
+    initial.n = i_max;
+    initial.old = old_array;
+    initial.cur = current_array;
+    initial.next = NULL;
+    initial.owned = 0;
+    amr.patches = malloc(sizeof(AmrPatch));
+    if (amr.patches != NULL) {
+        amr.patches[0] = initial;
+        amr.num_patches = 1;
+        regrid(&amr);
+    } else {
+        amr.failed = 1;
+    }
+    if (amr.failed) {
+        free_patches(amr.patches, amr.num_patches);
+        for (int b = 0; b < 3; b++)
+            free(amr.coarse[b]);
+        free(amr.workers);
+        return NULL;
+    }
+
+    pthread_barrier_init(&amr.barrier, NULL, num_threads);
+    pthread_mutex_init(&amr.claim_lock, NULL);
+    for (thr = 0; thr < num_threads; thr++) {
+        const long interior = amr.nc - 2;
+        AmrWorker *w = &amr.workers[thr];
+
+        w->id = thr;
+        w->amr = &amr;
+        w->start = 1 + interior * thr / num_threads;
+        w->end = 1 + interior * (thr + 1) / num_threads;
+        if (thr > 0)
+            pthread_create(&threads[thr], NULL, amr_worker, w);
+    }
+    amr_worker(&amr.workers[0]);
+    for (thr = 1; thr < num_threads; thr++)
+        pthread_join(threads[thr], NULL);
+    pthread_mutex_destroy(&amr.claim_lock);
+    pthread_barrier_destroy(&amr.barrier);
+
+    /* Base grid everywhere, patches on top. */
+    for (f = 0; f < i_max; f++)
+        next_array[f] = interpolate(amr.coarse[1], amr.nc, r, f);
+    for (int k = 0; k < amr.num_patches; k++) {
+        const AmrPatch *p = &amr.patches[k];
+
+        memcpy(next_array + p->a * r, p->cur, p->n * sizeof(double));
+    }
+
+    if (stats != NULL) {
+        *stats = amr.stats;
+        stats->patches = amr.num_patches;
+        stats->mean_coverage = amr.steps > 0 ? amr.covered / amr.steps : 0;
+    }
+
+    free_patches(amr.patches, amr.num_patches);
+    for (int b = 0; b < 3; b++)
+        free(amr.coarse[b]);
+    free(amr.workers);
+
+    return amr.failed ? NULL : next_array;
+}
@@ -0,0 +1,26 @@
+/*
+ * amr.h
+ *
+ * Block-structured adaptive mesh refinement: a coarse base grid with
+ * refined, subcycled patches where the wave has structure.
+ *
+ */
+
+#pragma once
+
+typedef struct {
+    int ratio;            /* refinement in space and time, >= 2 */
+    long regrid;          /* coarse steps between regrids */
+    double tol;           /* flag cells above tol * the largest gradient */
+} amr_params_t;
+
+typedef struct {
+    double coarse_updates, fine_updates;
+    int patches, max_patches;
+    double mean_coverage; /* fraction of the domain refined, averaged */
+} amr_stats_t;
+
+int amr_check(const amr_params_t *params, long i_max, long t_max);
+double *simulate_amr(const amr_params_t *params, long i_max, long t_max,
+        int num_threads, double *old_array, double *current_array,
+        double *next_array, amr_stats_t *stats);
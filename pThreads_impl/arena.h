@@ -0,0 +1,31 @@
+/*
+ * arena.h
+ *
+ * Huge-page backed arena for the wave buffers.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* arena_init() flags. */
+enum {
+    ARENA_POPULATE = 1,    /* pre-fault every page up front */
+    ARENA_LOCK = 2,        /* mlock the arena so it is never paged out */
+};
+
+typedef struct {
+    char *base;
+    size_t size;
+    size_t used;
+    const char *pages;     /* "1G", "2M", "THP" or "4K": what we got */
+} arena_t;
+
+/* Bytes arena_alloc() takes for a request of `bytes'. */
+size_t arena_footprint(size_t bytes);
+
+int arena_init(arena_t *arena, size_t size, int flags);
+void *arena_alloc(arena_t *arena, size_t bytes);
+void arena_reset(arena_t *arena);
+void arena_destroy(arena_t *arena);
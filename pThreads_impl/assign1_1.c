@@ -10,53 +10,359 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include "file.h"
 #include "timer.h"
 #include "simulate.h"
-
-typedef double (*func_t)(double x);
+#include "generatedata.h"
+#include "arena.h"
+#include "trace.h"
+#include "ooc.h"
+#include "zstate.h"
+#include "batch.h"
+#include "session.h"
+#include "progress.h"
+#include "output.h"
+#include "amr.h"
+#include "adjoint.h"
+#include "parareal.h"
+#include "kernel.h"
+#include "cache.h"
+#include "region.h"
+#include "wavefront.h"
+#include "raster.h"
 
 /*
- * Simple gauss with mu=0, sigma^1=1
+ * Simulation engines that can be selected with --engine=NAME. The first entry
+ * is the default.
  */
-double gauss(double x)
+static const struct {
+    const char *name;
+    simulate_func_t func;
+} engines[] = {
+    { "barrier", simulate },
+    { "chunk", simulate_v2 },
+    { "sequential", simulateSequential_v1 },
+    { "trapezoid", simulateSequential_trapezoid },
+    { "spectral", simulate_spectral },
+    { "wavefront", simulate_wavefront },
+};
+static const int num_engines = sizeof(engines) / sizeof(engines[0]);
+
+/* Set by SIGTERM/SIGINT, polled by the progress monitor. */
+static volatile sig_atomic_t stop_requested;
+
+static void request_stop(int sig)
 {
-    return exp((-1 * x * x) / 2);
+    (void) sig;
+    stop_requested = 1;
 }
 
+/* Like file_write_double_array(), but round-trips exactly through %lf. */
+static void write_exact(const char *filename, const double *array, long n)
+{
+    FILE *fp = fopen(filename, "w");
+    long i;
+
+    if (!fp) {
+        perror(filename);
+        return;
+    }
+    for (i = 0; i < n; i++)
+        fprintf(fp, "%.17g\n", array[i]);
+    fclose(fp);
+}
 
 /*
- * Fills a given array with samples of a given function. This is used to fill
- * the initial arrays with some starting data, to run the simulation on.
- *
- * The first sample is placed at array index `offset'. `range' samples are
- * taken, so your array should be able to store at least offset+range doubles.
- * The function `f' is sampled `range' times between `sample_start' and
- * `sample_end'.
+ * Reruns t_max steps of `engine' from the reference first levels (which it
+ * frees) and compares `result' with the outcome. Returns the seconds the
+ * rerun took, or -1 if it could not run.
  */
-void fill(double *array, int offset, int range, double sample_start,
-        double sample_end, func_t f)
+static double compare_reference(simulate_func_t engine, int num_threads,
+        const double *result, double *ref_old, double *ref_current,
+        long i_max, long t_max, double *max_error, double *rel_l2)
 {
-    int i;
-    float dx;
+    double *ref_next = calloc(i_max, sizeof(double)), *ref;
+    double err2 = 0, norm2 = 0, seconds = -1;
+    long i;
+
+    if (ref_next != NULL && ref_old != NULL && ref_current != NULL) {
+        timer_start();
+        ref = engine(i_max, t_max, num_threads, ref_old, ref_current, ref_next);
+        seconds = timer_end();
 
-    dx = (sample_end - sample_start) / range;
-    for (i = 0; i < range; i++) {
-        array[i + offset] = f(sample_start + i * dx);
+        *max_error = 0;
+        for (i = 0; i < i_max; i++) {
+            double e = fabs(result[i] - ref[i]);
+
+            *max_error = e > *max_error ? e : *max_error;
+            err2 += e * e;
+            norm2 += ref[i] * ref[i];
+        }
+        *rel_l2 = norm2 > 0 ? sqrt(err2 / norm2) : 0;
     }
+
+    free(ref_old);
+    free(ref_current);
+    free(ref_next);
+    return seconds;
 }
 
+/*
+ * Compares an AMR result with a uniform run from the same first levels
+ * and prints the savings and errors.
+ */
+static void amr_report(const amr_stats_t *stats, const double *result,
+        double *ref_old, double *ref_current, long i_max, long t_max,
+        int num_threads)
+{
+    double uniform = (double) (i_max - 2) * t_max, updates;
+    double max_error, rel_l2, seconds;
+
+    updates = stats->coarse_updates + stats->fine_updates;
+    printf("AMR: %d patches at the end (at most %d), %.1f%% of the domain "
+            "refined on average\n", stats->patches, stats->max_patches,
+            100 * stats->mean_coverage);
+    printf("AMR: %g point updates (%g coarse, %g fine) against %g uniform, "
+            "%.1f%% saved\n", updates, stats->coarse_updates,
+            stats->fine_updates, uniform, 100 * (1 - updates / uniform));
+
+    seconds = compare_reference(simulate, num_threads, result, ref_old,
+                                ref_current, i_max, t_max, &max_error, &rel_l2);
+    if (seconds >= 0)
+        printf("AMR: uniform run took %g seconds; max error %g, relative L2 "
+                "error %g\n", seconds, max_error, rel_l2);
+}
+
+/*
+ * Compares a parareal result with a one-thread serial run from the same
+ * first levels, and prints the iterations, the speedup and the error.
+ */
+static void parareal_report(const parareal_stats_t *stats, const double *result,
+        double seconds, double *ref_old, double *ref_current, long i_max,
+        long t_max, int num_threads)
+{
+    double max_error, rel_l2, serial;
+
+    printf("Parareal: %d windows, %d corrections, %s (last change %g)\n",
+            stats->windows, stats->iterations,
+            stats->converged ? "converged" : "not converged", stats->change);
+    printf("Parareal: critical path %g seconds, %.2fx faster than the fine "
+            "work with a core per window\n", stats->critical_seconds,
+            stats->fine_seconds / stats->critical_seconds);
+
+    serial = compare_reference(simulateSequential_v1, 1, result, ref_old,
+                               ref_current, i_max, t_max, &max_error, &rel_l2);
+    if (serial >= 0)
+        printf("Parareal: serial run took %g seconds, speedup %.2f on %d "
+                "threads; max difference %g\n", serial, serial / seconds,
+                num_threads, max_error);
+}
+
+/*
+ * Writes the state of a run that stopped early: both time levels, which
+ * are the initial data to resume from in file mode, and the step reached.
+ */
+static void write_partial(sim_session_t *session, long i_max, long t_max,
+        long t_start)
+{
+    long t;
+    double *current = session_peek(session, &t);
+    FILE *fp;
+
+    t += t_start;
+
+    write_exact("result_prev.txt", session_previous(session), i_max);
+    write_exact("result.txt", current, i_max);
+    fp = fopen("result.step", "w");
+    if (fp) {
+        fprintf(fp, "%ld\n", t);
+        fclose(fp);
+    }
+    printf("Stopped at step %ld of %ld; resume with "
+            "\"%ld %ld file result_prev.txt result.txt\"\n",
+            t, t_max, i_max, t_max - t);
+}
 
 int main(int argc, char *argv[])
 {
     double *old, *current, *next, *ret;
-    int t_max, i_max, num_threads;
+    long t_max, i_max;
+    int num_threads;
     double time;
+    simulate_func_t engine = engines[0].func;
+    sim_diag_t diag = { 0, NULL };
+    int arena_flags = 0;
+    const char *ooc_dir = NULL;
+    amr_params_t amr = { 2, 8, 0.02 };
+    amr_stats_t amr_stats;
+    int use_amr = 0;
+    parareal_params_t parareal = { 0, 1e-9, 0, 2 };
+    parareal_stats_t parareal_stats;
+    int use_parareal = 0;
+    double *ref_old = NULL, *ref_current = NULL;
+    int adjoint_slots = 0;
+    const char *cache_dir = NULL;
+    long cache_max = 1L << 30, cached = 0;
+    cache_t cache;
+    long region_a = -1, region_b = -1;
+    const char *adjoint_target = NULL;
+    double *target = NULL;
+    adjoint_result_t adjoint;
+    int zmode = -1;
+    double zeps = 0;
+    int zcheck = 0;
+    const char *manifest = NULL;
+    output_mode_t output = { OUTPUT_FULL, 0 };
+    const char *probe_spec = NULL, *probe_path = "probes.csv";
+    probe_set_t *probes = NULL;
+    const char *raster_spec = NULL;
+    raster_t *raster = NULL;
+    progress_opts_t popts = { NULL, 1, 0, &stop_requested };
+    sim_session_t *session = NULL;
+    progress_t progress;
+    int stopped = 0;
+    long t_done;
+    int ran_engine = 0;
+    int status = EXIT_SUCCESS;
+    int i, j;
+
+    /* Strip --option=value arguments, keeping the positional ones in order. */
+    for (i = 1, j = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--engine=", 9) == 0) {
+            int e;
+            for (e = 0; e < num_engines; e++) {
+                if (strcmp(argv[i] + 9, engines[e].name) == 0)
+                    break;
+            }
+            if (e == num_engines) {
+                printf("Unknown engine: %s.\n", argv[i] + 9);
+                return EXIT_FAILURE;
+            }
+            engine = engines[e].func;
+        } else if (strncmp(argv[i], "--kernel=", 9) == 0) {
+            int kernel = kernel_parse(argv[i] + 9);
+
+            if (kernel < 0) {
+                printf("Unknown kernel: %s.\n", argv[i] + 9);
+                return EXIT_FAILURE;
+            }
+            kernel_set_mode(kernel);
+        } else if (strcmp(argv[i], "--prefault") == 0) {
+            arena_flags = ARENA_POPULATE | ARENA_LOCK;
+        } else if (strcmp(argv[i], "--amr") == 0) {
+            use_amr = 1;
+        } else if (strncmp(argv[i], "--amr=", 6) == 0) {
+            use_amr = 1;
+            if (sscanf(argv[i] + 6, "%d:%ld:%lf", &amr.ratio, &amr.regrid,
+                        &amr.tol) < 1) {
+                printf("argument error: --amr=RATIO[:REGRID[:TOL]].\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--parareal") == 0) {
+            use_parareal = 1;
+        } else if (strncmp(argv[i], "--parareal=", 11) == 0) {
+            use_parareal = 1;
+            if (sscanf(argv[i] + 11, "%d:%lf:%d:%d", &parareal.windows,
+                        &parareal.tol, &parareal.max_iter, &parareal.ratio) < 1) {
+                printf("argument error: --parareal=WINDOWS[:TOL[:ITERATIONS"
+                        "[:RATIO]]].\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--adjoint=", 10) == 0) {
+            adjoint_slots = atoi(argv[i] + 10);
+            if (adjoint_slots < 1) {
+                printf("argument error: --adjoint should be >=1.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--adjoint-target=", 17) == 0) {
+            adjoint_target = argv[i] + 17;
+        } else if (strncmp(argv[i], "--region=", 9) == 0) {
+            if (sscanf(argv[i] + 9, "%ld:%ld", &region_a, &region_b) != 2) {
+                printf("argument error: --region=A:B.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+            cache_dir = argv[i] + 8;
+        } else if (strncmp(argv[i], "--cache-max=", 12) == 0) {
+            cache_max = cache_parse_size(argv[i] + 12);
+            if (cache_max < 0) {
+                printf("argument error: --cache-max=BYTES[K|M|G].\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--ooc=", 6) == 0) {
+            ooc_dir = argv[i] + 6;
+        } else if (strcmp(argv[i], "--compress=lossless") == 0) {
+            zmode = ZSTATE_LOSSLESS;
+        } else if (strncmp(argv[i], "--compress=lossy:", 17) == 0) {
+            zmode = ZSTATE_LOSSY;
+            zeps = atof(argv[i] + 17);
+            if (!(zeps > 0)) {
+                printf("argument error: lossy eps should be >0.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--compress-check") == 0) {
+            zcheck = 1;
+        } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+            manifest = argv[i] + 8;
+        } else if (strncmp(argv[i], "--diag=", 7) == 0) {
+            diag.every = atoi(argv[i] + 7);
+            if (diag.every < 1) {
+                printf("argument error: --diag should be >=1.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--metrics=", 10) == 0) {
+            char *colon = strrchr(argv[i] + 10, ':');
+
+            popts.metrics_path = argv[i] + 10;
+            if (colon != NULL) {
+                *colon = '\0';
+                popts.interval = atof(colon + 1);
+                if (!(popts.interval > 0)) {
+                    printf("argument error: metrics interval should be >0.\n");
+                    return EXIT_FAILURE;
+                }
+            }
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            if (output_parse(argv[i] + 9, &output) != 0) {
+                printf("Unknown output mode: %s.\n", argv[i] + 9);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--probes=", 9) == 0) {
+            probe_spec = argv[i] + 9;
+        } else if (strncmp(argv[i], "--probe-out=", 12) == 0) {
+            probe_path = argv[i] + 12;
+        } else if (strncmp(argv[i], "--raster=", 9) == 0) {
+            raster_spec = argv[i] + 9;
+        } else if (strncmp(argv[i], "--deadline=", 11) == 0) {
+            popts.deadline = atof(argv[i] + 11);
+            if (!(popts.deadline > 0)) {
+                printf("argument error: --deadline should be >0.\n");
+                return EXIT_FAILURE;
+            }
+        } else {
+            argv[j++] = argv[i];
+        }
+    }
+    argc = j;
+
+    /* Batch mode takes the core count as its only positional argument. */
+    if (manifest != NULL) {
+        int cores = argc > 1 ? atoi(argv[1]) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (cores < 1) {
+            printf("argument error: cores should be >=1.\n");
+            return EXIT_FAILURE;
+        }
+        return batch_run(manifest, cores) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
     /* Parse commandline args: i_max t_max num_threads */
     if (argc < 4) {
-        printf("Usage: %s i_max t_max num_threads [initial_data]\n", argv[0]);
+        printf("Usage: %s [options] i_max t_max num_threads [initial_data]\n",
+                argv[0]);
         printf(" - i_max: number of discrete amplitude points, should be >2\n");
         printf(" - t_max: number of discrete timesteps, should be >=1\n");
         printf(" - num_threads: number of threads to use for simulation, "
@@ -69,12 +375,72 @@ int main(int argc, char *argv[])
         printf("    * gauss: a single gauss-function at the start.\n");
         printf("    * file <2 filenames>: allows you to specify a file with on "
                 "each line a float for both generations.\n");
+        printf(" - options:\n");
+        printf("    * --engine=NAME: simulation engine, one of");
+        for (i = 0; i < num_engines; i++)
+            printf(" %s", engines[i].name);
+        printf(" (default %s).\n", engines[0].name);
+        printf("    * --kernel=auto|plain|stream: stencil kernel; auto "
+                "streams the stores once one level outgrows the cache "
+                "below the last level.\n");
+        printf("    * --prefault: fault in and lock the buffer arena before "
+                "the timed run.\n");
+        printf("    * --diag=K: write energy, L2 norm and max |u| every K "
+                "steps to diagnostics.csv (barrier engine only).\n");
+        printf("    * --amr[=RATIO[:REGRID[:TOL]]]: adaptive mesh refinement "
+                "on a grid RATIO times coarser (default 2:8:0.02), then a "
+                "uniform run to report the error.\n");
+        printf("    * --parareal[=WINDOWS[:TOL[:ITERATIONS[:RATIO]]]]: "
+                "parallel in time over WINDOWS windows (default num_threads), "
+                "corrected by a grid RATIO times coarser (default 2) until "
+                "no state moves more than TOL (default 1e-9) relative, at "
+                "most ITERATIONS times (default WINDOWS); then a serial run "
+                "to report the speedup.\n");
+        printf("    * --adjoint=SLOTS: also compute dJ/dc for J = 1/2 "
+                "|u_final - target|^2 by an adjoint sweep, keeping SLOTS "
+                "states (binomial checkpointing).\n");
+        printf("    * --adjoint-target=FILE: the target of --adjoint "
+                "(default all zeros).\n");
+        printf("    * --region=A:B: compute only the final state on points "
+                "A..B, from their backward light cone, on one thread; "
+                "result.txt holds just those points.\n");
+        printf("    * --cache=DIR: reuse final states cached in DIR under "
+                "a hash of the size and initial data; a longer run resumes "
+                "from the longest cached prefix (barrier engine only).\n");
+        printf("    * --cache-max=BYTES[K|M|G]: bound on the cache, least "
+                "recently used entries go first (default 1G).\n");
+        printf("    * --ooc=DIR: keep the time levels in files under DIR "
+                "and run out of core.\n");
+        printf("    * --batch=MANIFEST [cores]: run the jobs listed in "
+                "MANIFEST (\"i_max t_max initial_data output\" per line) packed "
+                "onto cores (default: all online).\n");
+        printf("    * --compress=lossless|lossy:EPS: keep the time levels "
+                "block-compressed, lossy ones to within EPS per store.\n");
+        printf("    * --compress-check: rerun uncompressed afterwards and "
+                "report the accumulated error (needs memory for three more "
+                "levels).\n");
+        printf("    * --output=full|decimate:W|envelope:W|digest: write "
+                "result.txt in full, as W evenly spaced points, as W min/max "
+                "buckets or as a checksum with summary statistics.\n");
+        printf("    * --probes=I,J,...|@FILE: record the wave at these "
+                "points every step (barrier engine only).\n");
+        printf("    * --probe-out=FILE: probe output, CSV or columnar binary "
+                "if FILE ends in .bin (default probes.csv).\n");
+        printf("    * --raster=FILE[:WxH[:mean|min|max|range]]: write a "
+                "space-time heatmap of the run to FILE (.png or .ppm), "
+                "binned during the sweep (barrier engine only).\n");
+        printf("    * --metrics=FILE[:SECONDS]: refresh Prometheus-format "
+                "progress metrics in FILE every SECONDS (default 1) "
+                "(barrier engine only).\n");
+        printf("    * --deadline=SECONDS: stop at the step boundary reached "
+                "after SECONDS and write the partial state (barrier engine "
+                "only; SIGTERM does the same).\n");
 
         return EXIT_FAILURE;
     }
 
-    i_max = atoi(argv[1]);
-    t_max = atoi(argv[2]);
+    i_max = strtol(argv[1], NULL, 10);
+    t_max = strtol(argv[2], NULL, 10);
     num_threads = atoi(argv[3]);
 
     if (i_max < 3) {
@@ -90,210 +456,357 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    /* Allocate and initialize buffers. */
-    old = malloc(i_max * sizeof(double));
-    current = malloc(i_max * sizeof(double));
-    next = malloc(i_max * sizeof(double));
+    /* How should we will our first two generations? Default to sinus. */
+    const char *mode = argc > 4 ? argv[4] : "sin";
+    init_fill_t fills[3];
+    double *buffers[3];
+    arena_t arena;
+    ooc_t ooc;
+    zstate_t *zs = NULL;
 
-    if (old == NULL || current == NULL || next == NULL) {
-        fprintf(stderr, "Could not allocate enough memory, aborting.\n");
+    if (init_mode_fills(mode, i_max, fills) != 0) {
+        printf("Unknown initial mode: %s.\n", mode);
+        return EXIT_FAILURE;
+    }
+    if (strcmp(mode, "file") == 0 && argc < 7) {
+        printf("No files specified!\n");
         return EXIT_FAILURE;
     }
 
-    memset(old, 0, i_max * sizeof(double));
-    memset(current, 0, i_max * sizeof(double));
-    memset(next, 0, i_max * sizeof(double));
-
-    /* How should we will our first two generations? */
-    if (argc > 4) {
-        if (strcmp(argv[4], "sin") == 0) {
-            fill(old, 1, i_max/4, 0, 2*3.14, sin);
-            fill(current, 2, i_max/4, 0, 2*3.14, sin);
-        } else if (strcmp(argv[4], "sinfull") == 0) {
-            fill(old, 1, i_max-2, 0, 10*3.14, sin);
-            fill(current, 2, i_max-3, 0, 10*3.14, sin);
-        } else if (strcmp(argv[4], "gauss") == 0) {
-            fill(old, 1, i_max/4, -3, 3, gauss);
-            fill(current, 2, i_max/4, -3, 3, gauss);
-        } else if (strcmp(argv[4], "file") == 0) {
-            if (argc < 7) {
-                printf("No files specified!\n");
-                return EXIT_FAILURE;
-            }
-            file_read_double_array(argv[5], old, i_max);
-            file_read_double_array(argv[6], current, i_max);
-        } else {
-            printf("Unknown initial mode: %s.\n", argv[4]);
+    /* Every option conflict is caught before anything is allocated. */
+    if (diag.every > 0 || popts.metrics_path != NULL || popts.deadline > 0 ||
+            probe_spec != NULL || raster_spec != NULL) {
+        if (engine != simulate || ooc_dir != NULL || zmode >= 0 || use_amr ||
+                use_parareal || adjoint_slots > 0) {
+            printf("argument error: --diag, --probes, --raster, --metrics and "
+                    "--deadline need the barrier engine.\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (use_parareal) {
+        if (parareal.windows == 0)
+            parareal.windows = num_threads;
+        if (parareal.max_iter == 0)
+            parareal.max_iter = parareal.windows;
+        if (use_amr) {
+            printf("argument error: --amr and --parareal exclude each other.\n");
             return EXIT_FAILURE;
         }
-    } else {
-        /* Default to sinus. */
-        fill(old, 1, i_max/4, 0, 2*3.14, sin);
-        fill(current, 2, i_max/4, 0, 2*3.14, sin);
+    }
+    if (zcheck && zmode < 0) {
+        printf("argument error: --compress-check needs --compress.\n");
+        return EXIT_FAILURE;
+    }
+    if (use_amr || use_parareal) {
+        if (ooc_dir != NULL || zmode >= 0 ||
+                (use_amr && amr_check(&amr, i_max, t_max) != 0) ||
+                (use_parareal && parareal_check(&parareal, i_max, t_max) != 0))
+            return EXIT_FAILURE;
+    }
+    if (adjoint_slots > 0 && (engine != simulate || ooc_dir != NULL ||
+                zmode >= 0 || use_amr || use_parareal)) {
+        printf("argument error: --adjoint needs the barrier engine.\n");
+        return EXIT_FAILURE;
+    }
+    if (region_a >= 0 || region_b >= 0) {
+        if (engine != simulate || num_threads > 1 || ooc_dir != NULL ||
+                zmode >= 0 || use_amr || use_parareal || adjoint_slots > 0 ||
+                cache_dir != NULL || diag.every > 0 || probe_spec != NULL ||
+                raster_spec != NULL || popts.metrics_path != NULL || popts.deadline > 0) {
+            printf("argument error: --region runs serially and on its own: "
+                    "one thread, the barrier engine and no other run options.\n");
+            return EXIT_FAILURE;
+        }
+        if (region_check(i_max, region_a, region_b) != 0)
+            return EXIT_FAILURE;
+    }
+    if (cache_dir != NULL && (engine != simulate || ooc_dir != NULL ||
+                zmode >= 0 || use_amr || use_parareal || adjoint_slots > 0 ||
+                diag.every > 0 || probe_spec != NULL || raster_spec != NULL)) {
+        printf("argument error: --cache needs the barrier engine, without "
+                "--diag, --probes or --raster.\n");
+        return EXIT_FAILURE;
     }
 
+    /* Allocate and initialize buffers, each thread touching its own chunk. */
+    if (ooc_dir != NULL) {
+        if (ooc_create(&ooc, ooc_dir, i_max) != 0) {
+            fprintf(stderr, "Could not set up out-of-core files, aborting.\n");
+            return EXIT_FAILURE;
+        }
+        buffers[0] = ooc.levels[0];
+        buffers[1] = ooc.levels[1];
+        buffers[2] = NULL;
+        init_fill(buffers, fills, 2, i_max, num_threads);
+    } else if (zmode >= 0) {
+        /* Only one uncompressed buffer: it stages each level and the result. */
+        if (arena_init(&arena, arena_footprint(i_max * sizeof(double)),
+                    arena_flags) != 0 ||
+                (buffers[0] = arena_alloc(&arena, i_max * sizeof(double))) == NULL ||
+                (zs = zstate_create(i_max, num_threads, zmode, zeps)) == NULL) {
+            fprintf(stderr, "Could not allocate enough memory, aborting.\n");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        /* Keep the first levels for the uncompressed rerun. */
+        if (zcheck) {
+            ref_old = malloc(i_max * sizeof(double));
+            ref_current = malloc(i_max * sizeof(double));
+        }
+        for (i = 0; i < 2; i++) {
+            double *ref = i == 0 ? ref_old : ref_current;
+
+            init_fill(buffers, &fills[i], 1, i_max, num_threads);
+            if (strcmp(mode, "file") == 0)
+                file_read_double_array(argv[5 + i], buffers[0], i_max);
+            if (ref != NULL)
+                memcpy(ref, buffers[0], i_max * sizeof(double));
+            if (zstate_load(zs, i, buffers[0]) != 0) {
+                fprintf(stderr, "Could not compress initial data, aborting.\n");
+                status = EXIT_FAILURE;
+                goto cleanup;
+            }
+        }
+        buffers[1] = buffers[2] = NULL;
+    } else if (arena_init(&arena, 3 * arena_footprint(i_max * sizeof(double)),
+                arena_flags) != 0 ||
+            init_buffers(&arena, i_max, num_threads, fills, buffers) != 0) {
+        fprintf(stderr, "Could not allocate enough memory, aborting.\n");
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+    old = buffers[0];
+    current = buffers[1];
+    next = buffers[2];
+
+    if (strcmp(mode, "file") == 0 && zs == NULL) {
+        file_read_double_array(argv[5], old, i_max);
+        file_read_double_array(argv[6], current, i_max);
+    }
+
+    /* From here on, failures go through the cleanup below. */
+    if (use_amr || use_parareal) {
+        /* Untouched first levels for the reference run. */
+        ref_old = malloc(i_max * sizeof(double));
+        ref_current = malloc(i_max * sizeof(double));
+        if (!ref_old || !ref_current) {
+            fprintf(stderr, "Could not allocate enough memory, aborting.\n");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        memcpy(ref_old, old, i_max * sizeof(double));
+        memcpy(ref_current, current, i_max * sizeof(double));
+    }
+    if (adjoint_slots > 0 && adjoint_target != NULL) {
+        target = calloc(i_max, sizeof(double));
+        if (!target) {
+            fprintf(stderr, "Could not allocate enough memory, aborting.\n");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        file_read_double_array(adjoint_target, target, i_max);
+    }
+    if (cache_dir != NULL) {
+        if (cache_open(&cache, cache_dir, cache_max, i_max, old, current,
+                       next) != 0) {
+            fprintf(stderr, "Could not open the cache in %s, aborting.\n",
+                    cache_dir);
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        cached = cache_lookup(&cache, t_max, old, current, next);
+    }
+    if (diag.every > 0) {
+        diag.fp = fopen("diagnostics.csv", "w");
+        if (!diag.fp) {
+            perror("Could not open diagnostics.csv");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+    }
+
+
+    /*
+     * The barrier engine runs as a session here so it can be watched and
+     * stopped at a step boundary; simulate() itself is the same session.
+     */
+    if (engine == simulate && ooc_dir == NULL && zs == NULL && !use_amr &&
+            !use_parareal && adjoint_slots == 0 && cached < t_max &&
+            region_a < 0) {
+        struct sigaction sa;
+
+        session = session_wrap(i_max, num_threads, old, current, next);
+        if (session == NULL ||
+                progress_start(&progress, session, t_max - cached, &popts) != 0) {
+            fprintf(stderr, "Could not start the simulation, aborting.\n");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        session_set_diag(session, diag.fp != NULL ? &diag : NULL);
+        if (probe_spec != NULL &&
+                ((probes = probe_open(probe_spec, probe_path, i_max)) == NULL ||
+                 session_set_probes(session, probes) != 0)) {
+            fprintf(stderr, "Could not set up the probes, aborting.\n");
+            progress_stop(&progress);
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        if (raster_spec != NULL &&
+                ((raster = raster_open(raster_spec, i_max, t_max)) == NULL ||
+                 session_set_raster(session, raster) != 0)) {
+            fprintf(stderr, "Could not set up the raster, aborting.\n");
+            progress_stop(&progress);
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = request_stop;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGTERM, &sa, NULL);
+        sigaction(SIGINT, &sa, NULL);
+    }
+
+    t_done = t_max;
     timer_start();
 
     /* Call the actual simulation that should be implemented in simulate.c. */
-    ret = simulate(i_max, t_max, num_threads, old, current, next);
+    if (ooc_dir != NULL) {
+        ret = ooc_simulate(&ooc, t_max, num_threads);
+    } else if (zs != NULL) {
+        ret = zstate_run(zs, t_max, buffers[0]);
+    } else if (use_amr) {
+        ret = simulate_amr(&amr, i_max, t_max, num_threads, old, current, next,
+                           &amr_stats);
+    } else if (use_parareal) {
+        ret = simulate_parareal(&parareal, i_max, t_max, num_threads, old,
+                                current, next, &parareal_stats);
+    } else if (adjoint_slots > 0) {
+        ret = adjoint_gradient(i_max, t_max, adjoint_slots, num_threads, old,
+                               current, next, target, &adjoint) == 0 ? next : NULL;
+    } else if (region_a >= 0) {
+        ret = simulate_region(i_max, t_max, region_a, region_b, old, current,
+                              next);
+    } else if (cached == t_max) {
+        ret = current;
+        t_done = 0;
+    } else if (session != NULL) {
+        stopped = session_step(session, t_max - cached);
+        ret = session_peek(session, &t_done);
+    } else {
+        ret = engine(i_max, t_max, num_threads, old, current, next);
+        ran_engine = 1;
+    }
 
     time = timer_end();
+    TRACE_DUMP();
+
+    if (session != NULL) {
+        progress_stop(&progress);
+        if (probes != NULL) {
+            session_set_probes(session, NULL);
+            probe_close(probes);
+        }
+        if (raster != NULL) {
+            session_set_raster(session, NULL);
+            raster_close(raster, num_threads);
+        }
+        if (stopped && progress.reason != NULL)
+            printf("Cancelled by %s\n", progress.reason);
+    }
+
+    if (diag.fp != NULL)
+        fclose(diag.fp);
     printf("Took %g seconds\n", time);
-    printf("Normalized: %g seconds\n", time / (i_max * t_max));
+    printf("Normalized: %g seconds\n", time / (1. * i_max * (t_done > 0 ? t_done : 1)));
+    if (ran_engine && engine == simulate_wavefront) {
+        wavefront_plan_t plan;
 
-    file_write_double_array("result.txt", ret, i_max);
+        wavefront_plan(i_max, num_threads, &plan);
+        printf("Wavefront: %ld tiles of %ld points, %d behind each other, "
+                "%.1f MiB window\n", plan.tiles, plan.tile, plan.lag,
+                plan.window_bytes / 1048576);
+        printf("Wavefront: modelled DRAM traffic %.1f bytes per point update "
+                "against %.1f for the barrier engine\n", plan.dram_bytes,
+                plan.barrier_bytes);
+    }
+    if (zs != NULL) {
+        zstate_stats_t zstats;
 
-    free(old);
-    free(current);
-    free(next);
+        zstate_stats(zs, &zstats);
+        printf("Compressed state: %zu of %zu bytes at peak (ratio %.2f), "
+                "max store error %g\n", zstats.peak_bytes, zstats.raw_bytes,
+                zstats.ratio, zstats.max_error);
+        zstate_destroy(zs);
+        zs = NULL;
+        if (ret != NULL && zcheck) {
+            double max_error, rel_l2;
 
-    return EXIT_SUCCESS;
-}
+            if (compare_reference(simulate, num_threads, ret, ref_old,
+                                  ref_current, i_max, t_max, &max_error,
+                                  &rel_l2) >= 0)
+                printf("Compressed state: accumulated max error %g, relative "
+                        "L2 error %g against the uncompressed run\n",
+                        max_error, rel_l2);
+            else
+                fprintf(stderr, "Could not rerun uncompressed.\n");
+        }
+    }
 
+    if (ret == NULL) {
+        fprintf(stderr, "Simulation failed, aborting.\n");
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+    if (cache_dir != NULL) {
+        if (cached < t_max && t_done > 0 &&
+                cache_store(&cache, cached + t_done, session_previous(session),
+                            ret) != 0)
+            fprintf(stderr, "Could not store the result in the cache.\n");
+        cache_report(&cache);
+    }
+    if (stopped) {
+        write_partial(session, i_max, t_max, cached);
+    } else if (region_a >= 0) {
+        const double updates = region_updates(i_max, t_max, region_a, region_b);
+
+        printf("Region: points %ld..%ld, %g point updates against %g for the "
+                "full run (%.2f%%)\n", region_a, region_b, updates,
+                (double) t_max * (i_max - 2),
+                100 * updates / ((double) t_max * (i_max - 2)));
+        if (output_write("result.txt", &output, ret + region_a,
+                         region_b - region_a + 1, num_threads) != 0)
+            fprintf(stderr, "Could not write result.txt.\n");
+    } else if (output_write("result.txt", &output, ret, i_max, num_threads) != 0) {
+        fprintf(stderr, "Could not write result.txt.\n");
+    }
 
-/**-----------------------------------------------------------------------------------------------*/
-
-//EXPERIMENT CODE
-
-// typedef double* (*simulate_func_t)(const int, const int, const int,
-//                                    double*, double*, double*);
-//
-// void runner(simulate_func_t sim_func, int t_max, int i_max, int num_threads, double* out_time) {
-//     double *old, *current, *next;
-//     double time;
-//
-//     /* Allocate buffers */
-//     old = malloc(i_max * sizeof(double));
-//     current = malloc(i_max * sizeof(double));
-//     next = malloc(i_max * sizeof(double));
-//     if (!old || !current || !next) {
-//         fprintf(stderr, "Memory allocation failed\n");
-//         return;
-//     }
-//     memset(old, 0, i_max * sizeof(double));
-//     memset(current, 0, i_max * sizeof(double));
-//     memset(next, 0, i_max * sizeof(double));
-//
-//     /* Initialize first two generations (sinus by default) */
-//     fill(old, 1, i_max / 4, 0, 2*3.14, sin);
-//     fill(current, 2, i_max / 4, 0, 2*3.14, sin);
-//
-//     timer_start();
-//     sim_func(i_max, t_max, num_threads, old, current, next);  // choose implementation based on version if needed
-//     time = timer_end();
-//
-//     *out_time = time;  // return elapsed time
-//
-//     free(old);
-//     free(current);
-//     free(next);
-// }
-//
-//
-// //EXPERIMENT 1: check report for more details
-// void experiment1(void) {
-//     FILE *fp = fopen("./results_ex1.csv", "w");
-//     if (!fp) {
-//         perror("Could not open results_ex1.csv");
-//         return;
-//     }
-//
-//     fprintf(fp, "simulate_version,i_max,t_max,num_threads,time_seconds,normalized_time\n");
-//
-//
-//     int i_max_values[] = {1000, 10000, 100000, 1000000, 10000000};
-//     int num_i = sizeof(i_max_values) / sizeof(i_max_values[0]);
-//
-//     int num_threads = 4;
-//     int t_max = 100;
-//
-//     for (int version = 1; version <= 3; version++) {
-//         for (int i = 0; i < num_i; i++) {
-//             int i_max = i_max_values[i];
-//             double elapsed_time;
-//
-//
-//             if (version==1)
-//                 runner(simulateSequential_v1, t_max, i_max, num_threads, &elapsed_time);
-//             else  if (version==2)
-//                 runner(simulate_v2, t_max, i_max, num_threads, &elapsed_time);
-//             else
-//                 runner(simulate, t_max, i_max, num_threads, &elapsed_time);
-//
-//             // Write results to CSV
-//             fprintf(fp, "%d,%d,%d,%d,%g,%g\n",
-//                     version, i_max, t_max, num_threads, elapsed_time, elapsed_time / (i_max * t_max));
-//
-//             printf("Version %d, i_max=%d -> %g seconds\n", version, i_max, elapsed_time);
-//         }
-//     }
-//
-//     fclose(fp);
-//     printf("All results saved to results_ex1.csv\n");
-// }
-//
-// //EXPERIMENT 2: check report for more details
-// void experiment2(void) {
-//     FILE *fp = fopen("./results_ex2.csv", "w");
-//     if (!fp) {
-//         perror("Could not open results_ex2.csv");
-//         return;
-//     }
-//
-//     fprintf(fp, "i_max,t_max,num_threads,time_seconds,speedup\n");
-//
-//     // You can adjust these
-//     int i_max_values[] = {1000, 100000, 1000000};
-//     int t_max_values[] = {100, 1000, 4000};
-//
-//     int num_i = sizeof(i_max_values) / sizeof(i_max_values[0]);
-//     int num_t = sizeof(t_max_values) / sizeof(t_max_values[0]);
-//
-//     int thread_counts[] = {1, 2, 4, 6, 8, 12, 14, 16};
-//     int num_threads_options = sizeof(thread_counts) / sizeof(thread_counts[0]);
-//
-//
-//     for (int a = 0; a < num_i; a++) {
-//         for (int b = 0; b < num_t; b++) {
-//
-//             int i_max = i_max_values[a];
-//             int t_max = t_max_values[b];
-//
-//             double base_time = 0.0;
-//
-//             printf("\n--- i_max=%d, t_max=%d ---\n", i_max, t_max);
-//
-//             for (int tc = 0; tc < num_threads_options; tc++) {
-//
-//                 int num_threads = thread_counts[tc];
-//                 double elapsed_time;
-//
-//                 // run simulation (always using optimized v3)
-//                 runner(simulate, t_max, i_max, num_threads, &elapsed_time);
-//
-//                 // first run (1 thread) becomes baseline
-//                 if (num_threads == 1)
-//                     base_time = elapsed_time;
-//
-//                 double speedup = base_time / elapsed_time;
-//
-//                 fprintf(fp, "%d,%d,%d,%g,%g\n",
-//                         i_max, t_max, num_threads, elapsed_time, speedup);
-//
-//                 printf("Threads=%d -> %g seconds, Speedup=%.2fx\n",
-//                        num_threads, elapsed_time, speedup);
-//             }
-//         }
-//     }
-//
-//     fclose(fp);
-//     printf("All results saved to results_ex2.csv\n");
-// }
-//
-//
-//
-// int main(void)
-// {
-//     experiment2();
-//     return 0;
-// }
\ No newline at end of file
+    if (adjoint_slots > 0) {
+        printf("Adjoint: J = %.17g, dJ/dc = %.17g\n", adjoint.misfit,
+                adjoint.gradient);
+        printf("Checkpointing: %d slots for %ld states, %ld forward steps "
+                "(%.2f per step), optimum %ld (%.2f per step)\n",
+                adjoint_slots, t_max + 1, adjoint.forward_steps,
+                (double) adjoint.forward_steps / (t_max > 0 ? t_max : 1),
+                adjoint.optimum, (double) adjoint.optimum / (t_max > 0 ? t_max : 1));
+        free(target);
+    }
+    if (use_parareal)
+        parareal_report(&parareal_stats, ret, time, ref_old, ref_current, i_max,
+                        t_max, num_threads);
+    if (use_amr)
+        amr_report(&amr_stats, ret, ref_old, ref_current, i_max, t_max, num_threads);
+
+cleanup:
+    /* The session was wrapped around the arena's buffers: end it first. */
+    if (session != NULL)
+        session_destroy(session);
+    if (zs != NULL)
+        zstate_destroy(zs);
+    if (ooc_dir != NULL)
+        ooc_destroy(&ooc);
+    else
+        arena_destroy(&arena);
+
+    return status;
+}
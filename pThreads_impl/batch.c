@@ -0,0 +1,394 @@
+/*
+ * batch.c
+ *
+ * Batch runner.
+ *
+ * A manifest lists one job per line: "i_max t_max initial_data output",
+ * where initial_data is sin, sinfull or gauss and output is the file the
+ * result is written to ("-" for none). Blank lines and lines starting with
+ * '#' are ignored.
+ *
+ * A short calibration measures the cost of a point update and of one
+ * barrier step. From those the runner gives every job a gang size: the
+ * largest thread count whose per-step synchronisation stays below a
+ * quarter of the per-thread compute, so small grids run single-threaded
+ * (where extra threads only slow them down) and large ones get a gang.
+ * Jobs are then started longest-estimate first, each as soon as enough
+ * cores are free, with smaller jobs backfilling idle cores. A job's
+ * threads are confined to the cores it was given (the runner thread sets
+ * its affinity and the gang inherits it), so gangs never share a core.
+ * The run reports throughput, per-core utilisation and how well the model
+ * predicted the job times.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "simulate.h"
+#include "generatedata.h"
+#include "arena.h"
+#include "file.h"
+#include "timer.h"
+
+#define BATCH_PATH_MAX 1024
+
+/* Largest fraction of a gang member's step spent waiting at barriers. */
+#define BATCH_SYNC_SHARE 0.25
+
+enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE, JOB_JOINED };
+
+typedef struct Batch Batch;
+
+typedef struct {
+    long i_max, t_max;
+    char mode[16];
+    char output[BATCH_PATH_MAX];
+
+    int gang;
+    double estimate;       /* predicted seconds */
+    double seconds;        /* measured seconds */
+    int state, failed;
+    cpu_set_t cpus;        /* the cores it was packed onto */
+    pthread_t thread;
+    Batch *batch;
+} BatchJob;
+
+struct Batch {
+    BatchJob *jobs;
+    int num_jobs;
+    int cores, free_cores;
+    int *core_owner;       /* job index per core, -1 when idle */
+    int *core_cpu;         /* the CPU each core stands for */
+    double *core_busy;     /* seconds per core */
+
+    double update_ns;      /* one point update, single thread */
+    double step_sync_ns;   /* one barrier step, per gang member */
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+
+static int load_manifest(Batch *b, const char *manifest)
+{
+    FILE *fp = fopen(manifest, "r");
+    char line[BATCH_PATH_MAX + 128];
+    int cap = 0, lineno = 0;
+
+    if (!fp) {
+        perror(manifest);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        BatchJob job;
+        init_fill_t fills[3];
+        char fmt[32];
+
+        lineno++;
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line))
+            continue;
+
+        memset(&job, 0, sizeof(job));
+        snprintf(fmt, sizeof(fmt), "%%ld %%ld %%15s %%%ds", BATCH_PATH_MAX - 1);
+        if (sscanf(line, fmt, &job.i_max, &job.t_max, job.mode, job.output) != 4 ||
+                job.i_max < 3 || job.t_max < 1 || strcmp(job.mode, "file") == 0 ||
+                init_mode_fills(job.mode, job.i_max, fills) != 0) {
+            fprintf(stderr, "%s:%d: expected \"i_max t_max sin|sinfull|gauss "
+                    "output\"\n", manifest, lineno);
+            fclose(fp);
+            return -1;
+        }
+
+        if (b->num_jobs == cap) {
+            BatchJob *jobs;
+
+            cap = cap ? 2 * cap : 64;
+            jobs = realloc(b->jobs, cap * sizeof(BatchJob));
+            if (jobs == NULL) {
+                fclose(fp);
+                return -1;
+            }
+            b->jobs = jobs;
+        }
+        b->jobs[b->num_jobs++] = job;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Maps the cores onto the CPUs this process may run on, in order. Asking
+ * for more cores than there are CPUs wraps around and shares them.
+ */
+static void map_cores(Batch *b)
+{
+    cpu_set_t allowed;
+    int cpu = -1, c;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 ||
+            CPU_COUNT(&allowed) == 0) {
+        CPU_ZERO(&allowed);
+        for (c = 0; c < b->cores && c < CPU_SETSIZE; c++)
+            CPU_SET(c, &allowed);
+    }
+    for (c = 0; c < b->cores; c++) {
+        do
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        while (!CPU_ISSET(cpu, &allowed));
+        b->core_cpu[c] = cpu;
+    }
+}
+
+/*
+ * Measures the two cost model constants on this machine.
+ */
+static void calibrate(Batch *b)
+{
+    const long i_max = 1 << 14, t_max = 200, small = 258;
+    double *buffers[3], seconds;
+    int k;
+
+    for (k = 0; k < 3; k++)
+        buffers[k] = calloc(i_max, sizeof(double));
+    if (!buffers[0] || !buffers[1] || !buffers[2]) {
+        b->update_ns = 1;
+        b->step_sync_ns = 5000;
+    } else {
+        timer_start();
+        simulateSequential_v1(i_max, t_max, 1, buffers[0], buffers[1], buffers[2]);
+        seconds = timer_end();
+        b->update_ns = 1e9 * seconds / (i_max * t_max);
+
+        /* A tiny grid is all synchronisation. */
+        timer_start();
+        simulate(small, t_max, 2, buffers[0], buffers[1], buffers[2]);
+        seconds = timer_end();
+        b->step_sync_ns = 1e9 * seconds / t_max - b->update_ns * small / 2;
+        if (b->step_sync_ns < 100)
+            b->step_sync_ns = 100;
+    }
+
+    for (k = 0; k < 3; k++)
+        free(buffers[k]);
+}
+
+/*
+ * Sync share of a gang of g:  g * sync / (i_max * update / g) <= share,
+ * so g <= sqrt(share * i_max * update / sync).
+ */
+static void plan_job(const Batch *b, BatchJob *job)
+{
+    int g = 1;
+
+    while (g < b->cores &&
+            (double) (g + 1) * (g + 1) * b->step_sync_ns
+                <= BATCH_SYNC_SHARE * job->i_max * b->update_ns)
+        g++;
+
+    job->gang = g;
+    job->estimate = 1e-9 * job->t_max *
+        (job->i_max * b->update_ns / g + (g > 1 ? g * b->step_sync_ns : 0));
+}
+
+static int by_estimate(const void *x, const void *y)
+{
+    const BatchJob *a = x, *b = y;
+
+    return (a->estimate < b->estimate) - (a->estimate > b->estimate);
+}
+
+static void *batch_job(void *arg)
+{
+    BatchJob *job = (BatchJob *) arg;
+    Batch *b = job->batch;
+    const int index = job - b->jobs;
+    init_fill_t fills[3];
+    double *buffers[3], *ret = NULL;
+    struct timespec start;
+    arena_t arena;
+    int c;
+
+    /* simulate()'s workers inherit this. */
+    pthread_setaffinity_np(pthread_self(), sizeof(job->cpus), &job->cpus);
+    timer_start_r(&start);
+
+    init_mode_fills(job->mode, job->i_max, fills);
+    if (arena_init(&arena, 3 * arena_footprint(job->i_max * sizeof(double)), 0) == 0) {
+        if (init_buffers(&arena, job->i_max, job->gang, fills, buffers) == 0) {
+            if (job->gang == 1)
+                ret = simulateSequential_v1(job->i_max, job->t_max, 1,
+                                            buffers[0], buffers[1], buffers[2]);
+            else
+                ret = simulate(job->i_max, job->t_max, job->gang,
+                               buffers[0], buffers[1], buffers[2]);
+        }
+        if (ret != NULL && strcmp(job->output, "-") != 0)
+            file_write_double_array(job->output, ret, job->i_max);
+        arena_destroy(&arena);
+    }
+
+    pthread_mutex_lock(&b->lock);
+    job->seconds = timer_end_r(&start);
+    job->failed = ret == NULL;
+    job->state = JOB_DONE;
+    for (c = 0; c < b->cores; c++) {
+        if (b->core_owner[c] == index) {
+            b->core_owner[c] = -1;
+            b->core_busy[c] += job->seconds;
+        }
+    }
+    b->free_cores += job->gang;
+    pthread_cond_signal(&b->done);
+    pthread_mutex_unlock(&b->lock);
+
+    return NULL;
+}
+
+static void start_job(Batch *b, int index)
+{
+    BatchJob *job = &b->jobs[index];
+    int c, taken = 0;
+
+    CPU_ZERO(&job->cpus);
+    for (c = 0; c < b->cores && taken < job->gang; c++) {
+        if (b->core_owner[c] < 0) {
+            b->core_owner[c] = index;
+            CPU_SET(b->core_cpu[c], &job->cpus);
+            taken++;
+        }
+    }
+    b->free_cores -= job->gang;
+    job->state = JOB_RUNNING;
+    job->batch = b;
+    pthread_create(&job->thread, NULL, batch_job, job);
+}
+
+static void report(const Batch *b, double makespan)
+{
+    double updates = 0, busy = 0, predicted = 0, actual = 0;
+    int failed = 0, gangs = 0, c, j;
+
+    for (j = 0; j < b->num_jobs; j++) {
+        const BatchJob *job = &b->jobs[j];
+
+        updates += (double) job->i_max * job->t_max;
+        predicted += job->estimate;
+        actual += job->seconds;
+        failed += job->failed;
+        gangs += job->gang > 1;
+    }
+
+    printf("Batch: %d jobs (%d ganged, %d failed) on %d cores in %g seconds\n",
+            b->num_jobs, gangs, failed, b->cores, makespan);
+    printf("Throughput: %g jobs/s, %g point updates/s\n",
+            b->num_jobs / makespan, updates / makespan);
+    printf("Cost model: %.3g ns/update, %.3g ns/barrier step; "
+            "predicted %g s of job time, measured %g s\n",
+            b->update_ns, b->step_sync_ns, predicted, actual);
+
+    printf("Core utilisation:");
+    for (c = 0; c < b->cores; c++) {
+        printf(" %.0f%%", 100 * b->core_busy[c] / makespan);
+        busy += b->core_busy[c];
+    }
+    printf(" (mean %.0f%%)\n", 100 * busy / (b->cores * makespan));
+}
+
+/*
+ * Runs every job of `manifest' on `cores' cores. Returns 0 when all jobs
+ * succeeded.
+ */
+int batch_run(const char *manifest, int cores)
+{
+    Batch b;
+    struct timespec start;
+    int next = 0, running = 0, failed = 0, j;
+
+    memset(&b, 0, sizeof(b));
+    b.cores = b.free_cores = cores;
+
+    if (load_manifest(&b, manifest) != 0) {
+        free(b.jobs);
+        return -1;
+    }
+    if (b.num_jobs == 0) {
+        printf("Batch: %s lists no jobs\n", manifest);
+        free(b.jobs);
+        return 0;
+    }
+
+    b.core_owner = malloc(cores * sizeof(int));
+    b.core_cpu = malloc(cores * sizeof(int));
+    b.core_busy = calloc(cores, sizeof(double));
+    if (!b.core_owner || !b.core_cpu || !b.core_busy) {
+        free(b.jobs);
+        free(b.core_owner);
+        free(b.core_cpu);
+        free(b.core_busy);
+        return -1;
+    }
+    for (j = 0; j < cores; j++)
+        b.core_owner[j] = -1;
+    map_cores(&b);
+
+    calibrate(&b);
+    for (j = 0; j < b.num_jobs; j++)
+        plan_job(&b, &b.jobs[j]);
+    qsort(b.jobs, b.num_jobs, sizeof(BatchJob), by_estimate);
+
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.done, NULL);
+    timer_start_r(&start);
+
+    pthread_mutex_lock(&b.lock);
+    while (next < b.num_jobs || running > 0) {
+        int started = 0;
+
+        /* Longest first; anything that fits may backfill. */
+        for (j = next; j < b.num_jobs && b.free_cores > 0; j++) {
+            if (b.jobs[j].state == JOB_QUEUED && b.jobs[j].gang <= b.free_cores) {
+                start_job(&b, j);
+                running++;
+                started = 1;
+            }
+        }
+        while (next < b.num_jobs && b.jobs[next].state != JOB_QUEUED)
+            next++;
+
+        if (!started || b.free_cores == 0)
+            pthread_cond_wait(&b.done, &b.lock);
+
+        for (j = 0; j < b.num_jobs; j++) {
+            if (b.jobs[j].state == JOB_DONE) {
+                pthread_join(b.jobs[j].thread, NULL);
+                b.jobs[j].state = JOB_JOINED;
+                running--;
+            }
+        }
+    }
+    pthread_mutex_unlock(&b.lock);
+
+    report(&b, timer_end_r(&start));
+
+    for (j = 0; j < b.num_jobs; j++)
+        failed += b.jobs[j].failed;
+
+    pthread_cond_destroy(&b.done);
+    pthread_mutex_destroy(&b.lock);
+    free(b.jobs);
+    free(b.core_owner);
+    free(b.core_cpu);
+    free(b.core_busy);
+
+    return failed ? -1 : 0;
+}
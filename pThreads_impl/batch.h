@@ -0,0 +1,11 @@
+/*
+ * batch.h
+ *
+ * Batch runner: packs the jobs of a manifest onto a fixed number of cores
+ * for aggregate throughput.
+ *
+ */
+
+#pragma once
+
+int batch_run(const char *manifest, int cores);
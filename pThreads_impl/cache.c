@@ -0,0 +1,432 @@
+/*
+ * cache.c
+ *
+ * Content-addressed result cache, see cache.h.
+ *
+ * A lookup takes the entry with the largest t <= t_max for the key and
+ * loads it into the caller's buffers as if the run had got there itself:
+ * level t in old, level t + 1 in current, and the boundary values level
+ * t + 2 has in the uninterrupted run in next (they rotate with the
+ * buffers and are never written). Running the remaining t_max - t steps
+ * from there is then bit-identical to running all of them.
+ *
+ * Entries are written to a temporary file and renamed into place, so
+ * concurrent runs never read half an entry. Eviction and the stats file
+ * are serialised with an fcntl() lock on the directory's "lock" file.
+ * Recency is the file's modification time, which a hit refreshes.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "kernel.h"
+
+#define FNV_OFFSET UINT64_C(14695981039346656037)
+#define FNV_PRIME UINT64_C(1099511628211)
+
+
+static const char magic[8] = "WSTATE1";
+
+/* Hashed into every key, so a different update never hits old entries. */
+static const double stencil_c = STENCIL_C;
+
+typedef struct {
+    int64_t i_max, t;
+    uint64_t key;
+    double edges[2];
+} EntryHeader;
+
+typedef struct {
+    char name[64];
+    long size;
+    time_t mtime;
+    uint64_t key;
+    long t;
+} Entry;
+
+/* Counters kept in the stats file, in this order. */
+enum { STAT_HITS, STAT_PARTIAL, STAT_MISSES, STAT_EVICTIONS, NUM_STATS };
+
+static const char *stat_names[NUM_STATS] = {
+    "hits", "partial", "misses", "evictions"
+};
+
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    size_t k;
+
+    for (k = 0; k < size; k++) {
+        hash ^= p[k];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/*
+ * Parses a byte count with an optional K, M or G suffix. Returns -1 if
+ * it is not one.
+ */
+long cache_parse_size(const char *text)
+{
+    char *end;
+    long size = strtol(text, &end, 10);
+
+    if (end == text || size < 0)
+        return -1;
+    if (*end == 'K' || *end == 'k')
+        size <<= 10;
+    else if (*end == 'M' || *end == 'm')
+        size <<= 20;
+    else if (*end == 'G' || *end == 'g')
+        size <<= 30;
+    else if (*end != '\0')
+        return -1;
+    return size;
+}
+
+static void entry_path(const cache_t *cache, char *path, size_t size,
+        const char *name)
+{
+    snprintf(path, size, "%s/%s", cache->dir, name);
+}
+
+/* Takes the directory lock; returns the descriptor to release, or -1. */
+static int lock_dir(const cache_t *cache)
+{
+    char path[CACHE_PATH_MAX + 16];
+    struct flock fl;
+    int fd;
+
+    entry_path(cache, path, sizeof(path), "lock");
+    fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0)
+        return -1;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &fl) != 0) {
+        if (errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static void read_stats(const cache_t *cache, long counts[NUM_STATS])
+{
+    char path[CACHE_PATH_MAX + 16], name[32];
+    long value;
+    FILE *fp;
+
+    memset(counts, 0, NUM_STATS * sizeof(long));
+    entry_path(cache, path, sizeof(path), "stats");
+    fp = fopen(path, "r");
+    if (!fp)
+        return;
+    while (fscanf(fp, "%31s %ld", name, &value) == 2) {
+        for (int k = 0; k < NUM_STATS; k++) {
+            if (strcmp(name, stat_names[k]) == 0)
+                counts[k] = value;
+        }
+    }
+    fclose(fp);
+}
+
+/* Adds to the counters in the stats file. The caller holds the lock. */
+static void add_stats(const cache_t *cache, int stat, long count)
+{
+    char path[CACHE_PATH_MAX + 16], tmp[CACHE_PATH_MAX + 16];
+    long counts[NUM_STATS];
+    FILE *fp;
+
+    read_stats(cache, counts);
+    counts[stat] += count;
+    entry_path(cache, path, sizeof(path), "stats");
+    entry_path(cache, tmp, sizeof(tmp), "stats.tmp");
+    fp = fopen(tmp, "w");
+    if (!fp)
+        return;
+    for (int k = 0; k < NUM_STATS; k++)
+        fprintf(fp, "%s %ld\n", stat_names[k], counts[k]);
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+        remove(tmp);
+}
+
+/* The entry files in the directory. Returns their number, or -1. */
+static int list_entries(const cache_t *cache, Entry **entries)
+{
+    DIR *dir = opendir(cache->dir);
+    struct dirent *de;
+    Entry *list = NULL;
+    int n = 0, cap = 0;
+
+    if (dir == NULL)
+        return -1;
+    while ((de = readdir(dir)) != NULL) {
+        char path[CACHE_PATH_MAX + 64];
+        struct stat st;
+        uint64_t key;
+        long t;
+        int len = 0;
+
+        if (sscanf(de->d_name, "%16" SCNx64 "-%ld.wst%n", &key, &t, &len) != 2 ||
+                len == 0 || de->d_name[len] != '\0' || strlen(de->d_name) >= 64)
+            continue;
+        entry_path(cache, path, sizeof(path), de->d_name);
+        if (stat(path, &st) != 0)
+            continue;
+        if (n == cap) {
+            Entry *grown = realloc(list, (cap = cap ? 2 * cap : 16) * sizeof(Entry));
+
+            if (grown == NULL)
+                break;
+            list = grown;
+        }
+        strcpy(list[n].name, de->d_name);
+        list[n].size = st.st_size;
+        list[n].mtime = st.st_mtime;
+        list[n].key = key;
+        list[n].t = t;
+        n++;
+    }
+    closedir(dir);
+    *entries = list;
+    return n;
+}
+
+/* Least recently used first; on a tie the shorter prefix goes first. */
+static int by_recency(const void *a, const void *b)
+{
+    const Entry *x = a, *y = b;
+
+    if (x->mtime != y->mtime)
+        return x->mtime < y->mtime ? -1 : 1;
+    return (x->t > y->t) - (x->t < y->t);
+}
+
+/*
+ * Opens (creating it if needed) the cache in dir for a run from these
+ * initial buffers, and computes their key. Returns -1 on failure.
+ */
+int cache_open(cache_t *cache, const char *dir, long max_bytes, long i_max,
+        const double *old_array, const double *current_array,
+        const double *next_array)
+{
+    const double *first[3] = { old_array, current_array, next_array };
+    const int64_t size = i_max;
+    uint64_t key = FNV_OFFSET;
+
+    if (strlen(dir) + 64 >= CACHE_PATH_MAX)
+        return -1;
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        perror(dir);
+        return -1;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    strcpy(cache->dir, dir);
+    cache->max_bytes = max_bytes;
+    cache->i_max = i_max;
+    for (int b = 0; b < 3; b++) {
+        cache->edges[b][0] = first[b][0];
+        cache->edges[b][1] = first[b][i_max - 1];
+    }
+
+    key = fnv1a(key, magic, sizeof(magic));
+    key = fnv1a(key, &size, sizeof(size));
+    key = fnv1a(key, &stencil_c, sizeof(stencil_c));
+    key = fnv1a(key, old_array, i_max * sizeof(double));
+    key = fnv1a(key, current_array, i_max * sizeof(double));
+    key = fnv1a(key, cache->edges[2], sizeof(cache->edges[2]));
+    cache->key = key;
+
+    return 0;
+}
+
+static int load_entry(const cache_t *cache, const Entry *e, double *old_array,
+        double *current_array, double *next_array)
+{
+    char path[CACHE_PATH_MAX + 64];
+    char head[8];
+    EntryHeader h;
+    const size_t n = cache->i_max;
+    FILE *fp;
+    int ok;
+
+    entry_path(cache, path, sizeof(path), e->name);
+    fp = fopen(path, "rb");
+    if (!fp)
+        return -1;
+    ok = fread(head, sizeof(head), 1, fp) == 1 &&
+         memcmp(head, magic, sizeof(magic)) == 0 &&
+         fread(&h, sizeof(h), 1, fp) == 1 &&
+         h.i_max == cache->i_max && h.t == e->t && h.key == cache->key &&
+         fread(old_array, sizeof(double), n, fp) == n &&
+         fread(current_array, sizeof(double), n, fp) == n;
+    fclose(fp);
+    if (!ok)
+        return -1;
+
+    next_array[0] = h.edges[0];
+    next_array[n - 1] = h.edges[1];
+    utime(path, NULL);
+    return 0;
+}
+
+/*
+ * Loads the longest cached prefix of a t_max-step run into the buffers,
+ * and returns its step: t_max for a hit, 0 (buffers untouched) for a
+ * miss. Unreadable entries are removed.
+ */
+long cache_lookup(cache_t *cache, long t_max, double *old_array,
+        double *current_array, double *next_array)
+{
+    Entry *entries = NULL;
+    int n = list_entries(cache, &entries), fd;
+
+    cache->t = 0;
+    for (;;) {
+        int best = -1;
+
+        for (int k = 0; k < n; k++) {
+            if (entries[k].key == cache->key && entries[k].t > 0 &&
+                    entries[k].t <= t_max &&
+                    (best < 0 || entries[k].t > entries[best].t))
+                best = k;
+        }
+        if (best < 0)
+            break;
+        if (load_entry(cache, &entries[best], old_array, current_array,
+                       next_array) == 0) {
+            cache->t = entries[best].t;
+            break;
+        }
+        {
+            char path[CACHE_PATH_MAX + 64];
+
+            entry_path(cache, path, sizeof(path), entries[best].name);
+            remove(path);
+            entries[best].key = ~cache->key;
+        }
+    }
+    free(entries);
+
+    cache->outcome = cache->t == 0 ? CACHE_MISS :
+                     cache->t == t_max ? CACHE_HIT : CACHE_PARTIAL;
+    fd = lock_dir(cache);
+    if (fd >= 0) {
+        add_stats(cache, cache->outcome == CACHE_HIT ? STAT_HITS :
+                  cache->outcome == CACHE_PARTIAL ? STAT_PARTIAL : STAT_MISSES, 1);
+        close(fd);
+    }
+    return cache->t;
+}
+
+/*
+ * Drops least recently used entries until the directory fits, sparing the
+ * one just stored (mtimes only resolve to the second).
+ */
+static void evict(const cache_t *cache, const char *keep)
+{
+    Entry *entries = NULL;
+    int n = list_entries(cache, &entries), evicted = 0;
+    long total = 0;
+
+    for (int k = 0; k < n; k++)
+        total += entries[k].size;
+    if (total > cache->max_bytes) {
+        qsort(entries, n, sizeof(Entry), by_recency);
+        for (int k = 0; k < n && total > cache->max_bytes; k++) {
+            char path[CACHE_PATH_MAX + 64];
+
+            if (strcmp(entries[k].name, keep) == 0)
+                continue;
+            entry_path(cache, path, sizeof(path), entries[k].name);
+            if (remove(path) == 0) {
+                total -= entries[k].size;
+                evicted++;
+            }
+        }
+        add_stats(cache, STAT_EVICTIONS, evicted);
+    }
+    free(entries);
+}
+
+/*
+ * Stores the two levels after t steps (levels t and t + 1) and evicts
+ * down to the size bound. Returns -1 if the entry could not be written.
+ */
+int cache_store(cache_t *cache, long t, const double *previous,
+        const double *current)
+{
+    char name[64], path[CACHE_PATH_MAX + 64], tmp[CACHE_PATH_MAX + 96];
+    const size_t n = cache->i_max;
+    EntryHeader h;
+    FILE *fp;
+    int ok, fd;
+
+    memset(&h, 0, sizeof(h));
+    h.i_max = cache->i_max;
+    h.t = t;
+    h.key = cache->key;
+    h.edges[0] = cache->edges[(t + 2) % 3][0];
+    h.edges[1] = cache->edges[(t + 2) % 3][1];
+
+    snprintf(name, sizeof(name), "%016" PRIx64 "-%ld.wst", cache->key, t);
+    entry_path(cache, path, sizeof(path), name);
+    snprintf(tmp, sizeof(tmp), "%s/.%ld.%s", cache->dir, (long) getpid(), name);
+    fp = fopen(tmp, "wb");
+    if (!fp)
+        return -1;
+    ok = fwrite(magic, sizeof(magic), 1, fp) == 1 &&
+         fwrite(&h, sizeof(h), 1, fp) == 1 &&
+         fwrite(previous, sizeof(double), n, fp) == n &&
+         fwrite(current, sizeof(double), n, fp) == n;
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+
+    fd = lock_dir(cache);
+    if (fd >= 0) {
+        evict(cache, name);
+        close(fd);
+    }
+    return 0;
+}
+
+/* Prints what the last lookup found and the directory's totals. */
+void cache_report(const cache_t *cache)
+{
+    static const char *outcomes[] = { "miss", "partial hit", "hit" };
+    Entry *entries = NULL;
+    long counts[NUM_STATS], total = 0;
+    int n = list_entries(cache, &entries);
+
+    for (int k = 0; k < n; k++)
+        total += entries[k].size;
+    free(entries);
+    read_stats(cache, counts);
+
+    printf("Cache: %s", outcomes[cache->outcome]);
+    if (cache->outcome == CACHE_PARTIAL)
+        printf(", resumed from step %ld", cache->t);
+    printf(" (key %016" PRIx64 ")\n", cache->key);
+    printf("Cache: %ld hits, %ld partial, %ld misses, %ld evictions; "
+            "%d entries, %.1f of %.1f MiB\n", counts[STAT_HITS],
+            counts[STAT_PARTIAL], counts[STAT_MISSES], counts[STAT_EVICTIONS],
+            n > 0 ? n : 0, total / 1048576.0, cache->max_bytes / 1048576.0);
+}
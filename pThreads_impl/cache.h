@@ -0,0 +1,45 @@
+/*
+ * cache.h
+ *
+ * On-disk result cache. Entries are keyed by a hash of the grid size, the
+ * wave constant and the initial state, and hold the two levels after t
+ * steps, so a longer run can resume from the longest cached prefix.
+ *
+ * Entry files are named <key>-<t>.wst and are binary, native byte order:
+ *
+ *     char magic[8] = "WSTATE1"; int64 i_max; int64 t; uint64 key;
+ *     double edges[2];      boundary values of the third buffer
+ *     double previous[i_max]; double current[i_max];
+ *
+ * The directory is bounded in size with least-recently-used eviction;
+ * hit, miss and eviction counts accumulate in its "stats" file.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define CACHE_PATH_MAX 4096
+
+enum { CACHE_MISS, CACHE_PARTIAL, CACHE_HIT };
+
+typedef struct {
+    char dir[CACHE_PATH_MAX];
+    long max_bytes;
+    long i_max;
+    uint64_t key;
+    double edges[3][2];   /* boundary values of the three initial buffers */
+    int outcome;          /* of the last lookup */
+    long t;               /* step it resumed from */
+} cache_t;
+
+long cache_parse_size(const char *text);
+int cache_open(cache_t *cache, const char *dir, long max_bytes, long i_max,
+        const double *old_array, const double *current_array,
+        const double *next_array);
+long cache_lookup(cache_t *cache, long t_max, double *old_array,
+        double *current_array, double *next_array);
+int cache_store(cache_t *cache, long t, const double *previous,
+        const double *current);
+void cache_report(const cache_t *cache);
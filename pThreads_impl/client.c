@@ -0,0 +1,120 @@
+/*
+ * client.c
+ *
+ * wave_client: submits one job to wave_server and maps the result.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "file.h"
+
+static const char *status_names[] = {
+    "ok", "invalid request", "does not fit the server arena", "server failure",
+};
+
+int main(int argc, char *argv[])
+{
+    const char *path = WAVE_DEFAULT_SOCKET;
+    const char *out = NULL;
+    wave_request_t req;
+    wave_reply_t reply;
+    const double *result;
+    int shutdown = 0;
+    int sock, fd, i, j;
+
+    memset(&req, 0, sizeof(req));
+    req.magic = WAVE_MAGIC;
+    req.kind = WAVE_JOB;
+    strcpy(req.mode, "sin");
+
+    /* Strip --option=value arguments, keeping the positional ones in order. */
+    for (i = 1, j = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--socket=", 9) == 0)
+            path = argv[i] + 9;
+        else if (strncmp(argv[i], "--priority=", 11) == 0)
+            req.priority = atoi(argv[i] + 11);
+        else if (strncmp(argv[i], "--out=", 6) == 0)
+            out = argv[i] + 6;
+        else if (strcmp(argv[i], "--shutdown") == 0)
+            shutdown = 1;
+        else
+            argv[j++] = argv[i];
+    }
+    argc = j;
+
+    if (shutdown) {
+        req.kind = WAVE_SHUTDOWN;
+    } else if (argc < 3) {
+        printf("Usage: %s [options] i_max t_max [initial_data]\n", argv[0]);
+        printf(" - initial_data: sin (default), sinfull or gauss.\n");
+        printf(" - options:\n");
+        printf("    * --socket=PATH: server socket (default %s).\n",
+                WAVE_DEFAULT_SOCKET);
+        printf("    * --priority=P: higher runs first (default 0).\n");
+        printf("    * --out=FILE: write the result as text, like "
+                "result.txt.\n");
+        printf("    * --shutdown: ask the server to finish its queue and "
+                "exit.\n");
+        return EXIT_FAILURE;
+    } else {
+        req.i_max = strtol(argv[1], NULL, 10);
+        req.t_max = strtol(argv[2], NULL, 10);
+        if (argc > 3) {
+            if (strlen(argv[3]) >= sizeof(req.mode)) {
+                printf("Unknown initial mode: %s.\n", argv[3]);
+                return EXIT_FAILURE;
+            }
+            strcpy(req.mode, argv[3]);
+        }
+    }
+
+    sock = wave_connect(path);
+    if (sock < 0) {
+        fprintf(stderr, "Could not connect to %s.\n", path);
+        return EXIT_FAILURE;
+    }
+    if (wave_write_all(sock, &req, sizeof(req)) != 0) {
+        fprintf(stderr, "Could not send the request.\n");
+        return EXIT_FAILURE;
+    }
+    if (shutdown) {
+        close(sock);
+        return EXIT_SUCCESS;
+    }
+
+    if (wave_recv_reply(sock, &reply, &fd) != 0) {
+        fprintf(stderr, "No reply from the server.\n");
+        return EXIT_FAILURE;
+    }
+    close(sock);
+
+    if (reply.status != WAVE_OK || fd < 0) {
+        fprintf(stderr, "Job failed: %s.\n",
+                reply.status > 0 && reply.status <= WAVE_EFAIL ?
+                status_names[reply.status] : "no result");
+        return EXIT_FAILURE;
+    }
+
+    result = wave_map_result(fd, reply.i_max);
+    close(fd);
+    if (result == NULL) {
+        fprintf(stderr, "Could not map the result.\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Queued %g seconds\n", reply.queued);
+    printf("Took %g seconds\n", reply.seconds);
+    printf("Normalized: %g seconds\n",
+            reply.seconds / (1. * reply.i_max * reply.t_max));
+
+    if (out != NULL)
+        file_write_double_array(out, result, reply.i_max);
+
+    wave_unmap_result(result, reply.i_max);
+    return EXIT_SUCCESS;
+}
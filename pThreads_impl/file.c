@@ -13,10 +13,10 @@
 /*
  * Reads at most n doubles from a given file into an array.
  */
-void file_read_double_array(const char *filename, double *array, int n)
+void file_read_double_array(const char *filename, double *array, long n)
 {
     FILE *fp;
-    int i;
+    long i;
 
     fp = fopen(filename, "r");
 
@@ -39,10 +39,10 @@ void file_read_double_array(const char *filename, double *array, int n)
  * Saves an array with n items to a given file, overwriting any previous
  * contents.
  */
-void file_write_double_array(const char *filename, double *array, int n)
+void file_write_double_array(const char *filename, const double *array, long n)
 {
     FILE *fp;
-    int i;
+    long i;
 
     fp = fopen(filename, "w");
 
@@ -0,0 +1,218 @@
+/*
+ * generatedata.c
+ *
+ * Generates the initial wave buffers.
+ *
+ * init_buffers() carves all three buffers from an arena and lets every
+ * thread zero and sample its own chunk, so the pages are first touched by
+ * the threads that sweep them and setup scales with the thread count. The
+ * samples come from branch-free sin/exp kernels the compiler can vectorize,
+ * accurate to a few ulp against libm.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "generatedata.h"
+#include "arena.h"
+
+/* Adding and subtracting this rounds any |x| < 2^51 to the nearest integer. */
+static const double round_magic = 6755399441055744.0;
+
+/*
+ * sin(x) for moderate |x|: Cody-Waite reduction by pi/2 and the fdlibm
+ * kernel polynomials. The quadrant is applied arithmetically (multiplying by
+ * exact 0/1 and +-1 factors) so the loop has no control flow to vectorize.
+ */
+static inline double vsin(double x)
+{
+    const double two_over_pi = 6.36619772367581382433e-01;
+    const double pio2_hi = 1.57079632673412561417e+00;
+    const double pio2_lo = 6.07710050650619224932e-11;
+    double n = (x * two_over_pi + round_magic) - round_magic;
+    double r = (x - n * pio2_hi) - n * pio2_lo;
+    double z = r * r;
+    double s, co, odd, sign;
+    int q = (int) n;
+
+    s = r + r * z * (-1.66666666666666324348e-01 + z * (8.33333333332248946124e-03
+            + z * (-1.98412698298579493134e-04 + z * (2.75573137070700676789e-06
+            + z * (-2.50507602534068634195e-08 + z * 1.58969099521155010221e-10)))));
+    co = 1.0 - 0.5 * z + z * z * (4.16666666666666019037e-02
+            + z * (-1.38888888888741095749e-03 + z * (2.48015872894767294178e-05
+            + z * (-2.75573143513906633035e-07 + z * (2.08757232129817482790e-09
+            + z * -1.13596475577881948265e-11)))));
+
+    odd = q & 1;
+    sign = 1 - (q & 2);
+    return sign * (s * (1 - odd) + co * odd);
+}
+
+/*
+ * exp(x) for the moderate arguments of the gauss profile: reduction by
+ * ln 2, a degree 13 Taylor polynomial and a scale by 2^k built in the
+ * exponent bits.
+ */
+static inline double vexp(double x)
+{
+    const double inv_ln2 = 1.44269504088896338700e+00;
+    const double ln2_hi = 6.93147180369123816490e-01;
+    const double ln2_lo = 1.90821492927058770002e-10;
+    double k = (x * inv_ln2 + round_magic) - round_magic;
+    double r = (x - k * ln2_hi) - k * ln2_lo;
+    double biased = k + (1023 + 4503599627370496.0);
+    double p, scale;
+    uint64_t bits;
+
+    p = 1.0 + r * (1.0 + r * (1.0 / 2 + r * (1.0 / 6 + r * (1.0 / 24
+            + r * (1.0 / 120 + r * (1.0 / 720 + r * (1.0 / 5040
+            + r * (1.0 / 40320 + r * (1.0 / 362880 + r * (1.0 / 3628800
+            + r * (1.0 / 39916800 + r * (1.0 / 479001600
+            + r * (1.0 / 6227020800.0)))))))))))));
+
+    /* The low mantissa bits of `biased' hold k + 1023; move them to the
+     * exponent field. */
+    memcpy(&bits, &biased, sizeof(bits));
+    bits <<= 52;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+/*
+ * Writes indices [lo, hi) of a buffer described by `f'.
+ */
+static void init_chunk(double *array, const init_fill_t *f, long lo, long hi)
+{
+    const long offset = f->offset;
+    const double start = f->sample_start;
+    const double dx = (f->sample_end - f->sample_start) / f->range;
+    long sample_lo = offset, sample_hi = offset + f->range;
+    long i;
+
+    if (f->func == INIT_ZERO || sample_hi <= lo || sample_lo >= hi) {
+        memset(array + lo, 0, (hi - lo) * sizeof(double));
+        return;
+    }
+
+    if (sample_lo < lo)
+        sample_lo = lo;
+    if (sample_hi > hi)
+        sample_hi = hi;
+
+    memset(array + lo, 0, (sample_lo - lo) * sizeof(double));
+
+    if (f->func == INIT_SIN) {
+        for (i = sample_lo; i < sample_hi; i++)
+            array[i] = vsin(start + (i - offset) * dx);
+    } else {
+        for (i = sample_lo; i < sample_hi; i++) {
+            double x = start + (i - offset) * dx;
+            array[i] = vexp((-1 * x * x) / 2);
+        }
+    }
+
+    memset(array + sample_hi, 0, (hi - sample_hi) * sizeof(double));
+}
+
+typedef struct {
+    long lo, hi;
+    int count;
+    const init_fill_t *fills;
+    double **buffers;
+} InitArgs;
+
+static void *init_worker(void *arg)
+{
+    InitArgs *args = (InitArgs *) arg;
+    int b;
+
+    for (b = 0; b < args->count; b++)
+        init_chunk(args->buffers[b], &args->fills[b], args->lo, args->hi);
+    return NULL;
+}
+
+/*
+ * Initialises `count' existing buffers of i_max doubles as described by
+ * `fills', splitting the index range over `num_threads' threads the same
+ * way simulate() does.
+ */
+void init_fill(double *buffers[], const init_fill_t fills[], int count,
+        long i_max, int num_threads)
+{
+    pthread_t threads[num_threads];
+    InitArgs args[num_threads];
+    long chunk_size = i_max / num_threads;
+    long remainder = i_max % num_threads;
+    long start_index = 0;
+    int thr;
+
+    if (num_threads < 1)
+        return;
+
+    for (thr = 0; thr < num_threads; thr++) {
+        long range = chunk_size + (thr < remainder ? 1 : 0);
+
+        args[thr].lo = start_index;
+        args[thr].hi = start_index + range;
+        args[thr].count = count;
+        args[thr].fills = fills;
+        args[thr].buffers = buffers;
+        start_index += range;
+
+        if (thr > 0)
+            pthread_create(&threads[thr], NULL, init_worker, &args[thr]);
+    }
+
+    /* The calling thread takes the first chunk itself. */
+    init_worker(&args[0]);
+
+    for (thr = 1; thr < num_threads; thr++)
+        pthread_join(threads[thr], NULL);
+}
+
+/*
+ * Carves three buffers of i_max doubles out of `arena' and initialises them
+ * with init_fill(). Returns 0 on success, -1 if allocation failed.
+ */
+int init_buffers(arena_t *arena, long i_max, int num_threads,
+        const init_fill_t fills[3], double *buffers[3])
+{
+    int b;
+
+    for (b = 0; b < 3; b++)
+        buffers[b] = arena_alloc(arena, i_max * sizeof(double));
+    if (!buffers[0] || !buffers[1] || !buffers[2])
+        return -1;
+
+    init_fill(buffers, fills, 3, i_max, num_threads);
+    return 0;
+}
+
+/*
+ * Describes the first two generations of one of the drivers' initial modes:
+ * "sin", "sinfull", "gauss" or "file" (all zero, the caller reads the
+ * files). The third buffer is always zero. Returns -1 for an unknown mode.
+ */
+int init_mode_fills(const char *mode, long i_max, init_fill_t fills[3])
+{
+    fills[0] = (init_fill_t) { INIT_SIN, 1, i_max/4, 0, 2*3.14 };
+    fills[1] = (init_fill_t) { INIT_SIN, 2, i_max/4, 0, 2*3.14 };
+    fills[2] = (init_fill_t) { INIT_ZERO, 0, 0, 0, 0 };
+
+    if (strcmp(mode, "sinfull") == 0) {
+        fills[0] = (init_fill_t) { INIT_SIN, 1, i_max-2, 0, 10*3.14 };
+        fills[1] = (init_fill_t) { INIT_SIN, 2, i_max-3, 0, 10*3.14 };
+    } else if (strcmp(mode, "gauss") == 0) {
+        fills[0] = (init_fill_t) { INIT_GAUSS, 1, i_max/4, -3, 3 };
+        fills[1] = (init_fill_t) { INIT_GAUSS, 2, i_max/4, -3, 3 };
+    } else if (strcmp(mode, "file") == 0) {
+        fills[0].func = INIT_ZERO;
+        fills[1].func = INIT_ZERO;
+    } else if (strcmp(mode, "sin") != 0) {
+        return -1;
+    }
+    return 0;
+}
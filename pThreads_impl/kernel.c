@@ -0,0 +1,211 @@
+/*
+ * kernel.c
+ *
+ * Stencil kernels.
+ *
+ * Once the levels no longer fit in the private caches, every step streams
+ * them from the shared last level or DRAM, and a plain store to next[i]
+ * first reads the line it overwrites (read for ownership): four streams of
+ * traffic for three arrays. stencil_stream() writes next with non-temporal
+ * stores, which go to memory without that read and without evicting
+ * old/cur, and prefetches old and cur ahead of the sweep. Below the
+ * threshold the plain kernel is faster, since next is read again from
+ * cache one step later.
+ *
+ * Both kernels evaluate the update in the same order, so they give
+ * bit-identical results.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kernel.h"
+
+/*
+ * How far ahead of the sweep old and cur are prefetched, in doubles. From
+ * wave_bench's sweep on a 420 MiB grid (Xeon, 2 MiB L2): 0-64 doubles
+ * lose up to 20%, 512-2048 are within noise of each other and 128-256
+ * vary from run to run. 512 is one page ahead.
+ */
+#ifndef PREFETCH_DISTANCE
+#define PREFETCH_DISTANCE 512
+#endif
+
+/* Last-level cache size when sysfs has nothing to say. */
+#define DEFAULT_LLC_BYTES (8L << 20)
+
+static const double c = STENCIL_C;
+
+static int kernel_mode = KERNEL_AUTO;
+static long prefetch_distance = PREFETCH_DISTANCE;
+
+
+void stencil_plain(double *restrict next, const double *restrict cur,
+        const double *restrict old, long start, long end)
+{
+    for (long i = start; i < end; i++) {
+        next[i] = 2 * cur[i] - old[i]
+                  + c * (cur[i-1] - 2 * cur[i] + cur[i+1]);
+    }
+}
+
+#ifdef __SSE2__
+static inline void stream_pair(double *next, const double *cur,
+        const double *old, long i, __m128d two, __m128d cc)
+{
+    __m128d mid = _mm_loadu_pd(cur + i);
+    __m128d lap = _mm_add_pd(_mm_sub_pd(_mm_loadu_pd(cur + i - 1),
+                                        _mm_mul_pd(two, mid)),
+                             _mm_loadu_pd(cur + i + 1));
+    __m128d u = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(two, mid),
+                                      _mm_loadu_pd(old + i)),
+                           _mm_mul_pd(cc, lap));
+
+    _mm_stream_pd(next + i, u);
+}
+#endif
+
+void stencil_stream(double *restrict next, const double *restrict cur,
+        const double *restrict old, long start, long end)
+{
+#ifdef __SSE2__
+    const __m128d two = _mm_set1_pd(2), cc = _mm_set1_pd(c);
+    long i = start;
+
+    /* Streaming stores need 16-byte aligned addresses. */
+    if (i < end && ((uintptr_t) (next + i) & 15) != 0) {
+        stencil_plain(next, cur, old, i, i + 1);
+        i++;
+    }
+
+    /* One cache line of next per iteration, one prefetch per stream. */
+    for (; i + 8 <= end; i += 8) {
+        _mm_prefetch((const char *) (cur + i + prefetch_distance), _MM_HINT_T0);
+        _mm_prefetch((const char *) (old + i + prefetch_distance), _MM_HINT_T0);
+        stream_pair(next, cur, old, i, two, cc);
+        stream_pair(next, cur, old, i + 2, two, cc);
+        stream_pair(next, cur, old, i + 4, two, cc);
+        stream_pair(next, cur, old, i + 6, two, cc);
+    }
+    for (; i + 2 <= end; i += 2)
+        stream_pair(next, cur, old, i, two, cc);
+    stencil_plain(next, cur, old, i, end);
+
+    /* Streaming stores are weakly ordered: drain them before the barrier. */
+    _mm_sfence();
+#else
+    stencil_plain(next, cur, old, start, end);
+#endif
+}
+
+/* The largest and the second largest data cache of cpu0, from sysfs. */
+static long llc, mid;
+
+static void read_caches(void)
+{
+    long best = 0, next = 0;
+
+    for (int index = 0; index < 8; index++) {
+        char path[96], type[32];
+        long size;
+        char unit = 0;
+        FILE *fp;
+
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        fp = fopen(path, "r");
+        if (!fp)
+            break;
+        if (fscanf(fp, "%31s", type) != 1)
+            type[0] = '\0';
+        fclose(fp);
+        if (strcmp(type, "Instruction") == 0)
+            continue;
+
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        fp = fopen(path, "r");
+        if (!fp)
+            continue;
+        if (fscanf(fp, "%ld%c", &size, &unit) >= 1) {
+            if (unit == 'K')
+                size <<= 10;
+            else if (unit == 'M')
+                size <<= 20;
+            if (size > best) {
+                next = best;
+                best = size;
+            } else if (size > next && size < best) {
+                next = size;
+            }
+        }
+        fclose(fp);
+    }
+
+    llc = best > 0 ? best : DEFAULT_LLC_BYTES;
+    mid = next > 0 ? next : llc;
+}
+
+/*
+ * Size of the largest data cache of cpu0.
+ */
+long kernel_llc_bytes(void)
+{
+    if (llc == 0)
+        read_caches();
+    return llc;
+}
+
+/*
+ * Parses auto, plain or stream. Returns -1 for anything else.
+ */
+int kernel_parse(const char *name)
+{
+    if (strcmp(name, "auto") == 0)
+        return KERNEL_AUTO;
+    if (strcmp(name, "plain") == 0)
+        return KERNEL_PLAIN;
+    if (strcmp(name, "stream") == 0)
+        return KERNEL_STREAM;
+    return -1;
+}
+
+/* Overrides the automatic choice for the rest of the process. */
+void kernel_set_mode(int mode)
+{
+    kernel_mode = mode;
+}
+
+/* Sets how far ahead stencil_stream() prefetches, in doubles. */
+void kernel_set_prefetch(long distance)
+{
+    prefetch_distance = distance;
+}
+
+/*
+ * The kernel for a grid of i_max points: streaming once a single level
+ * outgrows the cache below the last level. The last level is not the
+ * threshold: on the Xeon wave_bench was measured on, its 105 MiB are
+ * shared and non-inclusive, and streaming already wins by 1.05-1.4x from
+ * 6.6 MiB (three levels) up, while plain wins by 5-25% up to 4.6 MiB,
+ * i.e. up to one level per 2 MiB L2. With a single cache level, that
+ * level stands in.
+ */
+stencil_func_t kernel_select(long i_max)
+{
+    if (kernel_mode == KERNEL_STREAM)
+        return stencil_stream;
+    if (kernel_mode == KERNEL_PLAIN)
+        return stencil_plain;
+    if (mid == 0)
+        read_caches();
+    return i_max * (long) sizeof(double) > mid ?
+           stencil_stream : stencil_plain;
+}
@@ -0,0 +1,140 @@
+/*
+ * kernel_bench.c
+ *
+ * wave_bench: times the plain and the streaming-store kernel on grids
+ * below and above the last-level cache, through the barrier engine.
+ *
+ * Beyond the cache a step moves old and cur in and next out, plus, with
+ * plain stores, a read for ownership of next: 32 bytes per point update
+ * against 24 with streaming stores. The bandwidth column is that model
+ * over the measured time, so equal values mean the streaming kernel saved
+ * exactly the RFO stream. Both kernels must produce identical results.
+ *
+ * On the largest grid it then sweeps the prefetch distance of the
+ * streaming kernel, the data PREFETCH_DISTANCE in kernel.c is taken from.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "session.h"
+#include "kernel.h"
+#include "timer.h"
+
+/* Point updates per timed run. */
+#define BENCH_UPDATES 4e8
+
+static double run(int mode, long i_max, long steps, int threads,
+        const double *old, const double *cur, double *result)
+{
+    sim_session_t *s;
+    double seconds;
+
+    kernel_set_mode(mode);
+    s = session_create(i_max, threads, old, cur);
+    if (s == NULL)
+        return -1;
+    session_step(s, 1);                  /* fault in the buffers */
+    session_step(s, steps);
+    seconds = session_seconds(s);
+    memcpy(result, session_peek(s, NULL), i_max * sizeof(double));
+    session_destroy(s);
+
+    return seconds;
+}
+
+/* Prefetch distances swept, in doubles; 0 prefetches the current line. */
+static const long distances[] = { 0, 16, 32, 64, 128, 256, 512, 1024, 2048 };
+
+static void sweep(long i_max, long steps, int threads, const double *old,
+        const double *cur, double *result)
+{
+    const double updates = (double) (i_max - 2) * steps;
+
+    printf("\nprefetch distance at i_max %ld\n", i_max);
+    printf("%12s %12s %10s\n", "doubles", "stream ns/pt", "strm GB/s");
+    for (size_t d = 0; d < sizeof(distances) / sizeof(distances[0]); d++) {
+        double t;
+
+        kernel_set_prefetch(distances[d]);
+        t = run(KERNEL_STREAM, i_max, steps, threads, old, cur, result);
+        printf("%12ld %12.3f %10.2f\n", distances[d], 1e9 * t / updates,
+                24 * updates / t * 1e-9);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const long llc = kernel_llc_bytes();
+    long default_sizes[2], *sizes = default_sizes;
+    int num_sizes = 2, threads = argc > 1 ? atoi(argv[1]) : 1, k;
+
+    if (threads < 1) {
+        printf("Usage: %s [threads [i_max ...]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Default: a grid well inside the cache and one four times past it. */
+    default_sizes[0] = llc / 24 / 4;
+    default_sizes[1] = 4 * (llc / 24);
+    if (argc > 2) {
+        num_sizes = argc - 2;
+        sizes = malloc(num_sizes * sizeof(long));
+        if (sizes == NULL)
+            return EXIT_FAILURE;
+        for (k = 0; k < num_sizes; k++)
+            sizes[k] = strtol(argv[2 + k], NULL, 10);
+    }
+
+    printf("last-level cache %ld KiB, %d threads\n", llc >> 10, threads);
+    printf("%12s %8s %12s %12s %10s %10s %8s\n", "i_max", "MiB", "plain ns/pt",
+            "stream ns/pt", "plain GB/s", "strm GB/s", "speedup");
+
+    for (k = 0; k < num_sizes; k++) {
+        const long i_max = sizes[k];
+        const long steps = i_max > 0 ? (long) fmax(3, BENCH_UPDATES / i_max) : 0;
+        double *old = malloc(i_max * sizeof(double));
+        double *cur = malloc(i_max * sizeof(double));
+        double *plain = malloc(i_max * sizeof(double));
+        double *stream = malloc(i_max * sizeof(double));
+        double t_plain, t_stream, updates;
+
+        if (i_max < 3 || !old || !cur || !plain || !stream) {
+            fprintf(stderr, "skipping i_max %ld\n", i_max);
+            free(old);
+            free(cur);
+            free(plain);
+            free(stream);
+            continue;
+        }
+        for (long i = 0; i < i_max; i++) {
+            old[i] = sin(1e-3 * i);
+            cur[i] = sin(1e-3 * (i + 1));
+        }
+
+        t_plain = run(KERNEL_PLAIN, i_max, steps, threads, old, cur, plain);
+        t_stream = run(KERNEL_STREAM, i_max, steps, threads, old, cur, stream);
+        updates = (double) (i_max - 2) * steps;
+
+        printf("%12ld %8.1f %12.3f %12.3f %10.2f %10.2f %8.3f%s\n", i_max,
+                3.0 * i_max * sizeof(double) / (1 << 20),
+                1e9 * t_plain / updates, 1e9 * t_stream / updates,
+                32 * updates / t_plain * 1e-9, 24 * updates / t_stream * 1e-9,
+                t_plain / t_stream,
+                memcmp(plain, stream, i_max * sizeof(double)) ? "  MISMATCH" : "");
+        if (k == num_sizes - 1)
+            sweep(i_max, steps, threads, old, cur, stream);
+
+        free(old);
+        free(cur);
+        free(plain);
+        free(stream);
+    }
+
+    if (sizes != default_sizes)
+        free(sizes);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+/*
+ * loadgen.c
+ *
+ * wave_loadgen: keeps a number of clients busy submitting jobs to
+ * wave_server and reports throughput and latency.
+ *
+ * Each client thread submits its jobs back to back with priorities cycling
+ * through 0..3, maps every result and checks that it is finite, so the
+ * measured latency includes the hand-off the real clients pay.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "protocol.h"
+#include "timer.h"
+
+typedef struct {
+    int id, jobs;
+    const char *path;
+    wave_request_t req;
+    double *latency;      /* seconds, one per job */
+    double run_seconds;   /* sum of server step time */
+    int failed;
+} LoadClient;
+
+static void *load_client(void *arg)
+{
+    LoadClient *lc = (LoadClient *) arg;
+    int j;
+
+    for (j = 0; j < lc->jobs; j++) {
+        wave_request_t req = lc->req;
+        wave_reply_t reply;
+        struct timespec start;
+        const double *result;
+        int sock, fd;
+
+        req.priority = (lc->id + j) % 4;
+        timer_start_r(&start);
+
+        sock = wave_connect(lc->path);
+        if (sock < 0 || wave_write_all(sock, &req, sizeof(req)) != 0 ||
+                wave_recv_reply(sock, &reply, &fd) != 0 ||
+                reply.status != WAVE_OK || fd < 0) {
+            if (sock >= 0)
+                close(sock);
+            lc->failed++;
+            lc->latency[j] = -1;
+            continue;
+        }
+        close(sock);
+
+        result = wave_map_result(fd, reply.i_max);
+        close(fd);
+        if (result == NULL || !isfinite(result[reply.i_max / 2])) {
+            lc->failed++;
+            lc->latency[j] = -1;
+        } else {
+            lc->latency[j] = timer_end_r(&start);
+            lc->run_seconds += reply.seconds;
+        }
+        if (result != NULL)
+            wave_unmap_result(result, reply.i_max);
+    }
+
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = WAVE_DEFAULT_SOCKET;
+    wave_request_t req;
+    int num_clients, jobs, total, done, failed, i, j;
+    double *latency, run_seconds = 0, elapsed, sum = 0;
+    struct timespec start;
+
+    memset(&req, 0, sizeof(req));
+    req.magic = WAVE_MAGIC;
+    req.kind = WAVE_JOB;
+    strcpy(req.mode, "sin");
+
+    for (i = 1, j = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--socket=", 9) == 0)
+            path = argv[i] + 9;
+        else
+            argv[j++] = argv[i];
+    }
+    argc = j;
+
+    if (argc < 5) {
+        printf("Usage: %s [--socket=PATH] clients jobs_per_client i_max t_max "
+                "[initial_data]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    num_clients = atoi(argv[1]);
+    jobs = atoi(argv[2]);
+    req.i_max = strtol(argv[3], NULL, 10);
+    req.t_max = strtol(argv[4], NULL, 10);
+    if (argc > 5 && strlen(argv[5]) < sizeof(req.mode))
+        strcpy(req.mode, argv[5]);
+    if (num_clients < 1 || jobs < 1) {
+        printf("argument error: clients and jobs_per_client should be >=1.\n");
+        return EXIT_FAILURE;
+    }
+
+    total = num_clients * jobs;
+    latency = malloc(total * sizeof(double));
+    if (latency == NULL) {
+        fprintf(stderr, "Could not allocate enough memory, aborting.\n");
+        return EXIT_FAILURE;
+    }
+
+    {
+        pthread_t threads[num_clients];
+        LoadClient clients[num_clients];
+
+        timer_start_r(&start);
+        for (i = 0; i < num_clients; i++) {
+            clients[i].id = i;
+            clients[i].jobs = jobs;
+            clients[i].path = path;
+            clients[i].req = req;
+            clients[i].latency = latency + i * jobs;
+            clients[i].run_seconds = 0;
+            clients[i].failed = 0;
+            pthread_create(&threads[i], NULL, load_client, &clients[i]);
+        }
+        failed = 0;
+        for (i = 0; i < num_clients; i++) {
+            pthread_join(threads[i], NULL);
+            failed += clients[i].failed;
+            run_seconds += clients[i].run_seconds;
+        }
+        elapsed = timer_end_r(&start);
+    }
+
+    /* Failed jobs carry a negative latency and sort to the front. */
+    qsort(latency, total, sizeof(double), compare_doubles);
+    for (done = 0, i = 0; i < total; i++) {
+        if (latency[i] >= 0) {
+            sum += latency[i];
+            done++;
+        }
+    }
+
+    printf("jobs: %d ok, %d failed in %g seconds (%g jobs/s)\n",
+            done, failed, elapsed, done / elapsed);
+    if (done > 0) {
+        const double *ok = latency + (total - done);
+
+        printf("latency: mean %g  p50 %g  p99 %g  max %g seconds\n",
+                sum / done, ok[done / 2], ok[(done * 99) / 100],
+                ok[done - 1]);
+        printf("server stepping: %g seconds (%.1f%% of wall time)\n",
+                run_seconds, 100 * run_seconds / elapsed);
+    }
+
+    free(latency);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,285 @@
+/*
+ * ooc.c
+ *
+ * Out-of-core engine.
+ *
+ * Four files in a scratch directory hold the old and current level read by a
+ * pass and the two levels it writes. A pass advances the whole grid `block'
+ * steps: every tile of interior points is loaded together with a halo of
+ * `block' points per side, stepped `block' times in memory on a shrinking
+ * range (the dependency cone), and only its final two levels are written
+ * back. Each tile is therefore read and written once per `block' steps. The
+ * next tile is announced to the kernel with POSIX_MADV_WILLNEED while the
+ * current one is computed. Tiles of a pass are independent and are spread
+ * over the threads.
+ *
+ * The drivers never write next[0] or next[i_max-1], so the boundary values
+ * rotate with the three buffers: level s sees the boundary of buffer s % 3.
+ * We keep those six values aside and reproduce the rotation exactly, which
+ * makes the result bit-identical to simulate().
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "ooc.h"
+#include "kernel.h"
+
+static const double c = STENCIL_C;
+
+#define OOC_DEFAULT_TILE (1L << 20)
+#define OOC_DEFAULT_BLOCK 64
+
+
+static double *map_level(const char *path, long i_max)
+{
+    size_t bytes = (size_t) i_max * sizeof(double);
+    double *p;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "ooc: could not create %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, bytes) != 0) {
+        fprintf(stderr, "ooc: could not size %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "ooc: could not map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    posix_madvise(p, bytes, POSIX_MADV_SEQUENTIAL);
+    return p;
+}
+
+/*
+ * Creates and maps the four zero-filled level files in `dir'. The caller
+ * fills levels[0] (old) and levels[1] (current) before ooc_simulate().
+ * Returns 0 on success, -1 on failure.
+ */
+int ooc_create(ooc_t *ooc, const char *dir, long i_max)
+{
+    int l;
+
+    memset(ooc, 0, sizeof(*ooc));
+    ooc->i_max = i_max;
+    ooc->tile = OOC_DEFAULT_TILE;
+    ooc->block = OOC_DEFAULT_BLOCK;
+
+    for (l = 0; l < 4; l++) {
+        snprintf(ooc->paths[l], OOC_PATH_MAX, "%s/wave_level%d.bin", dir, l);
+        ooc->levels[l] = map_level(ooc->paths[l], i_max);
+        if (ooc->levels[l] == NULL) {
+            ooc_destroy(ooc);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void ooc_destroy(ooc_t *ooc)
+{
+    int l;
+
+    for (l = 0; l < 4; l++) {
+        if (ooc->levels[l] != NULL)
+            munmap(ooc->levels[l], (size_t) ooc->i_max * sizeof(double));
+        if (ooc->paths[l][0] != '\0')
+            unlink(ooc->paths[l]);
+        ooc->levels[l] = NULL;
+        ooc->paths[l][0] = '\0';
+    }
+}
+
+
+typedef struct {
+    int id, num_threads;
+    ooc_t *ooc;
+    long t_max;
+    double *local[3];
+    pthread_barrier_t *barrier;
+} OocArgs;
+
+static void advise_tile(const double *level, long lo, long hi)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start = (size_t) lo * sizeof(double) / page * page;
+    size_t end = (size_t) hi * sizeof(double);
+
+    posix_madvise((char *) level + start, end - start, POSIX_MADV_WILLNEED);
+}
+
+/*
+ * Advances tile [a, b) from level s (in[0]) and s+1 (in[1]) by `steps'
+ * steps and writes levels s+steps and s+steps+1 to out[0] and out[1].
+ */
+static void ooc_tile(OocArgs *args, double *const in[2], double *const out[2],
+        long s, long steps, long a, long b)
+{
+    const ooc_t *ooc = args->ooc;
+    const long i_max = ooc->i_max;
+    long lo = a - steps < 0 ? 0 : a - steps;
+    long hi = b + steps > i_max ? i_max : b + steps;
+    double *loc[3];
+    long j, i;
+
+    /* local[m] holds a level l with l % 3 == m, shifted by lo */
+    for (j = 0; j < 3; j++)
+        loc[j] = args->local[j] - lo;
+
+    memcpy(loc[s % 3] + lo, in[0] + lo, (hi - lo) * sizeof(double));
+    memcpy(loc[(s + 1) % 3] + lo, in[1] + lo, (hi - lo) * sizeof(double));
+    if (lo == 0) {
+        for (j = 0; j < 3; j++)
+            loc[j][0] = ooc->bounds[j][0];
+    }
+    if (hi == i_max) {
+        for (j = 0; j < 3; j++)
+            loc[j][i_max - 1] = ooc->bounds[j][1];
+    }
+
+    for (j = 0; j < steps; j++) {
+        double *next = loc[(s + j + 2) % 3];
+        const double *cur = loc[(s + j + 1) % 3];
+        const double *old = loc[(s + j) % 3];
+        long from = a - (steps - 1 - j), to = b + (steps - 1 - j);
+
+        if (from < 1)
+            from = 1;
+        if (to > i_max - 1)
+            to = i_max - 1;
+
+        for (i = from; i < to; i++) {
+            next[i] = 2 * cur[i] - old[i]
+                      + c * (cur[i-1] - 2 * cur[i] + cur[i+1]);
+        }
+    }
+
+    memcpy(out[0] + a, loc[(s + steps) % 3] + a, (b - a) * sizeof(double));
+    memcpy(out[1] + a, loc[(s + steps + 1) % 3] + a, (b - a) * sizeof(double));
+}
+
+static void *ooc_worker(void *arg)
+{
+    OocArgs *args = (OocArgs *) arg;
+    ooc_t *ooc = args->ooc;
+    const long i_max = ooc->i_max;
+    const long num_tiles = (i_max - 2 + ooc->tile - 1) / ooc->tile;
+    long s = 0;
+
+    while (s < args->t_max) {
+        long steps = args->t_max - s < ooc->block ? args->t_max - s : ooc->block;
+        double *in[2] = { ooc->levels[0], ooc->levels[1] };
+        double *out[2] = { ooc->levels[2], ooc->levels[3] };
+        long tile;
+
+        for (tile = args->id; tile < num_tiles; tile += args->num_threads) {
+            long a = 1 + tile * ooc->tile;
+            long b = a + ooc->tile > i_max - 1 ? i_max - 1 : a + ooc->tile;
+            long ahead = tile + args->num_threads;
+
+            if (ahead < num_tiles) {
+                long na = 1 + ahead * ooc->tile - steps;
+                long nb = na + ooc->tile + 2 * steps;
+                if (na < 0)
+                    na = 0;
+                if (nb > i_max)
+                    nb = i_max;
+                advise_tile(in[0], na, nb);
+                advise_tile(in[1], na, nb);
+            }
+
+            ooc_tile(args, in, out, s, steps, a, b);
+        }
+
+        pthread_barrier_wait(args->barrier);
+
+        if (args->id == 0) {
+            s += steps;
+            ooc->levels[2][0] = ooc->bounds[s % 3][0];
+            ooc->levels[2][i_max - 1] = ooc->bounds[s % 3][1];
+            ooc->levels[3][0] = ooc->bounds[(s + 1) % 3][0];
+            ooc->levels[3][i_max - 1] = ooc->bounds[(s + 1) % 3][1];
+
+            ooc->levels[0] = out[0];
+            ooc->levels[1] = out[1];
+            ooc->levels[2] = in[0];
+            ooc->levels[3] = in[1];
+        } else {
+            s += steps;
+        }
+
+        pthread_barrier_wait(args->barrier);
+    }
+
+    return NULL;
+}
+
+/*
+ * Runs t_max steps on the mapped levels and returns the mapping holding the
+ * final current level. Boundary values of the third buffer are taken to be
+ * zero, as the drivers leave it.
+ */
+double *ooc_simulate(ooc_t *ooc, long t_max, int num_threads)
+{
+    const long i_max = ooc->i_max;
+    const long local_size = ooc->tile + 2 * ooc->block;
+    pthread_t threads[num_threads];
+    OocArgs args[num_threads];
+    pthread_barrier_t barrier;
+    int thr, j, failed = 0;
+
+    ooc->bounds[0][0] = ooc->levels[0][0];
+    ooc->bounds[0][1] = ooc->levels[0][i_max - 1];
+    ooc->bounds[1][0] = ooc->levels[1][0];
+    ooc->bounds[1][1] = ooc->levels[1][i_max - 1];
+    ooc->bounds[2][0] = 0;
+    ooc->bounds[2][1] = 0;
+
+    pthread_barrier_init(&barrier, NULL, num_threads);
+
+    for (thr = 0; thr < num_threads; thr++) {
+        args[thr].id = thr;
+        args[thr].num_threads = num_threads;
+        args[thr].ooc = ooc;
+        args[thr].t_max = t_max;
+        args[thr].barrier = &barrier;
+        for (j = 0; j < 3; j++) {
+            args[thr].local[j] = malloc(local_size * sizeof(double));
+            if (args[thr].local[j] == NULL)
+                failed = 1;
+        }
+    }
+
+    if (failed) {
+        fprintf(stderr, "ooc: could not allocate tile buffers\n");
+    } else {
+        for (thr = 1; thr < num_threads; thr++)
+            pthread_create(&threads[thr], NULL, ooc_worker, &args[thr]);
+        ooc_worker(&args[0]);
+        for (thr = 1; thr < num_threads; thr++)
+            pthread_join(threads[thr], NULL);
+    }
+
+    for (thr = 0; thr < num_threads; thr++) {
+        for (j = 0; j < 3; j++)
+            free(args[thr].local[j]);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    return failed ? NULL : ooc->levels[1];
+}
@@ -0,0 +1,28 @@
+/*
+ * ooc.h
+ *
+ * Out-of-core engine for grids larger than RAM. The time levels live in
+ * memory-mapped files and are swept in tiles with temporal blocking.
+ *
+ */
+
+#pragma once
+
+#define OOC_PATH_MAX 4096
+
+typedef struct {
+    long i_max;
+    long tile;            /* interior points per tile */
+    long block;           /* timesteps per pass over the files */
+
+    /* levels[0..1]: old/current read by a pass, levels[2..3]: written */
+    double *levels[4];
+    char paths[4][OOC_PATH_MAX];
+
+    /* boundary values of the three rotating buffers, see ooc.c */
+    double bounds[3][2];
+} ooc_t;
+
+int ooc_create(ooc_t *ooc, const char *dir, long i_max);
+double *ooc_simulate(ooc_t *ooc, long t_max, int num_threads);
+void ooc_destroy(ooc_t *ooc);
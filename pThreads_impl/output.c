@@ -0,0 +1,323 @@
+/*
+ * output.c
+ *
+ * Result output modes.
+ *
+ * Next to the full text dump, the result can be written as a decimated
+ * array, as a per-bucket min/max envelope (which, unlike decimation, keeps
+ * every peak visible at plot resolution) or as a digest for regression
+ * checks. All three reductions split the grid over the threads the same
+ * way the engines and init_fill() do, so each thread reads the part it
+ * last wrote and the reduction runs at memory bandwidth.
+ *
+ * The digest is computed over fixed blocks of OUTPUT_BLOCK points and the
+ * per-block results are combined in index order, so it is the same for
+ * every thread count.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "output.h"
+#include "file.h"
+
+#define OUTPUT_BLOCK 65536L
+
+#define FNV_OFFSET UINT64_C(14695981039346656037)
+#define FNV_PRIME UINT64_C(1099511628211)
+
+typedef struct {
+    uint64_t hash;
+    double min, max, sum, sum_sq;
+    long argmin, argmax;
+} BlockSummary;
+
+typedef struct {
+    const output_mode_t *mode;
+    const double *array;
+    long i_max;
+    long lo, hi;              /* units: output points, or blocks for digests */
+    double *values;           /* decimate: width, envelope: 2 * width */
+    BlockSummary *blocks;
+} OutputArgs;
+
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    size_t k;
+
+    for (k = 0; k < size; k++) {
+        hash ^= p[k];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* First grid index of bucket b of width. */
+static long bucket_start(long b, long i_max, long width)
+{
+    return (long) ((double) b * i_max / width);
+}
+
+static void summarise_block(const double *array, long lo, long hi,
+                            BlockSummary *s)
+{
+    long i;
+
+    s->hash = fnv1a(FNV_OFFSET, array + lo, (hi - lo) * sizeof(double));
+    s->min = s->max = array[lo];
+    s->argmin = s->argmax = lo;
+    s->sum = s->sum_sq = 0;
+    for (i = lo; i < hi; i++) {
+        if (array[i] < s->min) {
+            s->min = array[i];
+            s->argmin = i;
+        }
+        if (array[i] > s->max) {
+            s->max = array[i];
+            s->argmax = i;
+        }
+        s->sum += array[i];
+        s->sum_sq += array[i] * array[i];
+    }
+}
+
+static void *output_worker(void *arg)
+{
+    OutputArgs *args = (OutputArgs *) arg;
+    const double *array = args->array;
+    const long i_max = args->i_max, width = args->mode->width;
+    long b, i;
+
+    switch (args->mode->kind) {
+    case OUTPUT_DECIMATE:
+        for (b = args->lo; b < args->hi; b++) {
+            i = width > 1 ? (long) ((double) b * (i_max - 1) / (width - 1) + 0.5) : 0;
+            args->values[b] = array[i];
+        }
+        break;
+    case OUTPUT_ENVELOPE:
+        for (b = args->lo; b < args->hi; b++) {
+            long hi = bucket_start(b + 1, i_max, width);
+            double lo_value, hi_value;
+
+            i = bucket_start(b, i_max, width);
+            lo_value = hi_value = array[i];
+            for (; i < hi; i++) {
+                lo_value = array[i] < lo_value ? array[i] : lo_value;
+                hi_value = array[i] > hi_value ? array[i] : hi_value;
+            }
+            args->values[2 * b] = lo_value;
+            args->values[2 * b + 1] = hi_value;
+        }
+        break;
+    case OUTPUT_DIGEST:
+        for (b = args->lo; b < args->hi; b++) {
+            long hi = (b + 1) * OUTPUT_BLOCK < i_max ? (b + 1) * OUTPUT_BLOCK : i_max;
+
+            summarise_block(array, b * OUTPUT_BLOCK, hi, &args->blocks[b]);
+        }
+        break;
+    case OUTPUT_FULL:
+        break;
+    }
+    return NULL;
+}
+
+/*
+ * Runs output_worker() over `units' output points or digest blocks, split
+ * over the threads like init_fill() splits the grid.
+ */
+static void output_reduce(const output_mode_t *mode, const double *array,
+                          long i_max, long units, int num_threads,
+                          double *values, BlockSummary *blocks)
+{
+    pthread_t threads[num_threads];
+    OutputArgs args[num_threads];
+    long chunk_size = units / num_threads;
+    long remainder = units % num_threads;
+    long start = 0;
+    int thr;
+
+    if (num_threads < 1)
+        return;
+
+    for (thr = 0; thr < num_threads; thr++) {
+        long range = chunk_size + (thr < remainder ? 1 : 0);
+
+        args[thr].mode = mode;
+        args[thr].array = array;
+        args[thr].i_max = i_max;
+        args[thr].lo = start;
+        args[thr].hi = start + range;
+        args[thr].values = values;
+        args[thr].blocks = blocks;
+        start += range;
+
+        if (thr > 0)
+            pthread_create(&threads[thr], NULL, output_worker, &args[thr]);
+    }
+
+    output_worker(&args[0]);
+
+    for (thr = 1; thr < num_threads; thr++)
+        pthread_join(threads[thr], NULL);
+}
+
+/*
+ * Parses full, decimate:W, envelope:W or digest. Returns 0 on success.
+ */
+int output_parse(const char *spec, output_mode_t *mode)
+{
+    mode->width = 0;
+    if (strcmp(spec, "full") == 0) {
+        mode->kind = OUTPUT_FULL;
+    } else if (strcmp(spec, "digest") == 0) {
+        mode->kind = OUTPUT_DIGEST;
+    } else if (strncmp(spec, "decimate:", 9) == 0) {
+        mode->kind = OUTPUT_DECIMATE;
+        mode->width = strtol(spec + 9, NULL, 10);
+    } else if (strncmp(spec, "envelope:", 9) == 0) {
+        mode->kind = OUTPUT_ENVELOPE;
+        mode->width = strtol(spec + 9, NULL, 10);
+    } else {
+        return -1;
+    }
+
+    if ((mode->kind == OUTPUT_DECIMATE || mode->kind == OUTPUT_ENVELOPE) &&
+            mode->width < 1)
+        return -1;
+    return 0;
+}
+
+static void digest_add(output_digest_t *digest, const BlockSummary *s,
+                       double *sum, double *sum_sq)
+{
+    digest->hash = fnv1a(digest->hash, &s->hash, sizeof(s->hash));
+    if (s->min < digest->min) {
+        digest->min = s->min;
+        digest->argmin = s->argmin;
+    }
+    if (s->max > digest->max) {
+        digest->max = s->max;
+        digest->argmax = s->argmax;
+    }
+    *sum += s->sum;
+    *sum_sq += s->sum_sq;
+}
+
+/*
+ * Computes the digest of `array' with up to `num_threads' threads.
+ */
+void output_digest(const double *array, long i_max, int num_threads,
+                   output_digest_t *digest)
+{
+    const output_mode_t mode = { OUTPUT_DIGEST, 0 };
+    const long num_blocks = (i_max + OUTPUT_BLOCK - 1) / OUTPUT_BLOCK;
+    BlockSummary *blocks = malloc(num_blocks * sizeof(BlockSummary));
+    double sum = 0, sum_sq = 0;
+    long b;
+
+    digest->hash = FNV_OFFSET;
+    digest->min = digest->max = array[0];
+    digest->argmin = digest->argmax = 0;
+
+    if (blocks != NULL) {
+        output_reduce(&mode, array, i_max, num_blocks,
+                      num_threads < num_blocks ? num_threads : (int) num_blocks,
+                      NULL, blocks);
+        for (b = 0; b < num_blocks; b++)
+            digest_add(digest, &blocks[b], &sum, &sum_sq);
+        free(blocks);
+    } else {
+        /* Same result, one block at a time on this thread. */
+        for (b = 0; b < num_blocks; b++) {
+            long hi = (b + 1) * OUTPUT_BLOCK < i_max ? (b + 1) * OUTPUT_BLOCK : i_max;
+            BlockSummary s;
+
+            summarise_block(array, b * OUTPUT_BLOCK, hi, &s);
+            digest_add(digest, &s, &sum, &sum_sq);
+        }
+    }
+
+    digest->mean = sum / i_max;
+    digest->l2_norm = sqrt(sum_sq);
+}
+
+/*
+ * Writes `array' to `filename' in the given mode and returns 0 on success.
+ * The reduced modes use up to `num_threads' threads.
+ */
+int output_write(const char *filename, const output_mode_t *mode,
+                 const double *array, long i_max, int num_threads)
+{
+    output_digest_t digest;
+    long width = mode->width < i_max ? mode->width : i_max;
+    double *values;
+    FILE *fp;
+    long b;
+
+    if (mode->kind == OUTPUT_FULL) {
+        file_write_double_array(filename, array, i_max);
+        return 0;
+    }
+
+    values = NULL;
+    if (mode->kind == OUTPUT_DIGEST) {
+        output_digest(array, i_max, num_threads, &digest);
+    } else {
+        output_mode_t clamped = *mode;
+
+        clamped.width = width;
+        values = malloc(2 * width * sizeof(double));
+        if (values == NULL)
+            return -1;
+        output_reduce(&clamped, array, i_max, width,
+                      num_threads < width ? num_threads : (int) width,
+                      values, NULL);
+    }
+
+    fp = fopen(filename, "w");
+    if (!fp) {
+        perror(filename);
+        free(values);
+        return -1;
+    }
+
+    switch (mode->kind) {
+    case OUTPUT_DECIMATE:
+        for (b = 0; b < width; b++) {
+            long i = width > 1 ? (long) ((double) b * (i_max - 1) / (width - 1) + 0.5) : 0;
+
+            fprintf(fp, "%ld %.17g\n", i, values[b]);
+        }
+        break;
+    case OUTPUT_ENVELOPE:
+        for (b = 0; b < width; b++) {
+            fprintf(fp, "%ld %.17g %.17g\n", bucket_start(b, i_max, width),
+                    values[2 * b], values[2 * b + 1]);
+        }
+        break;
+    case OUTPUT_DIGEST:
+        fprintf(fp, "points %ld\nfnv1a64 %016" PRIx64 "\n"
+                "min %.17g\nargmin %ld\nmax %.17g\nargmax %ld\n"
+                "mean %.17g\nl2_norm %.17g\n", i_max, digest.hash,
+                digest.min, digest.argmin, digest.max, digest.argmax,
+                digest.mean, digest.l2_norm);
+        printf("Digest: fnv1a64 %016" PRIx64 ", min %g, max %g, mean %g, "
+                "L2 %g\n", digest.hash, digest.min, digest.max, digest.mean,
+                digest.l2_norm);
+        break;
+    case OUTPUT_FULL:
+        break;
+    }
+
+    free(values);
+    return fclose(fp) == 0 ? 0 : -1;
+}
@@ -0,0 +1,35 @@
+/*
+ * output.h
+ *
+ * Reduced result output for grids too large to write or plot in full.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    OUTPUT_FULL,       /* every point, one per line */
+    OUTPUT_DECIMATE,   /* `width' evenly spaced points, "index value" */
+    OUTPUT_ENVELOPE,   /* `width' buckets, "first_index min max" */
+    OUTPUT_DIGEST,     /* checksum and summary statistics */
+} output_kind_t;
+
+typedef struct {
+    output_kind_t kind;
+    long width;
+} output_mode_t;
+
+typedef struct {
+    uint64_t hash;        /* FNV-1a of the FNV-1a of each OUTPUT_BLOCK */
+    double min, max;
+    long argmin, argmax;
+    double mean, l2_norm;
+} output_digest_t;
+
+int output_parse(const char *spec, output_mode_t *mode);
+void output_digest(const double *array, long i_max, int num_threads,
+                   output_digest_t *digest);
+int output_write(const char *filename, const output_mode_t *mode,
+                 const double *array, long i_max, int num_threads);
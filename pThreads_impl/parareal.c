@@ -0,0 +1,552 @@
+/*
+ * parareal.c
+ *
+ * Parareal engine (Lions, Maday, Turinici) for small grids with many
+ * steps, where sweeping the grid in parallel does not pay.
+ *
+ * The time axis is cut into N windows of equal length (the last may be
+ * shorter), each starting from a state U_n: the two levels at its first
+ * step. F runs a window on the fine stencil, G approximates it on a grid
+ * `ratio' times coarser in space and time (so the Courant number is
+ * unchanged). After one serial G sweep for the first guess, every
+ * correction runs F on all unfinished windows concurrently and then
+ * sweeps serially
+ *
+ *     U_{n+1} <- F(U_n, old) + G(U_n, new) - G(U_n, old).
+ *
+ * After k corrections the first k windows are exact, so N corrections
+ * reproduce the serial run bit for bit (the G terms cancel exactly once
+ * their inputs agree).
+ *
+ * Plain Parareal does not converge for the undamped wave equation: the
+ * coarse grid's dispersion error makes F - G of order one on most modes,
+ * and the sweep amplifies it. So G is Krylov-enhanced (Gander, Petcu):
+ * the states F has run so far span a space S, kept as an orthonormal
+ * basis together with the F images of its vectors. Since F is linear,
+ * the part of a state in S is propagated exactly from those, and only
+ * the rest goes through the coarse grid. S grows by N vectors per
+ * correction, which keeps the sweep from amplifying the coarse error
+ * before the exact windows reach it. It does not make the iteration
+ * converge early: on 2001 points it still takes all N corrections (4 of
+ * 4, 16 of 16, 32 of 32) at tolerances down to 1e-2 and stops a few
+ * short only around 1e-1, so a Parareal run costs the serial run and
+ * more. F is linear only with zero boundary values; with others the
+ * engine falls back to the plain coarse propagator.
+ *
+ * The coarse propagator works on increments: it restricts the state by
+ * full weighting, runs the coarse steps, and adds the interpolated change
+ * in displacement and in velocity (dt u_t = cur - old + lap / 2) to the
+ * fine state. The coarse level ratio steps back comes from the same
+ * Taylor series as in the AMR engine. Boundary values are never written;
+ * each state gets the ones its levels have in the serial run.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "parareal.h"
+#include "kernel.h"
+#include "timer.h"
+
+/* Memory the Krylov basis may take, states and images together. */
+#define KRYLOV_BYTES (256L << 20)
+
+static const double c = STENCIL_C;
+
+typedef struct Parareal Parareal;
+
+typedef struct {
+    int id;
+    double *buf[3];             /* fine levels */
+    double *work;               /* coarse levels, a projected state, coefficients */
+    Parareal *pr;
+} PararealWorker;
+
+enum { PHASE_FINE, PHASE_COARSE };
+
+struct Parareal {
+    parareal_params_t params;
+    long i_max, nc;
+    int windows, num_threads;
+    long length;                /* steps per window, the last may have fewer */
+    long *start;                /* first step of each window, then t_max */
+    double edges[3][2];         /* boundary values of level j are edges[j % 3] */
+    stencil_func_t stencil;
+
+    /* Two levels per state, previous then current. */
+    double **state;             /* U_n, n = 0 .. windows */
+    double **fine;              /* F(U_n) */
+    double **coarse;            /* G(U_n) */
+    double *window_seconds;
+    int first;                  /* first window still to run on F */
+    int phase;                  /* what the workers do */
+
+    /* Krylov enhancement: orthonormal q[] and F(q[]) for full windows. */
+    int krylov;
+    long basis, max_basis;
+    double **q, **fq;
+};
+
+
+static void set_edges(const Parareal *pr, double *level, long j)
+{
+    level[0] = pr->edges[j % 3][0];
+    level[pr->i_max - 1] = pr->edges[j % 3][1];
+}
+
+static double dot(const double *a, const double *b, long n)
+{
+    double sum = 0;
+
+    for (long i = 0; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+/* F: the window's steps on the fine stencil, from state[n] to fine[n]. */
+static void fine_window(Parareal *pr, int n, double *buf[3])
+{
+    const long i_max = pr->i_max, t = pr->start[n];
+    double *old = buf[0], *cur = buf[1], *next = buf[2], *temp;
+
+    memcpy(old, pr->state[n], i_max * sizeof(double));
+    memcpy(cur, pr->state[n] + i_max, i_max * sizeof(double));
+    set_edges(pr, next, t + 2);
+
+    for (long s = t; s < pr->start[n + 1]; s++) {
+        pr->stencil(next, cur, old, 1, i_max - 1);
+        temp = old;
+        old = cur;
+        cur = next;
+        next = temp;
+    }
+    memcpy(pr->fine[n], old, i_max * sizeof(double));
+    memcpy(pr->fine[n] + i_max, cur, i_max * sizeof(double));
+}
+
+/* dt u_t at point i of the level pair, from the wave equation. */
+static double velocity(const double *old, const double *cur, long i)
+{
+    return cur[i] - old[i] + c * (cur[i-1] - 2 * cur[i] + cur[i+1]) / 2;
+}
+
+/*
+ * Full weighting onto coarse point J: hat weights (r - |k|) / r^2 over
+ * the r - 1 fine points on either side. Injection would alias grid-scale
+ * content onto smooth coarse modes, which the sweep then amplifies.
+ * `back' selects the level r fine steps earlier, from the Taylor series
+ * u - r (dt u_t) + r^2 (dt^2 u_tt) / 2 with dt^2 u_tt = lap.
+ */
+static double restrict_level(const double *old, const double *cur, long J,
+        int r, long nc, int back)
+{
+    double sum = 0;
+
+    if (J == 0 || J == nc - 1)
+        return cur[J * r];
+    for (long f = J * r - r + 1; f < J * r + r; f++) {
+        const double w = (double) (r - labs(f - J * r)) / (r * r);
+        double u = cur[f];
+
+        if (back) {
+            const double lap = c * (cur[f-1] - 2 * cur[f] + cur[f+1]);
+
+            u += -r * (cur[f] - old[f] + lap / 2) + r * r * lap / 2;
+        }
+        sum += w * u;
+    }
+    return sum;
+}
+
+/* G: window n from state `in' to `out', using 5 * nc doubles of `work'. */
+static void coarse_window(const Parareal *pr, int n, const double *in,
+        double *out, double *work)
+{
+    const int r = pr->params.ratio;
+    const long i_max = pr->i_max, nc = pr->nc;
+    const long t = pr->start[n], steps = pr->start[n + 1] - t;
+    const double *old = in, *cur = in + i_max;
+    double *level[3] = { work, work + nc, work + 2 * nc }, *temp;
+    double *du = work + 3 * nc, *dv = work + 4 * nc;
+    double *out_old = out, *out_cur = out + i_max;
+    long J;
+
+    /* The current level, and the one r fine steps back. */
+    for (J = 0; J < nc; J++) {
+        level[1][J] = restrict_level(old, cur, J, r, nc, 0);
+        level[0][J] = restrict_level(old, cur, J, r, nc, 1);
+        level[2][J] = cur[J * r];
+    }
+    for (J = 1; J < nc - 1; J++) {
+        du[J] = level[1][J];
+        dv[J] = velocity(level[0], level[1], J) / r;
+    }
+
+    for (long s = 0; s < steps / r; s++) {
+        stencil_plain(level[2], level[1], level[0], 1, nc - 1);
+        temp = level[0];
+        level[0] = level[1];
+        level[1] = level[2];
+        level[2] = temp;
+    }
+
+    du[0] = du[nc - 1] = dv[0] = dv[nc - 1] = 0;
+    for (J = 1; J < nc - 1; J++) {
+        du[J] = level[1][J] - du[J];
+        dv[J] = velocity(level[0], level[1], J) / r - dv[J];
+    }
+
+    /* Interpolated increments on the fine grid. */
+    for (long i = 1; i < i_max - 1; i++) {
+        const long a = i / r;
+        const double w = (double) (i - a * r) / r;
+        const double dui = (1 - w) * du[a] + (a + 1 < nc ? w * du[a + 1] : 0);
+
+        out_cur[i] = cur[i] + dui;
+    }
+    set_edges(pr, out_cur, t + steps + 1);
+    for (long i = 1; i < i_max - 1; i++) {
+        const long a = i / r;
+        const double w = (double) (i - a * r) / r;
+        const double dvi = (1 - w) * dv[a] + (a + 1 < nc ? w * dv[a + 1] : 0);
+        const double v = velocity(old, cur, i) + dvi;
+
+        /* Invert dt u_t = cur - old + lap / 2 for the previous level. */
+        out_old[i] = out_cur[i] - v
+                     + c * (out_cur[i-1] - 2 * out_cur[i] + out_cur[i+1]) / 2;
+    }
+    set_edges(pr, out_old, t + steps);
+}
+
+/*
+ * The enhanced G: the part of `in' in the basis exactly, the rest on the
+ * coarse grid. `work' holds 5 * nc + 2 * i_max + max_basis doubles.
+ */
+static void propagate(const Parareal *pr, int n, const double *in, double *out,
+        double *work)
+{
+    const long len = 2 * pr->i_max;
+    double *rest = work + 5 * pr->nc, *h = rest + len;
+    long j;
+
+    if (!pr->krylov || pr->basis == 0 ||
+            pr->start[n + 1] - pr->start[n] != pr->length) {
+        coarse_window(pr, n, in, out, work);
+        return;
+    }
+
+    memcpy(rest, in, len * sizeof(double));
+    for (j = 0; j < pr->basis; j++) {
+        h[j] = dot(pr->q[j], in, len);
+        for (long i = 0; i < len; i++)
+            rest[i] -= h[j] * pr->q[j][i];
+    }
+    coarse_window(pr, n, rest, out, work);
+    for (j = 0; j < pr->basis; j++) {
+        for (long i = 0; i < len; i++)
+            out[i] += h[j] * pr->fq[j][i];
+    }
+}
+
+/*
+ * Adds state[n] and fine[n] to the basis, orthogonalised twice (Gram-
+ * Schmidt), unless the state is already in its span. `v' and `fv' are
+ * scratch states.
+ */
+static int extend_basis(Parareal *pr, int n, double *v, double *fv)
+{
+    const long len = 2 * pr->i_max;
+    const double norm0 = sqrt(dot(pr->state[n], pr->state[n], len));
+    double norm;
+
+    if (pr->basis == pr->max_basis || norm0 == 0)
+        return 0;
+    memcpy(v, pr->state[n], len * sizeof(double));
+    memcpy(fv, pr->fine[n], len * sizeof(double));
+    for (int pass = 0; pass < 2; pass++) {
+        for (long j = 0; j < pr->basis; j++) {
+            const double h = dot(pr->q[j], v, len);
+
+            for (long i = 0; i < len; i++) {
+                v[i] -= h * pr->q[j][i];
+                fv[i] -= h * pr->fq[j][i];
+            }
+        }
+    }
+    norm = sqrt(dot(v, v, len));
+    if (norm <= 1e-10 * norm0)
+        return 0;
+
+    pr->q[pr->basis] = malloc(len * sizeof(double));
+    pr->fq[pr->basis] = malloc(len * sizeof(double));
+    if (!pr->q[pr->basis] || !pr->fq[pr->basis]) {
+        free(pr->q[pr->basis]);
+        free(pr->fq[pr->basis]);
+        return -1;
+    }
+    for (long i = 0; i < len; i++) {
+        pr->q[pr->basis][i] = v[i] / norm;
+        pr->fq[pr->basis][i] = fv[i] / norm;
+    }
+    pr->basis++;
+    return 0;
+}
+
+/*
+ * Fine phase: F on every unfinished window. Coarse phase: the enhanced G
+ * of the current states past the first unfinished window, with the newly
+ * grown basis.
+ */
+static void *parareal_worker(void *arg)
+{
+    PararealWorker *w = arg;
+    Parareal *pr = w->pr;
+    struct timespec start;
+    const int from = pr->first + (pr->phase == PHASE_COARSE);
+
+    for (int n = from + w->id; n < pr->windows; n += pr->num_threads) {
+        timer_start_r(&start);
+        if (pr->phase == PHASE_FINE)
+            fine_window(pr, n, w->buf);
+        else
+            propagate(pr, n, pr->state[n], pr->coarse[n], w->work);
+        pr->window_seconds[n] = timer_end_r(&start);
+    }
+    return NULL;
+}
+
+/* Runs a phase on all workers; returns its slowest window. */
+static double run_phase(Parareal *pr, PararealWorker *workers, int phase)
+{
+    pthread_t threads[pr->num_threads];
+    double slowest = 0;
+    int thr;
+
+    pr->phase = phase;
+    for (thr = 1; thr < pr->num_threads; thr++)
+        pthread_create(&threads[thr], NULL, parareal_worker, &workers[thr]);
+    parareal_worker(&workers[0]);
+    for (thr = 1; thr < pr->num_threads; thr++)
+        pthread_join(threads[thr], NULL);
+
+    for (int n = pr->first + (phase == PHASE_COARSE); n < pr->windows; n++)
+        slowest = fmax(slowest, pr->window_seconds[n]);
+    return slowest;
+}
+
+/*
+ * Validates the parameters for this grid, and caps the windows at one per
+ * coarse step. Prints what is wrong and returns -1 if they do not fit.
+ */
+int parareal_check(parareal_params_t *params, long i_max, long t_max)
+{
+    const int r = params->ratio;
+
+    if (params->windows < 1 || !(params->tol > 0) || params->max_iter < 1 ||
+            r < 2) {
+        printf("argument error: parareal needs windows >= 1, tol > 0, "
+                "iterations >= 1 and ratio >= 2.\n");
+        return -1;
+    }
+    if ((i_max - 1) % r != 0 || (i_max - 1) / r < 2 || t_max % r != 0) {
+        printf("argument error: parareal with ratio %d needs i_max = %d*k + 1 "
+                "(k >= 2) and t_max a multiple of %d.\n", r, r, r);
+        return -1;
+    }
+    if (params->windows > t_max / r)
+        params->windows = t_max / r > 0 ? t_max / r : 1;
+    return 0;
+}
+
+static void free_levels(double **levels, long n)
+{
+    if (levels == NULL)
+        return;
+    for (long k = 0; k < n; k++)
+        free(levels[k]);
+    free(levels);
+}
+
+static double **alloc_levels(int n, long size)
+{
+    double **levels = calloc(n, sizeof(double *));
+
+    if (levels == NULL)
+        return NULL;
+    for (int k = 0; k < n; k++) {
+        levels[k] = malloc(size * sizeof(double));
+        if (levels[k] == NULL) {
+            free_levels(levels, n);
+            return NULL;
+        }
+    }
+    return levels;
+}
+
+static void parareal_free(Parareal *pr, PararealWorker *workers, double **scratch)
+{
+    free_levels(pr->state, pr->windows + 1);
+    free_levels(pr->fine, pr->windows);
+    free_levels(pr->coarse, pr->windows);
+    free_levels(pr->q, pr->basis);
+    free_levels(pr->fq, pr->basis);
+    free_levels(scratch, 3);
+    free(pr->start);
+    free(pr->window_seconds);
+    if (workers != NULL) {
+        for (int thr = 0; thr < pr->num_threads; thr++) {
+            free(workers[thr].buf[0]);
+            free(workers[thr].work);
+        }
+        free(workers);
+    }
+}
+
+/*
+ * Runs t_max steps from old/current and writes the last level to
+ * next_array. Returns next_array, or NULL on failure. The parameters
+ * must have passed parareal_check().
+ */
+double *simulate_parareal(const parareal_params_t *params, long i_max,
+        long t_max, int num_threads, double *old_array, double *current_array,
+        double *next_array, parareal_stats_t *stats)
+{
+    const double *first[3] = { old_array, current_array, next_array };
+    const int r = params->ratio;
+    const long coarse_steps = t_max / r;
+    PararealWorker *workers;
+    Parareal pr;
+    double **scratch, scale = 0;
+    struct timespec start;
+    long per;
+    int n, k, thr;
+
+    memset(&pr, 0, sizeof(pr));
+    pr.params = *params;
+    pr.i_max = i_max;
+    pr.nc = (i_max - 1) / r + 1;
+    pr.num_threads = num_threads;
+    pr.stencil = kernel_select(i_max);
+    pr.krylov = 1;
+    for (int b = 0; b < 3; b++) {
+        pr.edges[b][0] = first[b][0];
+        pr.edges[b][1] = first[b][i_max - 1];
+        if (pr.edges[b][0] != 0 || pr.edges[b][1] != 0)
+            pr.krylov = 0;
+    }
+
+    /* Equal windows of whole coarse steps; fewer if some would be empty. */
+    per = (coarse_steps + params->windows - 1) / params->windows;
+    pr.windows = per > 0 ? (coarse_steps + per - 1) / per : 1;
+    pr.length = per * r;
+    pr.max_basis = KRYLOV_BYTES / (4 * i_max * (long) sizeof(double));
+    if (pr.max_basis > 2 * i_max)
+        pr.max_basis = 2 * i_max;
+
+    pr.start = malloc((pr.windows + 1) * sizeof(long));
+    pr.window_seconds = calloc(pr.windows, sizeof(double));
+    pr.state = alloc_levels(pr.windows + 1, 2 * i_max);
+    pr.fine = alloc_levels(pr.windows, 2 * i_max);
+    pr.coarse = alloc_levels(pr.windows, 2 * i_max);
+    pr.q = calloc(pr.max_basis, sizeof(double *));
+    pr.fq = calloc(pr.max_basis, sizeof(double *));
+    scratch = alloc_levels(3, 2 * i_max);
+    workers = calloc(num_threads, sizeof(PararealWorker));
+    if (!pr.start || !pr.window_seconds || !pr.state || !pr.fine ||
+            !pr.coarse || !pr.q || !pr.fq || !scratch || !workers) {
+        parareal_free(&pr, workers, scratch);
+        return NULL;
+    }
+    for (thr = 0; thr < num_threads; thr++) {
+        PararealWorker *w = &workers[thr];
+
+        w->id = thr;
+        w->pr = &pr;
+        w->buf[0] = malloc(3 * i_max * sizeof(double));
+        w->work = malloc((5 * pr.nc + 2 * i_max + pr.max_basis) * sizeof(double));
+        if (w->buf[0] == NULL || w->work == NULL) {
+            parareal_free(&pr, workers, scratch);
+            return NULL;
+        }
+        w->buf[1] = w->buf[0] + i_max;
+        w->buf[2] = w->buf[0] + 2 * i_max;
+    }
+    for (n = 0; n <= pr.windows; n++)
+        pr.start[n] = n * pr.length < t_max ? n * pr.length : t_max;
+
+    memcpy(pr.state[0], old_array, i_max * sizeof(double));
+    memcpy(pr.state[0] + i_max, current_array, i_max * sizeof(double));
+    for (long i = 0; i < i_max; i++)
+        scale = fmax(scale, fabs(current_array[i]));
+    if (scale == 0)
+        scale = 1;
+
+    /* First guess: one serial coarse sweep. */
+    memset(stats, 0, sizeof(*stats));
+    timer_start_r(&start);
+    for (n = 0; n < pr.windows; n++) {
+        propagate(&pr, n, pr.state[n], pr.coarse[n], workers[0].work);
+        memcpy(pr.state[n + 1], pr.coarse[n], 2 * i_max * sizeof(double));
+    }
+    stats->critical_seconds = timer_end_r(&start);
+
+    for (k = 1; k <= params->max_iter && pr.first < pr.windows; k++) {
+        double change = 0;
+
+        stats->critical_seconds += run_phase(&pr, workers, PHASE_FINE);
+        if (k == 1) {
+            for (n = 0; n < pr.windows; n++)
+                stats->fine_seconds += pr.window_seconds[n];
+        }
+
+        /* Grow the basis, then redo G of the current states with it. */
+        if (pr.krylov) {
+            timer_start_r(&start);
+            for (n = pr.first; n < pr.windows; n++) {
+                if (pr.start[n + 1] - pr.start[n] == pr.length &&
+                        extend_basis(&pr, n, scratch[1], scratch[2]) != 0) {
+                    parareal_free(&pr, workers, scratch);
+                    return NULL;
+                }
+            }
+            stats->critical_seconds += timer_end_r(&start);
+            stats->critical_seconds += run_phase(&pr, workers, PHASE_COARSE);
+        }
+
+        /* The serial correction sweep; window `first' is exact now. */
+        timer_start_r(&start);
+        memcpy(pr.state[pr.first + 1], pr.fine[pr.first],
+               2 * i_max * sizeof(double));
+        for (n = pr.first + 1; n < pr.windows; n++) {
+            double *next = pr.state[n + 1], *guess = scratch[0];
+
+            propagate(&pr, n, pr.state[n], guess, workers[0].work);
+            for (long i = 0; i < 2 * i_max; i++) {
+                const double u = pr.fine[n][i] + (guess[i] - pr.coarse[n][i]);
+
+                change = fmax(change, fabs(u - next[i]));
+                next[i] = u;
+            }
+            scratch[0] = pr.coarse[n];
+            pr.coarse[n] = guess;
+        }
+        stats->critical_seconds += timer_end_r(&start);
+
+        pr.first++;
+        stats->iterations = k;
+        stats->change = change / scale;
+        if (change <= params->tol * scale)
+            break;
+    }
+    stats->windows = pr.windows;
+    stats->converged = stats->change <= params->tol || pr.first == pr.windows;
+
+    memcpy(next_array, pr.state[pr.windows] + i_max, i_max * sizeof(double));
+    parareal_free(&pr, workers, scratch);
+
+    return next_array;
+}
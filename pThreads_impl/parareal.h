@@ -0,0 +1,28 @@
+/*
+ * parareal.h
+ *
+ * Parareal: parallel in time. Windows of the time axis run concurrently
+ * on the fine stencil and are corrected by a cheap coarse propagator.
+ *
+ */
+
+#pragma once
+
+typedef struct {
+    int windows;          /* time windows, one fine task each */
+    double tol;           /* stop when no state moves more than tol * max |u| */
+    int max_iter;         /* corrections at most; windows makes it exact */
+    int ratio;            /* coarsening in space and time, >= 2 */
+} parareal_params_t;
+
+typedef struct {
+    int windows, iterations, converged;
+    double change;        /* largest relative change in the last correction */
+    double fine_seconds;  /* all windows once, i.e. the serial fine run */
+    double critical_seconds; /* coarse sweeps plus the slowest window each time */
+} parareal_stats_t;
+
+int parareal_check(parareal_params_t *params, long i_max, long t_max);
+double *simulate_parareal(const parareal_params_t *params, long i_max,
+        long t_max, int num_threads, double *old_array, double *current_array,
+        double *next_array, parareal_stats_t *stats);
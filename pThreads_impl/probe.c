@@ -0,0 +1,406 @@
+/*
+ * probe.c
+ *
+ * Probe recording and the background writer.
+ *
+ * Each worker owns the probes inside its chunk and, after sweeping, copies
+ * their new values into its own buffer: O(probes) per step, and no two
+ * threads write the same buffer. Buffers hold a block of rows and come in
+ * pairs. When a block is full, thread 0 hands it to the writer thread
+ * between the step barriers and the workers go on filling the other one;
+ * if the writer is still busy with that one, thread 0 waits, so a slow
+ * disk throttles the run instead of growing memory.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "probe.h"
+
+/* A full pair of blocks of all probes stays around this many doubles. */
+#define PROBE_BLOCK_VALUES (1L << 20)
+#define PROBE_SPEC_MAX (1 << 20)
+
+typedef struct {
+    int lo, hi;              /* owned probes: index[lo..hi) */
+    double *values[2];       /* [probe - lo][row] per buffer */
+} ProbeThread;
+
+struct probe_set {
+    long *index;
+    int count;
+    long i_max;
+
+    FILE *fp;
+    const char *path;
+    int binary;
+
+    int num_threads;
+    ProbeThread *threads;
+    long block;              /* rows per buffer */
+
+    /* Written by thread 0 between barriers, read by the workers. */
+    int fill;                /* buffer being filled */
+    long rows;               /* rows in it */
+    long first_step;
+
+    /* Hand-off to the writer. */
+    pthread_t writer;
+    int writer_started;
+    pthread_mutex_t lock;
+    pthread_cond_t work, idle;
+    int pending;             /* buffer to write, -1 when idle */
+    long pending_rows, pending_first;
+    int quit, failed;
+    long written;
+};
+
+
+static int compare_longs(const void *a, const void *b)
+{
+    long x = *(const long *) a, y = *(const long *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Parses a list of indices separated by commas or whitespace. */
+static int parse_indices(probe_set_t *p, const char *text)
+{
+    int cap = 0;
+
+    while (*text) {
+        char *end;
+        long value;
+
+        if (*text == ',' || isspace((unsigned char) *text)) {
+            text++;
+            continue;
+        }
+        if (*text == '#') {
+            while (*text && *text != '\n')
+                text++;
+            continue;
+        }
+
+        value = strtol(text, &end, 10);
+        if (end == text) {
+            fprintf(stderr, "probes: bad index near \"%.16s\"\n", text);
+            return -1;
+        }
+        text = end;
+
+        if (p->count == cap) {
+            long *grown;
+
+            cap = cap ? 2 * cap : 16;
+            grown = realloc(p->index, cap * sizeof(long));
+            if (grown == NULL)
+                return -1;
+            p->index = grown;
+        }
+        p->index[p->count++] = value;
+    }
+    return 0;
+}
+
+static int read_spec_file(probe_set_t *p, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char *text;
+    size_t n;
+    int ret;
+
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    text = malloc(PROBE_SPEC_MAX + 1);
+    if (text == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    n = fread(text, 1, PROBE_SPEC_MAX, fp);
+    text[n] = '\0';
+    if (!feof(fp)) {
+        fprintf(stderr, "%s: probe list too long\n", path);
+        ret = -1;
+    } else {
+        ret = parse_indices(p, text);
+    }
+    free(text);
+    fclose(fp);
+    return ret;
+}
+
+/*
+ * Reads the probe indices from `spec' ("i,j,k" or "@file") and creates
+ * `path' for the output. Only interior points can be probed: the engines
+ * never write the boundaries. Returns NULL on error.
+ */
+probe_set_t *probe_open(const char *spec, const char *path, long i_max)
+{
+    probe_set_t *p = calloc(1, sizeof(*p));
+    size_t len = strlen(path);
+    int k, unique;
+
+    if (p == NULL)
+        return NULL;
+    p->pending = -1;
+    p->i_max = i_max;
+    p->path = path;
+
+    if ((spec[0] == '@' ? read_spec_file(p, spec + 1) : parse_indices(p, spec)) != 0 ||
+            p->count == 0) {
+        if (p->count == 0)
+            fprintf(stderr, "probes: no indices given\n");
+        probe_close(p);
+        return NULL;
+    }
+
+    qsort(p->index, p->count, sizeof(long), compare_longs);
+    for (k = 0, unique = 0; k < p->count; k++) {
+        if (p->index[k] < 1 || p->index[k] > i_max - 2) {
+            fprintf(stderr, "probes: index %ld is not an interior point "
+                    "(1..%ld)\n", p->index[k], i_max - 2);
+            probe_close(p);
+            return NULL;
+        }
+        if (unique == 0 || p->index[k] != p->index[unique - 1])
+            p->index[unique++] = p->index[k];
+    }
+    p->count = unique;
+
+    p->block = PROBE_BLOCK_VALUES / (2 * p->count);
+    if (p->block < 16)
+        p->block = 16;
+
+    p->binary = len > 4 && strcmp(path + len - 4, ".bin") == 0;
+    p->fp = fopen(path, p->binary ? "wb" : "w");
+    if (!p->fp) {
+        perror(path);
+        probe_close(p);
+        return NULL;
+    }
+
+    if (p->binary) {
+        int64_t count = p->count;
+
+        fwrite("WPROBE1", 1, 8, p->fp);
+        fwrite(&count, sizeof(count), 1, p->fp);
+        for (k = 0; k < p->count; k++) {
+            int64_t index = p->index[k];
+
+            fwrite(&index, sizeof(index), 1, p->fp);
+        }
+    } else {
+        fprintf(p->fp, "step");
+        for (k = 0; k < p->count; k++)
+            fprintf(p->fp, ",%ld", p->index[k]);
+        fprintf(p->fp, "\n");
+    }
+
+    return p;
+}
+
+int probe_count(const probe_set_t *p)
+{
+    return p->count;
+}
+
+static int write_block(probe_set_t *p, int buf, long first, long rows)
+{
+    int thr, k;
+    long r;
+
+    if (p->binary) {
+        int64_t header[2] = { first, rows };
+
+        fwrite(header, sizeof(int64_t), 2, p->fp);
+        for (thr = 0; thr < p->num_threads; thr++) {
+            const ProbeThread *pt = &p->threads[thr];
+
+            for (k = 0; k < pt->hi - pt->lo; k++)
+                fwrite(pt->values[buf] + k * p->block, sizeof(double), rows, p->fp);
+        }
+    } else {
+        for (r = 0; r < rows; r++) {
+            fprintf(p->fp, "%ld", first + r);
+            for (thr = 0; thr < p->num_threads; thr++) {
+                const ProbeThread *pt = &p->threads[thr];
+
+                for (k = 0; k < pt->hi - pt->lo; k++)
+                    fprintf(p->fp, ",%.17g", pt->values[buf][k * p->block + r]);
+            }
+            fprintf(p->fp, "\n");
+        }
+    }
+
+    return ferror(p->fp) ? -1 : 0;
+}
+
+static void *probe_writer(void *arg)
+{
+    probe_set_t *p = (probe_set_t *) arg;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        int buf;
+        long first, rows;
+
+        while (p->pending < 0 && !p->quit)
+            pthread_cond_wait(&p->work, &p->lock);
+        if (p->pending < 0)
+            break;
+        buf = p->pending;
+        first = p->pending_first;
+        rows = p->pending_rows;
+        pthread_mutex_unlock(&p->lock);
+
+        if (write_block(p, buf, first, rows) != 0)
+            p->failed = 1;
+
+        pthread_mutex_lock(&p->lock);
+        p->written += rows;
+        p->pending = -1;
+        pthread_cond_signal(&p->idle);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+/*
+ * Gives the filling buffer to the writer, once it is done with the other
+ * one, and switches to that.
+ */
+static void hand_off(probe_set_t *p)
+{
+    pthread_mutex_lock(&p->lock);
+    while (p->pending >= 0)
+        pthread_cond_wait(&p->idle, &p->lock);
+    p->pending = p->fill;
+    p->pending_first = p->first_step;
+    p->pending_rows = p->rows;
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    p->fill ^= 1;
+    p->rows = 0;
+}
+
+/*
+ * Sets up per-thread buffers for `num_threads' workers and starts the
+ * writer. Every worker must then be given its chunk with probe_assign().
+ */
+int probe_attach(probe_set_t *p, int num_threads)
+{
+    p->threads = calloc(num_threads, sizeof(ProbeThread));
+    if (p->threads == NULL)
+        return -1;
+    p->num_threads = num_threads;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    if (pthread_create(&p->writer, NULL, probe_writer, p) != 0)
+        return -1;
+    p->writer_started = 1;
+    return 0;
+}
+
+/*
+ * Gives thread `thr' the probes inside [start, end). Returns -1 if their
+ * buffers cannot be allocated.
+ */
+int probe_assign(probe_set_t *p, int thr, long start, long end)
+{
+    ProbeThread *pt = &p->threads[thr];
+    int k;
+
+    for (k = 0; k < p->count && p->index[k] < start; k++)
+        ;
+    pt->lo = k;
+    for (; k < p->count && p->index[k] < end; k++)
+        ;
+    pt->hi = k;
+
+    if (pt->hi > pt->lo) {
+        for (int b = 0; b < 2; b++) {
+            free(pt->values[b]);
+            pt->values[b] = malloc((pt->hi - pt->lo) * p->block * sizeof(double));
+        }
+        if (!pt->values[0] || !pt->values[1])
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Worker `thr': stores its probes' values of `level' as the current row.
+ */
+void probe_record(probe_set_t *p, int thr, const double *level)
+{
+    const ProbeThread *pt = &p->threads[thr];
+    double *column = pt->values[p->fill] + p->rows;
+    const long block = p->block;
+
+    for (int k = pt->lo; k < pt->hi; k++, column += block)
+        *column = level[p->index[k]];
+}
+
+/*
+ * Thread 0, after all workers recorded the row of `step'.
+ */
+void probe_advance(probe_set_t *p, long step)
+{
+    if (p->rows == 0)
+        p->first_step = step;
+    if (++p->rows == p->block)
+        hand_off(p);
+}
+
+/*
+ * Writes out the remaining rows, stops the writer and frees `p'. Only
+ * once the session has let go of it. Returns 0 if the output is complete.
+ */
+int probe_close(probe_set_t *p)
+{
+    int ret = 0, thr;
+
+    if (p->writer_started) {
+        if (p->rows > 0)
+            hand_off(p);
+        pthread_mutex_lock(&p->lock);
+        p->quit = 1;
+        pthread_cond_signal(&p->work);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->writer, NULL);
+
+        if (!p->failed)
+            printf("Probes: %d series, %ld rows written to %s\n",
+                    p->count, p->written, p->path);
+        pthread_cond_destroy(&p->idle);
+        pthread_cond_destroy(&p->work);
+        pthread_mutex_destroy(&p->lock);
+    }
+
+    if (p->fp != NULL && (fclose(p->fp) != 0 || p->failed)) {
+        perror(p->path);
+        ret = -1;
+    }
+    if (p->threads != NULL) {
+        for (thr = 0; thr < p->num_threads; thr++) {
+            free(p->threads[thr].values[0]);
+            free(p->threads[thr].values[1]);
+        }
+    }
+    free(p->threads);
+    free(p->index);
+    free(p);
+    return ret;
+}
@@ -0,0 +1,31 @@
+/*
+ * probe.h
+ *
+ * Probes: time series of the wave at a few grid points, recorded by the
+ * barrier engine's workers during the sweep.
+ *
+ * The output is CSV ("step,<index>,<index>,...", one row per step) unless
+ * the file name ends in ".bin", in which case it is columnar binary in
+ * native byte order:
+ *
+ *     char magic[8] = "WPROBE1"; int64 count; int64 index[count];
+ *     then blocks of { int64 first_step; int64 rows;
+ *                      double column[count][rows]; }
+ *
+ * Probes are sorted by index and duplicates dropped.
+ *
+ */
+
+#pragma once
+
+typedef struct probe_set probe_set_t;
+
+probe_set_t *probe_open(const char *spec, const char *path, long i_max);
+int probe_count(const probe_set_t *p);
+int probe_close(probe_set_t *p);
+
+/* Used by the session; see session_set_probes(). */
+int probe_attach(probe_set_t *p, int num_threads);
+int probe_assign(probe_set_t *p, int thr, long start, long end);
+void probe_record(probe_set_t *p, int thr, const double *level);
+void probe_advance(probe_set_t *p, long step);
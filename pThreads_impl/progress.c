@@ -0,0 +1,174 @@
+/*
+ * progress.c
+ *
+ * Progress monitor thread.
+ *
+ * The monitor only reads the snapshot the session publishes at each step
+ * boundary (session_progress()), so polling never pauses the workers.
+ * Every `interval' seconds it rewrites the metrics file: the text goes to
+ * a temporary file that is then renamed over the old one, so a scraper
+ * never sees a half-written page. Deadline and stop flag are checked
+ * every POLL_MS milliseconds; when either trips the session is cancelled
+ * and stops at the next step boundary.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "progress.h"
+#include "timer.h"
+
+#define POLL_MS 50
+#define METRICS_PATH_MAX 1024
+
+
+static void write_metrics(progress_t *p, long t, double seconds, int stopped)
+{
+    const int threads = session_threads(p->session);
+    const double rate = seconds > 0 ? t / seconds : 0;
+    char tmp[METRICS_PATH_MAX];
+    FILE *fp;
+    int thr;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", p->opts.metrics_path)
+            >= (int) sizeof(tmp))
+        return;
+    fp = fopen(tmp, "w");
+    if (!fp) {
+        perror(tmp);
+        return;
+    }
+
+    fprintf(fp, "# HELP wave_step Time steps completed.\n"
+            "# TYPE wave_step gauge\nwave_step %ld\n", t);
+    fprintf(fp, "# HELP wave_step_target Time steps requested.\n"
+            "# TYPE wave_step_target gauge\nwave_step_target %ld\n", p->t_target);
+    fprintf(fp, "# HELP wave_elapsed_seconds Wall time spent stepping.\n"
+            "# TYPE wave_elapsed_seconds gauge\nwave_elapsed_seconds %g\n", seconds);
+    fprintf(fp, "# HELP wave_steps_per_second Mean step rate so far.\n"
+            "# TYPE wave_steps_per_second gauge\nwave_steps_per_second %g\n", rate);
+    fprintf(fp, "# HELP wave_eta_seconds Time to the last step at the mean rate.\n"
+            "# TYPE wave_eta_seconds gauge\nwave_eta_seconds %g\n",
+            rate > 0 ? (p->t_target - t) / rate : -1);
+
+    fprintf(fp, "# HELP wave_thread_updates_per_second Point updates per second "
+            "of compute, per worker.\n"
+            "# TYPE wave_thread_updates_per_second gauge\n");
+    for (thr = 0; thr < threads; thr++) {
+        fprintf(fp, "wave_thread_updates_per_second{thread=\"%d\"} %g\n",
+                thr, p->rates[thr]);
+    }
+
+    fprintf(fp, "# HELP wave_cancelled 1 once the run was told to stop early.\n"
+            "# TYPE wave_cancelled gauge\nwave_cancelled %d\n", p->reason != NULL);
+    fprintf(fp, "# HELP wave_finished 1 once stepping has ended.\n"
+            "# TYPE wave_finished gauge\nwave_finished %d\n", stopped);
+
+    if (fclose(fp) != 0 || rename(tmp, p->opts.metrics_path) != 0)
+        perror(p->opts.metrics_path);
+}
+
+static void *progress_main(void *arg)
+{
+    progress_t *p = (progress_t *) arg;
+    double since_write = p->opts.interval;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->quit) {
+        struct timespec until;
+        double seconds;
+        long t;
+        int rc;
+
+        t = session_progress(p->session, &seconds, p->rates);
+
+        if (p->reason == NULL) {
+            if (p->opts.stop_flag != NULL && *p->opts.stop_flag)
+                p->reason = "stop signal";
+            else if (p->opts.deadline > 0 && seconds >= p->opts.deadline)
+                p->reason = "deadline";
+            if (p->reason != NULL)
+                session_cancel(p->session);
+        }
+
+        if (p->opts.metrics_path != NULL && since_write >= p->opts.interval) {
+            write_metrics(p, t, seconds, 0);
+            since_write = 0;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += POLL_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        do {
+            rc = pthread_cond_timedwait(&p->wake, &p->lock, &until);
+        } while (rc == 0 && !p->quit);
+        since_write += POLL_MS * 1e-3;
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+/*
+ * Starts monitoring `session', which is to be stepped to `t_target'.
+ * Call before session_step(); returns nonzero on failure.
+ */
+int progress_start(progress_t *p, sim_session_t *session, long t_target,
+                   const progress_opts_t *opts)
+{
+    p->session = session;
+    p->t_target = t_target;
+    p->opts = *opts;
+    p->quit = 0;
+    p->reason = NULL;
+    if (p->opts.interval <= 0)
+        p->opts.interval = 1;
+
+    p->rates = calloc(session_threads(session), sizeof(double));
+    if (p->rates == NULL)
+        return -1;
+
+    session_set_tracking(session, opts->metrics_path != NULL);
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    if (pthread_create(&p->thread, NULL, progress_main, p) != 0) {
+        pthread_cond_destroy(&p->wake);
+        pthread_mutex_destroy(&p->lock);
+        free(p->rates);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Stops the monitor once stepping has returned and writes the final
+ * metrics page.
+ */
+void progress_stop(progress_t *p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+
+    if (p->opts.metrics_path != NULL) {
+        double seconds;
+        long t = session_progress(p->session, &seconds, p->rates);
+
+        write_metrics(p, t, seconds, 1);
+    }
+
+    session_set_tracking(p->session, 0);
+    pthread_cond_destroy(&p->wake);
+    pthread_mutex_destroy(&p->lock);
+    free(p->rates);
+}
@@ -0,0 +1,40 @@
+/*
+ * progress.h
+ *
+ * Progress monitor for a running session: refreshes a Prometheus-format
+ * metrics file that other processes can poll, and cancels the run at a
+ * step boundary on a deadline or a stop request.
+ *
+ */
+
+#pragma once
+
+#include <signal.h>
+#include <pthread.h>
+
+#include "session.h"
+
+typedef struct {
+    const char *metrics_path;            /* NULL: no metrics file */
+    double interval;                     /* seconds between refreshes */
+    double deadline;                     /* seconds of stepping, 0: none */
+    volatile sig_atomic_t *stop_flag;    /* cancel once nonzero, may be NULL */
+} progress_opts_t;
+
+typedef struct {
+    sim_session_t *session;
+    long t_target;
+    progress_opts_t opts;
+    double *rates;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int quit;
+
+    const char *reason;   /* why the run was cancelled, NULL if it was not */
+} progress_t;
+
+int progress_start(progress_t *p, sim_session_t *session, long t_target,
+                   const progress_opts_t *opts);
+void progress_stop(progress_t *p);
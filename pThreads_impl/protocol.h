@@ -0,0 +1,55 @@
+/*
+ * protocol.h
+ *
+ * Wire format between wave_server and its clients.
+ *
+ * A client connects to the server's Unix socket, writes one wave_request_t
+ * and reads one wave_reply_t. A successful job reply carries a file
+ * descriptor (SCM_RIGHTS) for a shared memory segment holding the i_max
+ * doubles of the result, which the client maps instead of reading text.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define WAVE_MAGIC 0x57415645u    /* "WAVE" */
+#define WAVE_DEFAULT_SOCKET "wave.sock"
+
+/* wave_request_t kinds. */
+enum { WAVE_JOB, WAVE_SHUTDOWN };
+
+/* wave_reply_t status codes. */
+enum {
+    WAVE_OK,
+    WAVE_EINVAL,          /* malformed request or unknown mode */
+    WAVE_ENOMEM,          /* does not fit the server's arena */
+    WAVE_EFAIL,           /* the server could not run or hand off the job */
+};
+
+typedef struct {
+    uint32_t magic;
+    int32_t kind;
+    int32_t priority;     /* higher runs first, FIFO among equals */
+    char mode[12];        /* "sin", "sinfull" or "gauss" */
+    int64_t i_max;
+    int64_t t_max;
+} wave_request_t;
+
+typedef struct {
+    uint32_t magic;
+    int32_t status;
+    int64_t i_max;
+    int64_t t_max;
+    double queued;        /* seconds between arrival and start */
+    double seconds;       /* seconds spent stepping */
+} wave_reply_t;
+
+int wave_connect(const char *path);
+int wave_write_all(int sock, const void *buf, size_t len);
+int wave_read_all(int sock, void *buf, size_t len);
+int wave_send_reply(int sock, const wave_reply_t *reply, int fd);
+int wave_recv_reply(int sock, wave_reply_t *reply, int *fd);
+const double *wave_map_result(int fd, long i_max);
+void wave_unmap_result(const double *result, long i_max);
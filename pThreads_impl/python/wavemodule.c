@@ -0,0 +1,208 @@
+/*
+ * wavemodule.c
+ *
+ * Python bindings: the `wavesim' module runs the simulation engines on
+ * caller-owned buffers, so notebooks can drive sweeps without writing and
+ * parsing result.txt.
+ *
+ *     import numpy as np, wavesim
+ *     old = np.zeros(n); cur = np.zeros(n); ...
+ *     result = wavesim.simulate(old, cur, t_max, threads=4)
+ *
+ * Any writable, C-contiguous buffer of doubles works (NumPy float64 arrays,
+ * array.array('d'), ...). The engines rotate through old, current and next
+ * in place; the result is returned as the object holding it, never copied.
+ * The GIL is released while the engine runs, and the buffers stay exported
+ * until it is done, so they cannot be resized under it.
+ *
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string.h>
+
+#include "../simulate.h"
+
+static const struct {
+    const char *name;
+    simulate_func_t func;
+} engines[] = {
+    { "barrier", simulate },
+    { "chunk", simulate_v2 },
+    { "sequential", simulateSequential_v1 },
+    { "trapezoid", simulateSequential_trapezoid },
+    { "spectral", simulate_spectral },
+};
+static const int num_engines = sizeof(engines) / sizeof(engines[0]);
+
+
+/* Exports `obj' as a writable C-contiguous array of doubles. */
+static int get_level(PyObject *obj, const char *what, Py_buffer *view)
+{
+    if (PyObject_GetBuffer(obj, view, PyBUF_WRITABLE | PyBUF_FORMAT |
+                PyBUF_C_CONTIGUOUS) != 0)
+        return -1;
+
+    if (view->itemsize != sizeof(double) || view->format == NULL ||
+            (strcmp(view->format, "d") != 0 && strcmp(view->format, "=d") != 0 &&
+             strcmp(view->format, "<d") != 0)) {
+        PyErr_Format(PyExc_TypeError, "%s must be a buffer of float64", what);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    return 0;
+}
+
+PyDoc_STRVAR(simulate_doc,
+"simulate(old, current, t_max, threads=1, engine='barrier', next=None)\n"
+"\n"
+"Advances the wave from levels `old' and `current' by t_max steps in place\n"
+"and returns the object that holds the result: `old', `current' or `next'.\n"
+"Without `next' a scratch level is allocated, and the result may be a\n"
+"float64 memoryview of it. All buffers must be writable float64\n"
+"arrays of the same length (>2).");
+
+static PyObject *wave_simulate(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = { "old", "current", "t_max", "threads", "engine",
+                                "next", NULL };
+    PyObject *objs[3] = { NULL, NULL, NULL };
+    const char *engine_name = "barrier";
+    simulate_func_t engine = NULL;
+    Py_buffer views[3];
+    long t_max, i_max;
+    int threads = 1, got = 0, e, k;
+    double *ret;
+    PyObject *result = NULL, *scratch = NULL;
+
+    (void) self;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOl|isO", keywords,
+                &objs[0], &objs[1], &t_max, &threads, &engine_name, &objs[2]))
+        return NULL;
+
+    for (e = 0; e < num_engines; e++) {
+        if (strcmp(engine_name, engines[e].name) == 0)
+            engine = engines[e].func;
+    }
+    if (engine == NULL) {
+        PyErr_Format(PyExc_ValueError, "unknown engine '%s'", engine_name);
+        return NULL;
+    }
+    if (t_max < 1 || threads < 1) {
+        PyErr_SetString(PyExc_ValueError, "t_max and threads must be >= 1");
+        return NULL;
+    }
+
+    if (objs[2] == NULL || objs[2] == Py_None) {
+        PyObject *bytes, *raw;
+        Py_ssize_t size;
+
+        if (PyObject_GetBuffer(objs[1], &views[0], PyBUF_SIMPLE) != 0)
+            return NULL;
+        size = views[0].len;
+        PyBuffer_Release(&views[0]);
+
+        /* Zeroed, like the engines expect of a fresh buffer. */
+        raw = PyByteArray_FromStringAndSize(NULL, size);
+        if (raw == NULL)
+            return NULL;
+        memset(PyByteArray_AS_STRING(raw), 0, size);
+        bytes = PyMemoryView_FromObject(raw);
+        Py_DECREF(raw);
+        if (bytes == NULL)
+            return NULL;
+        scratch = PyObject_CallMethod(bytes, "cast", "s", "d");
+        Py_DECREF(bytes);
+        if (scratch == NULL)
+            return NULL;
+        objs[2] = scratch;
+    }
+
+    for (got = 0; got < 3; got++) {
+        static const char *const names[3] = { "old", "current", "next" };
+
+        if (get_level(objs[got], names[got], &views[got]) != 0)
+            goto out;
+    }
+
+    i_max = views[0].len / sizeof(double);
+    if (i_max < 3 || views[1].len != views[0].len || views[2].len != views[0].len) {
+        PyErr_SetString(PyExc_ValueError,
+                        "levels must have the same length, of at least 3");
+        goto out;
+    }
+    for (k = 0; k < 3; k++) {
+        const char *a = views[k].buf, *b = views[(k + 1) % 3].buf;
+
+        if (a < b + views[0].len && b < a + views[0].len) {
+            PyErr_SetString(PyExc_ValueError, "levels must not overlap");
+            goto out;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = engine(i_max, t_max, threads, views[0].buf, views[1].buf, views[2].buf);
+    Py_END_ALLOW_THREADS
+
+    if (ret == NULL) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    for (k = 0; k < 3; k++) {
+        if (ret == views[k].buf)
+            break;
+    }
+    if (k == 3) {
+        PyErr_SetString(PyExc_RuntimeError, "engine returned a foreign buffer");
+    } else {
+        result = objs[k];
+        Py_INCREF(result);
+    }
+
+out:
+    for (k = 0; k < got; k++)
+        PyBuffer_Release(&views[k]);
+    Py_XDECREF(scratch);
+    return result;
+}
+
+static PyMethodDef wave_methods[] = {
+    { "simulate", (PyCFunction) (void (*)(void)) wave_simulate,
+      METH_VARARGS | METH_KEYWORDS, simulate_doc },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef wave_module = {
+    PyModuleDef_HEAD_INIT,
+    "wavesim",
+    "Wave equation simulation engines on float64 buffers.",
+    -1,
+    wave_methods,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_wavesim(void)
+{
+    PyObject *module = PyModule_Create(&wave_module);
+    PyObject *names;
+    int e;
+
+    if (module == NULL)
+        return NULL;
+
+    names = PyTuple_New(num_engines);
+    if (names == NULL) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    for (e = 0; e < num_engines; e++)
+        PyTuple_SET_ITEM(names, e, PyUnicode_FromString(engines[e].name));
+    if (PyModule_AddObject(module, "engines", names) != 0) {
+        Py_DECREF(names);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
@@ -0,0 +1,638 @@
+/*
+ * raster.c
+ *
+ * Space-time raster binning and the parallel PNG/PPM encoder.
+ *
+ * The interior points map onto the columns in equal runs, and every
+ * `every' steps make one row. Each worker keeps min, max and sum for the
+ * columns its chunk touches (a worker boundary can split a column, so
+ * neighbours may share one). raster_sweep() runs the stencil column run
+ * by column run and bins each run right after computing it, while it is
+ * still in L1/L2; it uses the plain kernel because streaming stores would
+ * send the new level past the cache the binning reads it from. When a
+ * row is complete, thread 0 folds the workers' columns into the image
+ * between the step barriers and resets them: O(width) per row.
+ *
+ * At the end the rows are colour-mapped in parallel. A PNG stores them
+ * in uncompressed deflate blocks, so no compressor is needed; the Adler
+ * checksum of the scanlines is computed per thread and combined, and the
+ * IDAT chunks get their CRCs in parallel too.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "raster.h"
+#include "kernel.h"
+
+#define RASTER_PATH_MAX 1024
+
+/* Default image size, reduced for grids or runs smaller than that. */
+#define RASTER_WIDTH 1024
+#define RASTER_HEIGHT 768
+
+/* Largest stored deflate block, and the IDAT chunk size. */
+#define DEFLATE_STORED_MAX 65535
+#define PNG_IDAT_BYTES (1L << 20)
+
+#define ADLER_BASE 65521
+
+enum { FORMAT_PPM, FORMAT_PNG };
+
+static const char *mode_names[] = { "mean", "min", "max", "range" };
+
+typedef struct {
+    long start, end;         /* the worker's points */
+    long col0, cols;         /* the columns they fall in */
+    double *min, *max, *sum; /* per column, current row */
+} RasterPart;
+
+struct raster {
+    char path[RASTER_PATH_MAX];
+    int format, mode;
+    long i_max, points;      /* interior points: 1 .. i_max - 2 */
+    long width, height;      /* height: rows the whole run makes */
+    long every;              /* steps per row */
+    long *count;             /* points per column */
+
+    /* Written by thread 0 between barriers. */
+    long steps;              /* steps in the current row */
+    long rows;               /* rows finished */
+    double *min, *max, *mean; /* [row * width + column] */
+
+    int num_parts;
+    RasterPart *parts;
+};
+
+/* Shared by the encoder threads. */
+typedef struct {
+    const raster_t *r;
+    int id, num_threads;
+    double scale;
+    unsigned char *raw;      /* scanlines, with the filter byte for PNG */
+    long line;               /* bytes per scanline */
+    uint32_t adler;          /* of this thread's rows */
+    const unsigned char *chunks; /* the zlib stream, for the CRCs */
+    long stream_bytes;
+    uint32_t *crcs;
+} EncodeJob;
+
+static uint32_t crc_table[256];
+
+
+/* Column of interior point i, and the first point of column col. */
+static long column_of(const raster_t *r, long i)
+{
+    return (i - 1) * r->width / r->points;
+}
+
+static long column_start(const raster_t *r, long col)
+{
+    return 1 + (col * r->points + r->width - 1) / r->width;
+}
+
+/*
+ * Opens a raster for a run of t_max steps on i_max points. The spec is
+ * FILE[:WIDTHxHEIGHT[:MODE]], with FILE ending in .png or .ppm and MODE
+ * one of mean (default), min, max and range. Returns NULL (with a
+ * message) on a bad spec or if memory runs out.
+ */
+raster_t *raster_open(const char *spec, long i_max, long t_max)
+{
+    raster_t *r = calloc(1, sizeof(*r));
+    const char *colon = strchr(spec, ':'), *ext;
+    size_t len = colon != NULL ? (size_t) (colon - spec) : strlen(spec);
+    long width = RASTER_WIDTH, height = RASTER_HEIGHT;
+
+    if (r == NULL)
+        return NULL;
+    if (len == 0 || len >= RASTER_PATH_MAX) {
+        fprintf(stderr, "raster: bad file name\n");
+        free(r);
+        return NULL;
+    }
+    memcpy(r->path, spec, len);
+    ext = strrchr(r->path, '.');
+    if (ext != NULL && strcmp(ext, ".png") == 0) {
+        r->format = FORMAT_PNG;
+    } else if (ext != NULL && strcmp(ext, ".ppm") == 0) {
+        r->format = FORMAT_PPM;
+    } else {
+        fprintf(stderr, "raster: %s should end in .png or .ppm\n", r->path);
+        free(r);
+        return NULL;
+    }
+
+    if (colon != NULL) {
+        const char *mode = strchr(colon + 1, ':');
+
+        if (sscanf(colon + 1, "%ldx%ld", &width, &height) != 2 ||
+                width < 1 || height < 1) {
+            fprintf(stderr, "raster: bad size \"%s\"\n", colon + 1);
+            free(r);
+            return NULL;
+        }
+        if (mode != NULL) {
+            for (r->mode = 0; r->mode < 4; r->mode++) {
+                if (strcmp(mode + 1, mode_names[r->mode]) == 0)
+                    break;
+            }
+            if (r->mode == 4) {
+                fprintf(stderr, "raster: unknown mode \"%s\"\n", mode + 1);
+                free(r);
+                return NULL;
+            }
+        }
+    }
+
+    r->i_max = i_max;
+    r->points = i_max - 2;
+    r->width = width < r->points ? width : r->points;
+    r->every = (t_max + height - 1) / height;
+    r->height = (t_max + r->every - 1) / r->every;
+    r->count = malloc(r->width * sizeof(long));
+    r->min = malloc(r->width * r->height * sizeof(double));
+    r->max = malloc(r->width * r->height * sizeof(double));
+    r->mean = malloc(r->width * r->height * sizeof(double));
+    if (!r->count || !r->min || !r->max || !r->mean) {
+        fprintf(stderr, "raster: out of memory\n");
+        raster_close(r, 0);
+        return NULL;
+    }
+    for (long col = 0; col < r->width; col++)
+        r->count[col] = column_start(r, col + 1) - column_start(r, col);
+
+    return r;
+}
+
+static void reset_part(RasterPart *p)
+{
+    for (long k = 0; k < p->cols; k++) {
+        p->min[k] = INFINITY;
+        p->max[k] = -INFINITY;
+        p->sum[k] = 0;
+    }
+}
+
+/* Sets up per-thread columns for a session of num_threads workers. */
+int raster_attach(raster_t *r, int num_threads)
+{
+    RasterPart *parts = calloc(num_threads, sizeof(RasterPart));
+
+    if (parts == NULL)
+        return -1;
+    for (int thr = 0; thr < r->num_parts; thr++) {
+        free(r->parts[thr].min);
+        free(r->parts[thr].max);
+        free(r->parts[thr].sum);
+    }
+    free(r->parts);
+    r->parts = parts;
+    r->num_parts = num_threads;
+    return 0;
+}
+
+/* Gives worker thr the points start .. end - 1. */
+int raster_assign(raster_t *r, int thr, long start, long end)
+{
+    RasterPart *p = &r->parts[thr];
+
+    p->start = start;
+    p->end = end;
+    p->col0 = end > start ? column_of(r, start) : 0;
+    p->cols = end > start ? column_of(r, end - 1) - p->col0 + 1 : 0;
+    free(p->min);
+    free(p->max);
+    free(p->sum);
+    p->min = malloc((p->cols + 1) * sizeof(double));
+    p->max = malloc((p->cols + 1) * sizeof(double));
+    p->sum = malloc((p->cols + 1) * sizeof(double));
+    if (!p->min || !p->max || !p->sum)
+        return -1;
+    reset_part(p);
+    return 0;
+}
+
+/* Bins level[a .. b), which lies within column col of part p. */
+static void bin_run(RasterPart *p, long col, const double *level, long a, long b)
+{
+    const long k = col - p->col0;
+    double lo = p->min[k], hi = p->max[k], sum = 0;
+
+    for (long i = a; i < b; i++) {
+        const double v = level[i];
+
+        lo = v < lo ? v : lo;
+        hi = v > hi ? v : hi;
+        sum += v;
+    }
+    p->min[k] = lo;
+    p->max[k] = hi;
+    p->sum[k] += sum;
+}
+
+/*
+ * Worker thr's sweep with the binning fused in: the stencil over its
+ * points one column run at a time, each run binned as soon as computed.
+ */
+void raster_sweep(raster_t *r, int thr, double *next, const double *cur,
+        const double *old)
+{
+    RasterPart *p = &r->parts[thr];
+
+    for (long i = p->start, col = p->col0; i < p->end; col++) {
+        long stop = column_start(r, col + 1);
+
+        stop = stop < p->end ? stop : p->end;
+        stencil_plain(next, cur, old, i, stop);
+        bin_run(p, col, next, i, stop);
+        i = stop;
+    }
+}
+
+/* Bins worker thr's points of a level computed elsewhere. */
+void raster_record(raster_t *r, int thr, const double *level)
+{
+    RasterPart *p = &r->parts[thr];
+
+    for (long i = p->start, col = p->col0; i < p->end; col++) {
+        long stop = column_start(r, col + 1);
+
+        stop = stop < p->end ? stop : p->end;
+        bin_run(p, col, level, i, stop);
+        i = stop;
+    }
+}
+
+/* Thread 0: folds the workers' columns into the next image row. */
+static void flush_row(raster_t *r)
+{
+    double *min = r->min + r->rows * r->width;
+    double *max = r->max + r->rows * r->width;
+    double *mean = r->mean + r->rows * r->width;
+
+    for (long col = 0; col < r->width; col++) {
+        min[col] = INFINITY;
+        max[col] = -INFINITY;
+        mean[col] = 0;
+    }
+    for (int thr = 0; thr < r->num_parts; thr++) {
+        RasterPart *p = &r->parts[thr];
+
+        for (long k = 0; k < p->cols; k++) {
+            const long col = p->col0 + k;
+
+            min[col] = fmin(min[col], p->min[k]);
+            max[col] = fmax(max[col], p->max[k]);
+            mean[col] += p->sum[k];
+        }
+        reset_part(p);
+    }
+    for (long col = 0; col < r->width; col++)
+        mean[col] /= (double) r->count[col] * r->steps;
+
+    r->rows++;
+    r->steps = 0;
+}
+
+/* Thread 0, between the step barriers: one more step binned. */
+void raster_advance(raster_t *r)
+{
+    if (++r->steps == r->every && r->rows < r->height)
+        flush_row(r);
+}
+
+static double pixel_value(const raster_t *r, long at)
+{
+    switch (r->mode) {
+    case RASTER_MIN:
+        return r->min[at];
+    case RASTER_MAX:
+        return r->max[at];
+    case RASTER_RANGE:
+        return r->max[at] - r->min[at];
+    default:
+        return r->mean[at];
+    }
+}
+
+static void colour(int mode, double v, double scale, unsigned char *rgb)
+{
+    double t = scale > 0 ? v / scale : 0;
+
+    if (!(t == t))
+        t = 0;
+    t = t < -1 ? -1 : t > 1 ? 1 : t;
+    if (mode == RASTER_RANGE) {
+        /* black - red - yellow - white */
+        rgb[0] = (unsigned char) lround(255 * fmin(1, 3 * t));
+        rgb[1] = (unsigned char) lround(255 * fmin(1, fmax(0, 3 * t - 1)));
+        rgb[2] = (unsigned char) lround(255 * fmax(0, 3 * t - 2));
+    } else if (t < 0) {
+        /* blue - white */
+        rgb[0] = rgb[1] = (unsigned char) lround(255 * (1 + t));
+        rgb[2] = 255;
+    } else {
+        /* white - red */
+        rgb[0] = 255;
+        rgb[1] = rgb[2] = (unsigned char) lround(255 * (1 - t));
+    }
+}
+
+static uint32_t adler_update(uint32_t adler, const unsigned char *data, long n)
+{
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+
+    while (n > 0) {
+        /* The sums cannot overflow 32 bits in 5552 bytes. */
+        long run = n < 5552 ? n : 5552;
+
+        n -= run;
+        while (run-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return a | (b << 16);
+}
+
+/* The Adler-32 of A followed by B, from theirs and B's length. */
+static uint32_t adler_combine(uint32_t first, uint32_t second, long len)
+{
+    const uint32_t rem = len % ADLER_BASE;
+    uint32_t a = first & 0xffff, b = (rem * a) % ADLER_BASE;
+
+    a += (second & 0xffff) + ADLER_BASE - 1;
+    b += (first >> 16) + (second >> 16) + ADLER_BASE - rem;
+    if (a >= ADLER_BASE)
+        a -= ADLER_BASE;
+    if (a >= ADLER_BASE)
+        a -= ADLER_BASE;
+    if (b >= 2 * ADLER_BASE)
+        b -= 2 * ADLER_BASE;
+    if (b >= ADLER_BASE)
+        b -= ADLER_BASE;
+    return a | (b << 16);
+}
+
+static void crc_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const unsigned char *data, long n)
+{
+    crc = ~crc;
+    while (n-- > 0)
+        crc = crc_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* Encoder thread: colour-maps its rows, then checksums its IDAT chunks. */
+static void *encode_rows(void *arg)
+{
+    EncodeJob *job = arg;
+    const raster_t *r = job->r;
+    const long first = r->rows * job->id / job->num_threads;
+    const long last = r->rows * (job->id + 1) / job->num_threads;
+    const int filter = r->format == FORMAT_PNG;
+
+    for (long row = first; row < last; row++) {
+        unsigned char *line = job->raw + row * job->line;
+
+        if (filter)
+            line[0] = 0;
+        for (long col = 0; col < r->width; col++)
+            colour(r->mode, pixel_value(r, row * r->width + col), job->scale,
+                   line + filter + 3 * col);
+    }
+    job->adler = adler_update(1, job->raw + first * job->line,
+                              (last - first) * job->line);
+    return NULL;
+}
+
+static void *encode_crcs(void *arg)
+{
+    EncodeJob *job = arg;
+    const long chunks = (job->stream_bytes + PNG_IDAT_BYTES - 1) / PNG_IDAT_BYTES;
+
+    for (long k = job->id; k < chunks; k += job->num_threads) {
+        const long start = k * PNG_IDAT_BYTES;
+        const long n = job->stream_bytes - start < PNG_IDAT_BYTES ?
+                       job->stream_bytes - start : PNG_IDAT_BYTES;
+
+        job->crcs[k] = crc_update(crc_update(0, (const unsigned char *) "IDAT", 4),
+                                  job->chunks + start, n);
+    }
+    return NULL;
+}
+
+/* Runs fn over the jobs on their own threads, or inline if that fails. */
+static void run_jobs(EncodeJob *jobs, int n, void *(*fn)(void *))
+{
+    pthread_t threads[n];
+    int started[n];
+
+    for (int k = 1; k < n; k++)
+        started[k] = pthread_create(&threads[k], NULL, fn, &jobs[k]) == 0;
+    fn(&jobs[0]);
+    for (int k = 1; k < n; k++) {
+        if (started[k])
+            pthread_join(threads[k], NULL);
+        else
+            fn(&jobs[k]);
+    }
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static int write_chunk(FILE *fp, const char *type, const unsigned char *data,
+        long n, uint32_t crc)
+{
+    unsigned char head[8], tail[4];
+
+    put32(head, n);
+    memcpy(head + 4, type, 4);
+    put32(tail, crc);
+    return fwrite(head, 8, 1, fp) == 1 && (n == 0 || fwrite(data, n, 1, fp) == 1) &&
+           fwrite(tail, 4, 1, fp) == 1 ? 0 : -1;
+}
+
+static int write_png(const raster_t *r, FILE *fp, EncodeJob *jobs, int n,
+        const unsigned char *raw, long raw_bytes, uint32_t adler)
+{
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    const long blocks = raw_bytes > 0 ? (raw_bytes + DEFLATE_STORED_MAX - 1) / DEFLATE_STORED_MAX : 1;
+    const long stream_bytes = 2 + raw_bytes + 5 * blocks + 4;
+    const long chunks = (stream_bytes + PNG_IDAT_BYTES - 1) / PNG_IDAT_BYTES;
+    unsigned char *stream = malloc(stream_bytes), *p = stream, ihdr[13];
+    uint32_t *crcs = malloc(chunks * sizeof(uint32_t));
+    int ret = 0;
+
+    if (!stream || !crcs) {
+        free(stream);
+        free(crcs);
+        return -1;
+    }
+
+    /* zlib header (deflate, 32K window, no dictionary), stored blocks. */
+    *p++ = 0x78;
+    *p++ = 0x01;
+    for (long k = 0, done = 0; k < blocks; k++) {
+        const long len = raw_bytes - done < DEFLATE_STORED_MAX ?
+                         raw_bytes - done : DEFLATE_STORED_MAX;
+
+        *p++ = k == blocks - 1;
+        *p++ = len & 0xff;
+        *p++ = len >> 8;
+        *p++ = ~len & 0xff;
+        *p++ = (~len >> 8) & 0xff;
+        memcpy(p, raw + done, len);
+        p += len;
+        done += len;
+    }
+    put32(p, adler);
+
+    for (int k = 0; k < n; k++) {
+        jobs[k].chunks = stream;
+        jobs[k].stream_bytes = stream_bytes;
+        jobs[k].crcs = crcs;
+    }
+    run_jobs(jobs, n, encode_crcs);
+
+    put32(ihdr, r->width);
+    put32(ihdr + 4, r->rows);
+    ihdr[8] = 8;     /* bits per channel */
+    ihdr[9] = 2;     /* truecolour */
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    if (fwrite(signature, 8, 1, fp) != 1 ||
+            write_chunk(fp, "IHDR", ihdr, 13,
+                        crc_update(crc_update(0, (const unsigned char *) "IHDR", 4),
+                                   ihdr, 13)) != 0)
+        ret = -1;
+    for (long k = 0; k < chunks && ret == 0; k++) {
+        const long start = k * PNG_IDAT_BYTES;
+
+        ret = write_chunk(fp, "IDAT", stream + start,
+                          stream_bytes - start < PNG_IDAT_BYTES ?
+                          stream_bytes - start : PNG_IDAT_BYTES, crcs[k]);
+    }
+    if (ret == 0)
+        ret = write_chunk(fp, "IEND", NULL, 0,
+                          crc_update(0, (const unsigned char *) "IEND", 4));
+
+    free(stream);
+    free(crcs);
+    return ret;
+}
+
+/* Encodes the rows made so far with num_threads threads. */
+static int encode(raster_t *r, int num_threads)
+{
+    const int filter = r->format == FORMAT_PNG;
+    const long line = filter + 3 * r->width, raw_bytes = line * r->rows;
+    EncodeJob jobs[num_threads];
+    unsigned char *raw = malloc(raw_bytes > 0 ? raw_bytes : 1);
+    double scale = 0;
+    uint32_t adler = 1;
+    FILE *fp;
+    int ret = 0;
+
+    if (raw == NULL)
+        return -1;
+    for (long at = 0; at < r->rows * r->width; at++) {
+        const double v = fabs(pixel_value(r, at));
+
+        scale = v > scale ? v : scale;
+    }
+
+    for (int k = 0; k < num_threads; k++) {
+        jobs[k].r = r;
+        jobs[k].id = k;
+        jobs[k].num_threads = num_threads;
+        jobs[k].scale = scale;
+        jobs[k].raw = raw;
+        jobs[k].line = line;
+    }
+    crc_init();
+    run_jobs(jobs, num_threads, encode_rows);
+
+    fp = fopen(r->path, "wb");
+    if (!fp) {
+        perror(r->path);
+        free(raw);
+        return -1;
+    }
+    if (r->format == FORMAT_PNG) {
+        for (int k = 0; k < num_threads; k++) {
+            const long rows = r->rows * (k + 1) / num_threads - r->rows * k / num_threads;
+
+            adler = adler_combine(adler, jobs[k].adler, rows * line);
+        }
+        ret = write_png(r, fp, jobs, num_threads, raw, raw_bytes, adler);
+    } else {
+        fprintf(fp, "P6\n%ld %ld\n255\n", r->width, r->rows);
+        if (raw_bytes > 0 && fwrite(raw, raw_bytes, 1, fp) != 1)
+            ret = -1;
+    }
+    if (fclose(fp) != 0)
+        ret = -1;
+    free(raw);
+    return ret;
+}
+
+/*
+ * Finishes the last (possibly short) row, writes the image with
+ * num_threads encoder threads and frees the raster. num_threads 0 only
+ * frees it. Returns -1 if the image could not be written.
+ */
+int raster_close(raster_t *r, int num_threads)
+{
+    int ret = 0;
+
+    if (r == NULL)
+        return 0;
+    if (num_threads > 0) {
+        if (r->steps > 0 && r->rows < r->height)
+            flush_row(r);
+        ret = encode(r, num_threads);
+        if (ret != 0)
+            fprintf(stderr, "raster: could not write %s\n", r->path);
+        else
+            printf("Raster: %ldx%ld %s image, %ld steps per row, written to %s\n",
+                    r->width, r->rows, mode_names[r->mode], r->every, r->path);
+    }
+
+    for (int thr = 0; thr < r->num_parts; thr++) {
+        free(r->parts[thr].min);
+        free(r->parts[thr].max);
+        free(r->parts[thr].sum);
+    }
+    free(r->parts);
+    free(r->count);
+    free(r->min);
+    free(r->max);
+    free(r->mean);
+    free(r);
+    return ret;
+}
@@ -0,0 +1,31 @@
+/*
+ * raster.h
+ *
+ * Space-time raster: a heatmap of the whole run (x = position, y = time,
+ * time running down), binned by the barrier engine's workers during the
+ * sweep and written as PNG or PPM at the end, so the history is never
+ * stored.
+ *
+ * Each pixel reduces a block of points and steps to its min, max and
+ * mean; the image shows one of them (or max - min, "range"). Values go
+ * through a blue-white-red scale symmetric about zero, ranges through a
+ * black-red-yellow one.
+ *
+ */
+
+#pragma once
+
+enum { RASTER_MEAN, RASTER_MIN, RASTER_MAX, RASTER_RANGE };
+
+typedef struct raster raster_t;
+
+raster_t *raster_open(const char *spec, long i_max, long t_max);
+int raster_close(raster_t *r, int num_threads);
+
+/* Used by the session; see session_set_raster(). */
+int raster_attach(raster_t *r, int num_threads);
+int raster_assign(raster_t *r, int thr, long start, long end);
+void raster_sweep(raster_t *r, int thr, double *next, const double *cur,
+        const double *old);
+void raster_record(raster_t *r, int thr, const double *level);
+void raster_advance(raster_t *r);
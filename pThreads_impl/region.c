@@ -0,0 +1,85 @@
+/*
+ * region.c
+ *
+ * Dependency-cone queries.
+ *
+ * Level t + 1 at i depends on level t at i - 1 .. i + 1 and level t - 1 at
+ * i, so the last level on [a, b] only needs level t on [a - k, b + k],
+ * k = t_max - t steps back from it. Each step therefore computes its
+ * level on the interval the cone still needs, one cell narrower per side
+ * than the step before, clamped to the interior: a trapezoid instead of
+ * the full t_max x i_max rectangle.
+ *
+ * The buffers rotate exactly as in the full run, and the points of the
+ * cone see the same values in the same order through the same kernel, so
+ * the window is bit-identical to simulate()'s result. Everything outside
+ * the window is left over from earlier levels and must not be read.
+ *
+ * The sweep is serial: the driver rejects other engines and more than one
+ * thread rather than ignore them.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "region.h"
+#include "kernel.h"
+
+/* The interval step t (1-based) computes: the cone clamped to the interior. */
+static void cone(long i_max, long t_max, long a, long b, long t,
+        long *start, long *end)
+{
+    const long k = t_max - t;
+
+    *start = a - k > 1 ? a - k : 1;
+    *end = b + k < i_max - 2 ? b + k + 1 : i_max - 1;
+}
+
+/* Checks that [a, b] lies in the grid. Returns -1 (with a message) if not. */
+int region_check(long i_max, long a, long b)
+{
+    if (a < 0 || b >= i_max || a > b) {
+        printf("argument error: --region needs 0 <= a <= b < i_max.\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Point updates a query takes; the full run takes t_max * (i_max - 2). */
+double region_updates(long i_max, long t_max, long a, long b)
+{
+    double updates = 0;
+
+    for (long t = 1; t <= t_max; t++) {
+        long start, end;
+
+        cone(i_max, t_max, a, b, t, &start, &end);
+        if (end > start)
+            updates += end - start;
+    }
+    return updates;
+}
+
+/*
+ * Runs t_max steps restricted to the backward cone of [a, b] and returns
+ * the buffer holding the last level, valid on [a, b] only. Boundary
+ * points in the window keep their fixed values, as in the full run.
+ */
+double *simulate_region(long i_max, long t_max, long a, long b,
+        double *old_array, double *current_array, double *next_array)
+{
+    for (long t = 1; t <= t_max; t++) {
+        double *tmp = old_array;
+        long start, end;
+
+        cone(i_max, t_max, a, b, t, &start, &end);
+        if (end > start)
+            stencil_plain(next_array, current_array, old_array, start, end);
+
+        old_array = current_array;
+        current_array = next_array;
+        next_array = tmp;
+    }
+    return current_array;
+}
@@ -0,0 +1,14 @@
+/*
+ * region.h
+ *
+ * Dependency-cone queries: the final state on a window [a, b] only, from
+ * the backward light cone of that window instead of the whole grid.
+ *
+ */
+
+#pragma once
+
+int region_check(long i_max, long a, long b);
+double region_updates(long i_max, long t_max, long a, long b);
+double *simulate_region(long i_max, long t_max, long a, long b,
+        double *old_array, double *current_array, double *next_array);
@@ -53,6 +53,45 @@ def experiment2_plot():
 
             print(f"Saved: {filename}")
 
+# Scaling study written by wave_scaling ("make scaling")
+def scaling_plot(path="scaling.csv"):
+    # One figure per study and t_max; for weak scaling i_max is per thread.
+    df = pd.read_csv(path, comment='#')
+    baseline = df['backend'].iloc[0]  # the first row is always the baseline
+
+    for (study, t_max), group in df.groupby(['study', 't_max']):
+        if study == 'weak':
+            group = group.assign(size=group['i_max'] // group['threads'])
+        else:
+            group = group.assign(size=group['i_max'])
+
+        fig, (ax_time, ax_eff) = plt.subplots(1, 2, figsize=(14, 6))
+        for (backend, size), subset in group.groupby(['backend', 'size']):
+            if backend == baseline:
+                continue
+            subset = subset.sort_values(by='threads')
+            label = f"{backend}, i_max={size}" + (" per thread" if study == 'weak' else "")
+            ax_time.errorbar(subset['threads'], subset['mean_seconds'],
+                             yerr=subset['ci95_seconds'], marker='o', capsize=3, label=label)
+            ax_eff.plot(subset['threads'], subset['efficiency'], marker='o', label=label)
+
+        ax_time.set_xlabel("Number of Threads")
+        ax_time.set_ylabel("Execution Time (seconds, 95% CI)")
+        ax_time.set_yscale('log')
+        ax_eff.set_xlabel("Number of Threads")
+        ax_eff.set_ylabel(f"Efficiency (vs {baseline})")
+        ax_eff.axhline(1, color='gray', linestyle='--')
+        for ax in (ax_time, ax_eff):
+            ax.set_xscale('log', base=2)
+            ax.grid(True)
+        ax_eff.legend()
+        fig.suptitle(f"{study.capitalize()} scaling, t_max={t_max}")
+
+        filename = f"./experiment_plots/scaling_{study}_t{t_max}.png"
+        fig.savefig(filename, dpi=200)
+        plt.close(fig)
+        print(f"Saved: {filename}")
+
 
 if __name__ == '__main__':
     experiment2_plot()
\ No newline at end of file
@@ -0,0 +1,277 @@
+/*
+ * revolve.c
+ *
+ * Reverse-order access to the states of a run with a budget of S stored
+ * states (Griewank's binomial checkpointing, "revolve").
+ *
+ * State t is the pair of levels after t steps, the two arrays a resumed
+ * run starts from. revolve_prev() hands them out for t = t_max down to 0.
+ * Slot 0 holds state 0; the rest form a stack of checkpoints in
+ * increasing t. To reach state t, the scheduler restarts from the newest
+ * checkpoint below it and, while slots are free, stops at the split that
+ * the optimal schedule puts in that interval to store another checkpoint.
+ * With one slot left it simply recomputes up to t. Checkpoints past t
+ * are dropped as the iteration passes them.
+ *
+ * Reversing l states with s slots this way takes
+ *
+ *     T(l, s) = r l - beta(s + 1, r - 1),  beta(s, r) = (s + r)! / (s! r!)
+ *
+ * forward steps, where r is the smallest with beta(s, r) >= l: every state
+ * is recomputed at most r times, and no schedule does better. The split
+ * m of an interval minimises m + T(m, s) + T(l - m, s - 1), which is
+ * convex in m, so it is found by bisection.
+ *
+ * Forward steps run on a wrapped session; restoring a checkpoint copies
+ * it into the session's buffers and rebinds. The third buffer gets the
+ * boundary values the uninterrupted run would have there (they rotate
+ * with the buffers and are never written), so recomputed states are
+ * bit-identical to the original ones.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "revolve.h"
+#include "session.h"
+#include "arena.h"
+
+/* Saturation value for binomial(); far beyond any schedule we can run. */
+#define BINOMIAL_MAX (LONG_MAX / 4)
+
+struct revolve {
+    long i_max;
+    long t_max;
+    int slots;
+    long t_next;                  /* next state to hand out, -1 when done */
+
+    int depth;                    /* checkpoints on the stack, >= 1 */
+    long *t;                      /* step of each checkpoint */
+    double **previous, **current; /* their two levels */
+
+    double edges[3][2];           /* boundary values of level j are edges[j % 3] */
+    double *work[3];
+    long work_t;                  /* state in the session, -1 if stale */
+    sim_session_t *session;
+    arena_t arena;
+
+    long forward_steps;
+};
+
+
+/* beta(s, r) = C(s + r, s), saturating at BINOMIAL_MAX. */
+static long binomial(long s, long r)
+{
+    const long k = s < r ? s : r, n = s + r;
+    long b = 1;
+
+    for (long i = 1; i <= k; i++) {
+        if (b > BINOMIAL_MAX / (n - k + i))
+            return BINOMIAL_MAX;
+        b = b * (n - k + i) / i;   /* exact: b * (n - k + i) = i * C(n - k + i, i) */
+    }
+    return b;
+}
+
+/*
+ * Forward steps the optimal schedule needs to reverse `states' states
+ * with `slots' stored states, the first of them holding state 0.
+ */
+long revolve_optimum(long states, int slots)
+{
+    long r = 0;
+
+    if (states <= 1)
+        return 0;
+    if (slots < 1)
+        return -1;
+    if (slots == 1)
+        return states * (states - 1) / 2;
+
+    while (binomial(slots, r) < states)
+        r++;
+    return r * states - binomial(slots + 1, r - 1);
+}
+
+/* First checkpoint in an interval of l states with s slots, 1 <= m < l. */
+static long optimal_split(long l, int s)
+{
+    long lo = 1, hi = l - 1;
+
+    /* Smallest m where the cost stops decreasing. */
+    while (lo < hi) {
+        const long m = lo + (hi - lo) / 2;
+        const long here = m + revolve_optimum(m, s) + revolve_optimum(l - m, s - 1);
+        const long after = m + 1 + revolve_optimum(m + 1, s)
+                           + revolve_optimum(l - m - 1, s - 1);
+
+        if (after >= here)
+            hi = m;
+        else
+            lo = m + 1;
+    }
+    return lo;
+}
+
+/*
+ * Sets up reverse iteration over t_max steps from the first two levels,
+ * with `slots' stored states (at least 1) of two levels each. Only the
+ * boundary values of next_array are used, as the engines would. Returns
+ * NULL on failure.
+ */
+revolve_t *revolve_create(long i_max, long t_max, int slots, int num_threads,
+        const double *old_array, const double *current_array,
+        const double *next_array)
+{
+    const size_t bytes = i_max * sizeof(double);
+    const double *first[3] = { old_array, current_array, next_array };
+    revolve_t *rv;
+
+    if (i_max < 3 || t_max < 0 || slots < 1 || num_threads < 1)
+        return NULL;
+    rv = calloc(1, sizeof(*rv));
+    if (rv == NULL)
+        return NULL;
+    rv->t = malloc(slots * sizeof(long));
+    rv->previous = malloc(slots * sizeof(double *));
+    rv->current = malloc(slots * sizeof(double *));
+    if (!rv->t || !rv->previous || !rv->current ||
+            arena_init(&rv->arena, (3 + 2 * (size_t) slots) *
+                       arena_footprint(bytes), 0) != 0) {
+        free(rv->t);
+        free(rv->previous);
+        free(rv->current);
+        free(rv);
+        return NULL;
+    }
+
+    for (int b = 0; b < 3; b++) {
+        rv->work[b] = arena_alloc(&rv->arena, bytes);
+        rv->edges[b][0] = first[b][0];
+        rv->edges[b][1] = first[b][i_max - 1];
+    }
+    for (int k = 0; k < slots; k++) {
+        rv->previous[k] = arena_alloc(&rv->arena, bytes);
+        rv->current[k] = arena_alloc(&rv->arena, bytes);
+    }
+    memcpy(rv->previous[0], old_array, bytes);
+    memcpy(rv->current[0], current_array, bytes);
+    rv->t[0] = 0;
+    rv->depth = 1;
+
+    rv->i_max = i_max;
+    rv->t_max = t_max;
+    rv->slots = slots;
+    rv->t_next = t_max;
+    rv->work_t = -1;
+    rv->session = session_wrap(i_max, num_threads, rv->work[0], rv->work[1],
+                               rv->work[2]);
+    if (rv->session == NULL) {
+        arena_destroy(&rv->arena);
+        free(rv->t);
+        free(rv->previous);
+        free(rv->current);
+        free(rv);
+        return NULL;
+    }
+
+    return rv;
+}
+
+/* Loads the newest checkpoint into the session. */
+static void restore(revolve_t *rv)
+{
+    const int top = rv->depth - 1;
+    const long t = rv->t[top];
+    const size_t bytes = rv->i_max * sizeof(double);
+
+    memcpy(rv->work[0], rv->previous[top], bytes);
+    memcpy(rv->work[1], rv->current[top], bytes);
+    /* Level t + 2 goes where level t - 1 was. */
+    rv->work[2][0] = rv->edges[(t + 2) % 3][0];
+    rv->work[2][rv->i_max - 1] = rv->edges[(t + 2) % 3][1];
+    session_rebind(rv->session, rv->i_max, rv->work[0], rv->work[1], rv->work[2]);
+    rv->work_t = t;
+}
+
+static void advance(revolve_t *rv, long t)
+{
+    if (rv->work_t < 0 || rv->work_t != rv->t[rv->depth - 1])
+        restore(rv);
+    session_step(rv->session, t - rv->work_t);
+    rv->forward_steps += t - rv->work_t;
+    rv->work_t = t;
+}
+
+static void push(revolve_t *rv)
+{
+    const int top = rv->depth++;
+    const size_t bytes = rv->i_max * sizeof(double);
+
+    rv->t[top] = rv->work_t;
+    memcpy(rv->previous[top], session_previous(rv->session), bytes);
+    memcpy(rv->current[top], session_peek(rv->session, NULL), bytes);
+}
+
+/*
+ * Hands out the next state in reverse order: its step in *t and its two
+ * levels, valid until the next call. Returns 1 once state 0 has been
+ * handed out, 0 otherwise.
+ */
+int revolve_prev(revolve_t *rv, long *t, const double **previous,
+        const double **current)
+{
+    const long target = rv->t_next;
+    int top;
+
+    if (target < 0)
+        return 1;
+    while (rv->t[rv->depth - 1] > target)
+        rv->depth--;
+
+    while (rv->t[rv->depth - 1] < target) {
+        const long base = rv->t[rv->depth - 1];
+        const int s = rv->slots - rv->depth + 1;
+
+        if (s == 1) {
+            advance(rv, target);
+            break;
+        }
+        advance(rv, base + optimal_split(target + 1 - base, s));
+        push(rv);
+    }
+
+    top = rv->depth - 1;
+    if (rv->t[top] == target) {
+        *previous = rv->previous[top];
+        *current = rv->current[top];
+    } else {
+        *previous = session_previous(rv->session);
+        *current = session_peek(rv->session, NULL);
+    }
+    /* The state is handed out: the session no longer matches a checkpoint. */
+    rv->work_t = -1;
+    *t = target;
+    rv->t_next--;
+
+    return 0;
+}
+
+/* Forward steps taken so far, recomputation included. */
+long revolve_forward_steps(const revolve_t *rv)
+{
+    return rv->forward_steps;
+}
+
+void revolve_destroy(revolve_t *rv)
+{
+    session_destroy(rv->session);
+    arena_destroy(&rv->arena);
+    free(rv->t);
+    free(rv->previous);
+    free(rv->current);
+    free(rv);
+}
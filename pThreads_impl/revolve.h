@@ -0,0 +1,20 @@
+/*
+ * revolve.h
+ *
+ * Binomial checkpointing: the states of a run in reverse order, from a
+ * fixed number of stored states, recomputing the rest forward.
+ *
+ */
+
+#pragma once
+
+typedef struct revolve revolve_t;
+
+revolve_t *revolve_create(long i_max, long t_max, int slots, int num_threads,
+        const double *old_array, const double *current_array,
+        const double *next_array);
+int revolve_prev(revolve_t *rv, long *t, const double **previous,
+        const double **current);
+long revolve_forward_steps(const revolve_t *rv);
+long revolve_optimum(long states, int slots);
+void revolve_destroy(revolve_t *rv);
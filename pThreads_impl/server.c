@@ -0,0 +1,467 @@
+/*
+ * server.c
+ *
+ * wave_server: a long-running simulation daemon.
+ *
+ * The main thread accepts connections on a Unix socket, polls them until
+ * each has sent its wave_request_t (a silent one is dropped after a few
+ * seconds without holding up the rest) and queues it by priority. A single
+ * runner thread takes the most urgent job, carves its buffers from an arena
+ * that was faulted in at startup, and steps it on one session whose workers
+ * stay up for the life of the server. The buffer that will hold the result is a
+ * memfd instead, so the finished wave is handed to the client as a
+ * descriptor without being copied or formatted.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "protocol.h"
+#include "session.h"
+#include "generatedata.h"
+#include "arena.h"
+#include "timer.h"
+
+/* Seconds a new connection gets to send its request. */
+#define REQUEST_TIMEOUT 5
+
+/* How often the accept loop wakes to expire silent connections. */
+#define POLL_MS 500
+
+typedef struct {
+    wave_request_t req;
+    int conn;
+    unsigned long seq;
+    struct timespec arrived;
+} Job;
+
+/* A connection whose request has not fully arrived yet. */
+typedef struct {
+    int conn;
+    size_t got;
+    wave_request_t req;
+    struct timespec since;
+} Pending;
+
+typedef struct {
+    /* Max-heap on (priority, -seq). */
+    Job *heap;
+    int size, cap;
+    unsigned long next_seq;
+    int quit;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    int num_threads;
+    arena_t arena;
+    sim_session_t *session;
+    unsigned long jobs_done;
+} Server;
+
+
+static int job_before(const Job *a, const Job *b)
+{
+    if (a->req.priority != b->req.priority)
+        return a->req.priority > b->req.priority;
+    return a->seq < b->seq;
+}
+
+static int queue_push(Server *srv, const Job *job)
+{
+    int i;
+
+    if (srv->size == srv->cap) {
+        int cap = srv->cap ? 2 * srv->cap : 64;
+        Job *heap = realloc(srv->heap, cap * sizeof(Job));
+
+        if (heap == NULL)
+            return -1;
+        srv->heap = heap;
+        srv->cap = cap;
+    }
+
+    i = srv->size++;
+    srv->heap[i] = *job;
+    while (i > 0 && job_before(&srv->heap[i], &srv->heap[(i - 1) / 2])) {
+        Job tmp = srv->heap[i];
+        srv->heap[i] = srv->heap[(i - 1) / 2];
+        srv->heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+    return 0;
+}
+
+static Job queue_pop(Server *srv)
+{
+    Job top = srv->heap[0];
+    int i = 0;
+
+    srv->heap[0] = srv->heap[--srv->size];
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        Job tmp;
+
+        if (l < srv->size && job_before(&srv->heap[l], &srv->heap[m]))
+            m = l;
+        if (r < srv->size && job_before(&srv->heap[r], &srv->heap[m]))
+            m = r;
+        if (m == i)
+            break;
+        tmp = srv->heap[i];
+        srv->heap[i] = srv->heap[m];
+        srv->heap[m] = tmp;
+        i = m;
+    }
+    return top;
+}
+
+
+/*
+ * Runs one job. On success returns WAVE_OK and a memfd holding the result
+ * in *result_fd.
+ */
+static int run_job(Server *srv, const wave_request_t *req, double *seconds,
+        int *result_fd)
+{
+    const long i_max = req->i_max, t_max = req->t_max;
+    const int result_buffer = (t_max + 1) % 3;
+    init_fill_t fills[3];
+    double *buffers[3];
+    double *result;
+    struct timespec start;
+    size_t bytes;
+    int fd, b;
+
+    if (i_max < 3 || t_max < 1 || strcmp(req->mode, "file") == 0 ||
+            init_mode_fills(req->mode, i_max, fills) != 0)
+        return WAVE_EINVAL;
+    /* Two buffers come from the arena; check before the size can wrap. */
+    if ((size_t) i_max > SIZE_MAX / 16 ||
+            2 * arena_footprint(i_max * sizeof(double)) > srv->arena.size)
+        return WAVE_ENOMEM;
+    bytes = i_max * sizeof(double);
+
+    /* The result buffer is not taken from the arena. */
+    arena_reset(&srv->arena);
+    for (b = 0; b < 3; b++) {
+        if (b != result_buffer &&
+                (buffers[b] = arena_alloc(&srv->arena, bytes)) == NULL)
+            return WAVE_ENOMEM;
+    }
+
+    fd = memfd_create("wave-result", MFD_CLOEXEC);
+    if (fd < 0)
+        return WAVE_EFAIL;
+    if (ftruncate(fd, bytes) != 0) {
+        close(fd);
+        return WAVE_ENOMEM;
+    }
+    result = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (result == MAP_FAILED) {
+        close(fd);
+        return WAVE_ENOMEM;
+    }
+    buffers[result_buffer] = result;
+
+    /* The arena is already faulted in, so one thread fills it. */
+    init_fill(buffers, fills, 3, i_max, 1);
+
+    if (srv->session == NULL)
+        srv->session = session_wrap(i_max, srv->num_threads,
+                                    buffers[0], buffers[1], buffers[2]);
+    else
+        session_rebind(srv->session, i_max, buffers[0], buffers[1], buffers[2]);
+    if (srv->session == NULL) {
+        munmap(result, bytes);
+        close(fd);
+        return WAVE_EFAIL;
+    }
+
+    timer_start_r(&start);
+    session_step(srv->session, t_max);
+    *seconds = timer_end_r(&start);
+
+    munmap(result, bytes);
+    *result_fd = fd;
+    return WAVE_OK;
+}
+
+/* Answers a job the runner will never see. */
+static void refuse(int conn, const wave_request_t *req, int status)
+{
+    wave_reply_t reply;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = WAVE_MAGIC;
+    reply.status = status;
+    reply.i_max = req->i_max;
+    reply.t_max = req->t_max;
+    wave_send_reply(conn, &reply, -1);
+    close(conn);
+}
+
+static void *runner(void *arg)
+{
+    Server *srv = (Server *) arg;
+
+    for (;;) {
+        wave_reply_t reply;
+        Job job;
+        int fd = -1;
+
+        pthread_mutex_lock(&srv->lock);
+        while (srv->size == 0 && !srv->quit)
+            pthread_cond_wait(&srv->wake, &srv->lock);
+        if (srv->size == 0) {
+            pthread_mutex_unlock(&srv->lock);
+            break;
+        }
+        job = queue_pop(srv);
+        pthread_mutex_unlock(&srv->lock);
+
+        memset(&reply, 0, sizeof(reply));
+        reply.magic = WAVE_MAGIC;
+        reply.i_max = job.req.i_max;
+        reply.t_max = job.req.t_max;
+        reply.queued = timer_end_r(&job.arrived);
+        reply.status = run_job(srv, &job.req, &reply.seconds, &fd);
+
+        if (wave_send_reply(job.conn, &reply, fd) != 0)
+            fprintf(stderr, "wave_server: client went away before its reply\n");
+        if (fd >= 0)
+            close(fd);
+        close(job.conn);
+        srv->jobs_done++;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Queues a request that has fully arrived on `conn', or refuses it.
+ * Returns 1 for a shutdown request.
+ */
+static int take_request(Server *srv, int conn, wave_request_t *req)
+{
+    Job job;
+    int queued;
+
+    if (req->magic != WAVE_MAGIC) {
+        close(conn);
+        return 0;
+    }
+    req->mode[sizeof(req->mode) - 1] = '\0';
+    if (req->kind == WAVE_SHUTDOWN) {
+        close(conn);
+        return 1;
+    }
+
+    job.req = *req;
+    job.conn = conn;
+    timer_start_r(&job.arrived);
+
+    pthread_mutex_lock(&srv->lock);
+    job.seq = srv->next_seq++;
+    queued = queue_push(srv, &job) == 0;
+    pthread_cond_signal(&srv->wake);
+    pthread_mutex_unlock(&srv->lock);
+    if (!queued) {
+        fprintf(stderr, "wave_server: queue full, refusing a job\n");
+        refuse(conn, req, WAVE_EFAIL);
+    }
+    return 0;
+}
+
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr;
+    int sock;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+            listen(sock, 128) != 0) {
+        perror(path);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = WAVE_DEFAULT_SOCKET;
+    long arena_mb = 256;
+    Server srv;
+    pthread_t runner_thread;
+    Pending *pending = NULL;
+    int num_pending = 0, pending_cap = 0, quit = 0;
+    int sock, i;
+
+    memset(&srv, 0, sizeof(srv));
+    srv.num_threads = 1;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--socket=", 9) == 0) {
+            path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            srv.num_threads = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--arena-mb=", 11) == 0) {
+            arena_mb = strtol(argv[i] + 11, NULL, 10);
+        } else {
+            printf("Usage: %s [--socket=PATH] [--threads=N] [--arena-mb=M]\n",
+                    argv[0]);
+            printf(" - socket: Unix socket to listen on (default %s).\n",
+                    WAVE_DEFAULT_SOCKET);
+            printf(" - threads: simulation threads per job (default 1).\n");
+            printf(" - arena-mb: pre-faulted buffer memory; a job needs "
+                    "2 * i_max * 8 bytes of it (default 256).\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (srv.num_threads < 1 || arena_mb < 1) {
+        printf("argument error: threads and arena-mb should be >=1.\n");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (arena_init(&srv.arena, arena_mb << 20, ARENA_POPULATE) != 0) {
+        fprintf(stderr, "Could not allocate the buffer arena, aborting.\n");
+        return EXIT_FAILURE;
+    }
+    sock = listen_on(path);
+    if (sock < 0)
+        return EXIT_FAILURE;
+
+    pthread_mutex_init(&srv.lock, NULL);
+    pthread_cond_init(&srv.wake, NULL);
+    pthread_create(&runner_thread, NULL, runner, &srv);
+
+    printf("wave_server: listening on %s, %d threads, %ld MiB %s arena\n",
+            path, srv.num_threads, arena_mb, srv.arena.pages);
+    fflush(stdout);
+
+    while (!quit) {
+        struct pollfd fds[num_pending + 1];
+        int k;
+
+        fds[0].fd = sock;
+        fds[0].events = POLLIN;
+        for (k = 0; k < num_pending; k++) {
+            fds[k + 1].fd = pending[k].conn;
+            fds[k + 1].events = POLLIN;
+        }
+        if (poll(fds, num_pending + 1, POLL_MS) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        /* Backwards, so a finished connection can take the last one's slot. */
+        for (k = num_pending - 1; k >= 0; k--) {
+            Pending *p = &pending[k];
+            int done = 0, drop = 0;
+
+            if (fds[k + 1].revents != 0) {
+                ssize_t n = recv(p->conn, (char *) &p->req + p->got,
+                                 sizeof(p->req) - p->got, MSG_DONTWAIT);
+
+                if (n > 0)
+                    done = (p->got += n) == sizeof(p->req);
+                else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+                    drop = 1;
+            }
+            if (!done && timer_end_r(&p->since) > REQUEST_TIMEOUT)
+                drop = 1;
+
+            if (done)
+                quit |= take_request(&srv, p->conn, &p->req);
+            else if (drop)
+                close(p->conn);
+            if (done || drop)
+                pending[k] = pending[--num_pending];
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int conn = accept(sock, NULL, NULL);
+
+            if (conn < 0) {
+                if (errno != EINTR && errno != ECONNABORTED) {
+                    perror("accept");
+                    break;
+                }
+                continue;
+            }
+            if (num_pending == pending_cap) {
+                int cap = pending_cap ? 2 * pending_cap : 16;
+                Pending *grown = realloc(pending, cap * sizeof(Pending));
+
+                if (grown == NULL) {
+                    close(conn);
+                    continue;
+                }
+                pending = grown;
+                pending_cap = cap;
+            }
+            pending[num_pending].conn = conn;
+            pending[num_pending].got = 0;
+            timer_start_r(&pending[num_pending].since);
+            num_pending++;
+        }
+    }
+    while (num_pending > 0)
+        close(pending[--num_pending].conn);
+    free(pending);
+
+    /* Drain what is queued, then stop. */
+    pthread_mutex_lock(&srv.lock);
+    srv.quit = 1;
+    pthread_cond_signal(&srv.wake);
+    pthread_mutex_unlock(&srv.lock);
+    pthread_join(runner_thread, NULL);
+
+    printf("wave_server: %lu jobs done\n", srv.jobs_done);
+
+    close(sock);
+    unlink(path);
+    session_destroy(srv.session);
+    arena_destroy(&srv.arena);
+    pthread_cond_destroy(&srv.wake);
+    pthread_mutex_destroy(&srv.lock);
+    free(srv.heap);
+
+    return EXIT_SUCCESS;
+}
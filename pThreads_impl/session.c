@@ -0,0 +1,625 @@
+/*
+ * session.c
+ *
+ * The barrier engine behind simulate(), as a resumable session.
+ *
+ * session_create()/session_wrap() start num_threads workers that park on a
+ * condition variable. session_step(n) hands them n steps; they sweep their
+ * fixed chunk, meet at a barrier, thread 0 rotates the buffers, and after
+ * the last step they report back and park again. The buffers, the threads
+ * and the barrier therefore live as long as the session, and nothing is
+ * global, so sessions are independent of each other.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "session.h"
+#include "arena.h"
+#include "timer.h"
+#include "probe.h"
+#include "raster.h"
+#include "kernel.h"
+#include "trace.h"
+
+static const double c = STENCIL_C;
+
+// Per-thread diagnostic sums for one step, reduced by thread 0 in id order.
+typedef struct {
+    double kinetic;
+    double potential;
+    double sum_squares;
+    double max_abs;
+    long max_index;
+} DiagPartial;
+
+typedef struct {
+    int id;
+    long start, end;
+    sim_session_t *session;
+} SessionWorker;
+
+struct sim_session {
+    long i_max;
+    int num_threads;
+    long t;                  /* steps taken so far */
+    double seconds;          /* wall time spent in session_step() */
+
+    double *old_array;
+    double *current_array;
+    double *next_array;
+    int owns_buffers;
+    arena_t arena;
+
+    sim_diag_t diag;         /* every == 0 when disabled */
+    DiagPartial *partials;
+    probe_set_t *probes;     /* NULL when disabled */
+    raster_t *raster;        /* NULL when disabled */
+    stencil_func_t stencil;  /* kernel_select() for i_max */
+
+    pthread_t *threads;
+    SessionWorker *workers;
+    int num_started;
+    pthread_barrier_t barrier;
+
+    /* Hand-off between session_step() and the parked workers. */
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    unsigned long generation;
+    long pending;
+    int finished;
+    int quit;
+
+    /*
+     * Progress, published by thread 0 at every step boundary so monitors
+     * can read it while the workers run; see session_progress().
+     */
+    pthread_mutex_t progress_lock;
+    int tracking;            /* time each worker's sweeps */
+    long tracking_since;     /* step tracking was switched on at */
+    double *busy;            /* per worker compute seconds, own slot only */
+    double *published_busy;
+    long published_t;
+    int stepping;
+    struct timespec step_start;
+    int cancel;              /* set by session_cancel() */
+    int stop;                /* thread 0's verdict, read after a barrier */
+};
+
+
+/*
+ * Same update as the plain sweep, but also accumulates the discrete energy
+ *     E = 1/2 sum (cur_i - old_i)^2 + c/2 sum (cur_i+1 - cur_i)(old_i+1 - old_i)
+ * which the scheme conserves, and the L2 norm and max |u| of current.
+ * The thread owning i = 1 also takes the edge (0, 1).
+ */
+static void diag_sweep(const SessionWorker *w)
+{
+    sim_session_t *s = w->session;
+    double *next = s->next_array;
+    const double *cur = s->current_array;
+    const double *old = s->old_array;
+    DiagPartial p = { 0, 0, 0, 0, -1 };
+
+    if (w->start == 1)
+        p.potential += (cur[1] - cur[0]) * (old[1] - old[0]);
+
+    for (long i = w->start; i < w->end; i++) {
+        double velocity = cur[i] - old[i];
+        double magnitude = cur[i] < 0 ? -cur[i] : cur[i];
+
+        next[i] = 2 * cur[i] - old[i]
+                  + c * (cur[i-1] - 2 * cur[i] + cur[i+1]);
+
+        p.kinetic += velocity * velocity;
+        p.potential += (cur[i+1] - cur[i]) * (old[i+1] - old[i]);
+        p.sum_squares += cur[i] * cur[i];
+        if (magnitude > p.max_abs || p.max_index < 0) {
+            p.max_abs = magnitude;
+            p.max_index = i;
+        }
+    }
+
+    s->partials[w->id] = p;
+}
+
+// Thread 0 only: reduce the partials in a fixed order and emit one row.
+static void diag_emit(const sim_session_t *s)
+{
+    DiagPartial total = { 0, 0, 0, 0, -1 };
+
+    for (int thr = 0; thr < s->num_threads; thr++) {
+        const DiagPartial *p = &s->partials[thr];
+        total.kinetic += p->kinetic;
+        total.potential += p->potential;
+        total.sum_squares += p->sum_squares;
+        if (p->max_index >= 0 && (p->max_abs > total.max_abs || total.max_index < 0)) {
+            total.max_abs = p->max_abs;
+            total.max_index = p->max_index;
+        }
+    }
+
+    fprintf(s->diag.fp, "%ld,%.17g,%.17g,%.17g,%ld\n", s->t,
+            0.5 * total.kinetic + 0.5 * c * total.potential,
+            sqrt(total.sum_squares), total.max_abs, total.max_index);
+}
+
+static void sweep(const SessionWorker *w)
+{
+    const sim_session_t *s = w->session;
+
+    s->stencil(s->next_array, s->current_array, s->old_array, w->start, w->end);
+}
+
+static void *session_worker(void *arg)
+{
+    SessionWorker *w = (SessionWorker *) arg;
+    sim_session_t *s = w->session;
+    unsigned long seen = 0;
+    struct timespec busy_start;
+
+    TRACE_THREAD("worker", w->id);
+
+    for (;;) {
+        long steps;
+
+        pthread_mutex_lock(&s->lock);
+        while (s->generation == seen && !s->quit)
+            pthread_cond_wait(&s->start, &s->lock);
+        seen = s->generation;
+        steps = s->pending;
+        if (s->quit) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        for (long k = 0; k < steps; k++) {
+            // s->t only changes between the two barriers below
+            const long t = s->t;
+            int diag_step = s->diag.every > 0 && t % s->diag.every == 0;
+
+            TRACE_BEGIN(compute);
+            if (s->tracking)
+                timer_start_r(&busy_start);
+            if (diag_step) {
+                diag_sweep(w);
+                if (s->raster != NULL)
+                    raster_record(s->raster, w->id, s->next_array);
+            } else if (s->raster != NULL) {
+                raster_sweep(s->raster, w->id, s->next_array,
+                             s->current_array, s->old_array);
+            } else {
+                sweep(w);
+            }
+            if (s->probes != NULL)
+                probe_record(s->probes, w->id, s->next_array);
+            if (s->tracking)
+                s->busy[w->id] += timer_end_r(&busy_start);
+            TRACE_END(compute, "compute", t);
+
+            // wait for other computations
+            TRACE_BEGIN(wait);
+            pthread_barrier_wait(&s->barrier);
+            TRACE_END(wait, "barrier", t);
+
+            if (w->id == 0) {
+                TRACE_BEGIN(rotate);
+                if (diag_step)
+                    diag_emit(s);
+                double *temp = s->old_array;
+                s->old_array = s->current_array;
+                s->current_array = s->next_array;
+                s->next_array = temp;
+                s->t++;
+                if (s->probes != NULL)
+                    probe_advance(s->probes, s->t);
+                if (s->raster != NULL)
+                    raster_advance(s->raster);
+
+                pthread_mutex_lock(&s->progress_lock);
+                s->published_t = s->t;
+                if (s->tracking) {
+                    memcpy(s->published_busy, s->busy,
+                           s->num_threads * sizeof(double));
+                }
+                s->stop = s->cancel;
+                pthread_mutex_unlock(&s->progress_lock);
+                TRACE_END(rotate, diag_step ? "rotate+diag" : "rotate", t);
+            }
+
+            // wait for rotation
+            TRACE_BEGIN(rotate_wait);
+            pthread_barrier_wait(&s->barrier);
+            TRACE_END(rotate_wait, "barrier", t);
+
+            // cancelled: stop here, at a step boundary
+            if (s->stop)
+                break;
+        }
+
+        // hand the finished state back to session_step()
+        TRACE_BEGIN(handoff);
+        pthread_mutex_lock(&s->lock);
+        if (++s->finished == s->num_threads)
+            pthread_cond_signal(&s->done);
+        pthread_mutex_unlock(&s->lock);
+        TRACE_END(handoff, "handoff", s->t);
+    }
+
+    return NULL;
+}
+
+// Splits the interior points over the workers like simulate() always has.
+static void session_partition(sim_session_t *s)
+{
+
+    const long total_interior_points = s->i_max - 2;
+    const long chunk_size = total_interior_points / s->num_threads;
+    const long remainder = total_interior_points % s->num_threads;
+    long start_index = 1;
+
+    for (int thr = 0; thr < s->num_threads; thr++) {
+        long range = chunk_size + (thr < remainder ? 1 : 0);
+
+        s->workers[thr].start = start_index;
+        s->workers[thr].end = start_index + range;
+        start_index += range;
+    }
+}
+
+static sim_session_t *session_start(sim_session_t *s)
+{
+    s->threads = malloc(s->num_threads * sizeof(pthread_t));
+    s->workers = malloc(s->num_threads * sizeof(SessionWorker));
+    s->partials = malloc(s->num_threads * sizeof(DiagPartial));
+    s->busy = calloc(s->num_threads, sizeof(double));
+    s->published_busy = calloc(s->num_threads, sizeof(double));
+    if (!s->threads || !s->workers || !s->partials || !s->busy ||
+            !s->published_busy) {
+        session_destroy(s);
+        return NULL;
+    }
+
+    pthread_barrier_init(&s->barrier, NULL, s->num_threads);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_mutex_init(&s->progress_lock, NULL);
+    pthread_cond_init(&s->start, NULL);
+    pthread_cond_init(&s->done, NULL);
+
+    session_partition(s);
+    s->stencil = kernel_select(s->i_max);
+
+    for (int thr = 0; thr < s->num_threads; thr++) {
+        s->workers[thr].id = thr;
+        s->workers[thr].session = s;
+
+        if (pthread_create(&s->threads[thr], NULL, session_worker,
+                    &s->workers[thr]) != 0) {
+            session_destroy(s);
+            return NULL;
+        }
+        s->num_started++;
+    }
+
+    return s;
+}
+
+/*
+ * Starts a session on the caller's three buffers, which must stay valid
+ * until session_destroy(). No data is copied; the buffers rotate in place
+ * exactly as in simulate(). Returns NULL on failure.
+ */
+sim_session_t *session_wrap(long i_max, int num_threads,
+        double *old_array, double *current_array, double *next_array)
+{
+    sim_session_t *s = calloc(1, sizeof(*s));
+
+    if (s == NULL)
+        return NULL;
+
+    s->i_max = i_max;
+    s->num_threads = num_threads;
+    s->old_array = old_array;
+    s->current_array = current_array;
+    s->next_array = next_array;
+
+    return session_start(s);
+}
+
+/*
+ * Starts a session on its own copy of the first two levels. The third
+ * buffer starts zeroed, as the drivers leave it. Returns NULL on failure.
+ */
+sim_session_t *session_create(long i_max, int num_threads,
+        const double *old_array, const double *current_array)
+{
+    const size_t bytes = i_max * sizeof(double);
+    double *buffers[3];
+    sim_session_t *s;
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        return NULL;
+
+    if (arena_init(&s->arena, 3 * arena_footprint(bytes), 0) != 0) {
+        free(s);
+        return NULL;
+    }
+    for (int b = 0; b < 3; b++)
+        buffers[b] = arena_alloc(&s->arena, bytes);
+    memcpy(buffers[0], old_array, bytes);
+    memcpy(buffers[1], current_array, bytes);
+    memset(buffers[2], 0, bytes);
+
+    s->i_max = i_max;
+    s->num_threads = num_threads;
+    s->old_array = buffers[0];
+    s->current_array = buffers[1];
+    s->next_array = buffers[2];
+    s->owns_buffers = 1;
+
+    return session_start(s);
+}
+
+/*
+ * Points an idle wrapped session at a new set of buffers, possibly of a
+ * different size, and restarts its step count and timing. The workers stay
+ * up, so a long-lived caller pays thread creation once. Diagnostics are
+ * switched off and a session_cancel() is forgotten. Returns -1 for sessions
+ * that own their buffers.
+ */
+int session_rebind(sim_session_t *s, long i_max,
+        double *old_array, double *current_array, double *next_array)
+{
+    if (s->owns_buffers)
+        return -1;
+
+    s->i_max = i_max;
+    s->t = 0;
+    s->published_t = 0;
+    s->seconds = 0;
+    s->tracking = 0;
+    s->cancel = 0;
+    s->stop = 0;
+    s->old_array = old_array;
+    s->current_array = current_array;
+    s->next_array = next_array;
+    s->diag.every = 0;
+    s->diag.fp = NULL;
+    s->probes = NULL;
+    s->raster = NULL;
+    session_partition(s);
+    s->stencil = kernel_select(s->i_max);
+
+    return 0;
+}
+
+/*
+ * Writes a (step, energy, l2_norm, max_abs, max_index) CSV row to diag->fp
+ * every diag->every steps from now on, starting with the header. NULL turns
+ * the diagnostics off again.
+ */
+void session_set_diag(sim_session_t *s, const sim_diag_t *diag)
+{
+    if (diag == NULL || diag->every < 1) {
+        s->diag.every = 0;
+        s->diag.fp = NULL;
+        return;
+    }
+
+    s->diag = *diag;
+    fprintf(s->diag.fp, "step,energy,l2_norm,max_abs,max_index\n");
+}
+
+/*
+ * Records the probes in `probes' at every step from now on, starting with
+ * a row for the current level, until called again with NULL; only then
+ * may the caller probe_close() them. Only while idle. Returns -1 if the
+ * probe buffers cannot be set up.
+ */
+int session_set_probes(sim_session_t *s, probe_set_t *probes)
+{
+    s->probes = NULL;
+    if (probes == NULL)
+        return 0;
+
+    if (probe_attach(probes, s->num_threads) != 0)
+        return -1;
+    for (int thr = 0; thr < s->num_threads; thr++) {
+        const SessionWorker *w = &s->workers[thr];
+
+        if (probe_assign(probes, thr, w->start, w->end) != 0)
+            return -1;
+        probe_record(probes, thr, s->current_array);
+    }
+    probe_advance(probes, s->t);
+
+    s->probes = probes;
+    return 0;
+}
+
+/*
+ * Bins every step from now on into `raster', fused into the workers'
+ * sweeps, until called again with NULL; only then may the caller
+ * raster_close() it. Only while idle. Returns -1 if the per-thread
+ * columns cannot be set up.
+ */
+int session_set_raster(sim_session_t *s, raster_t *raster)
+{
+    s->raster = NULL;
+    if (raster == NULL)
+        return 0;
+
+    if (raster_attach(raster, s->num_threads) != 0)
+        return -1;
+    for (int thr = 0; thr < s->num_threads; thr++) {
+        const SessionWorker *w = &s->workers[thr];
+
+        if (raster_assign(raster, thr, w->start, w->end) != 0)
+            return -1;
+    }
+
+    s->raster = raster;
+    return 0;
+}
+
+/*
+ * Advances the session `steps' steps and returns once they are done (0),
+ * or once the workers stopped early at a step boundary because of
+ * session_cancel() (1). A session cancelled before the call takes no step.
+ */
+int session_step(sim_session_t *s, long steps)
+{
+    struct timespec start;
+
+    if (steps <= 0)
+        return 0;
+
+    timer_start_r(&start);
+
+    pthread_mutex_lock(&s->progress_lock);
+    s->stop = s->cancel;
+    if (s->stop) {
+        pthread_mutex_unlock(&s->progress_lock);
+        return 1;
+    }
+    s->stepping = 1;
+    s->step_start = start;
+    pthread_mutex_unlock(&s->progress_lock);
+
+    pthread_mutex_lock(&s->lock);
+    s->pending = steps;
+    s->finished = 0;
+    s->generation++;
+    pthread_cond_broadcast(&s->start);
+    while (s->finished < s->num_threads)
+        pthread_cond_wait(&s->done, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+
+    pthread_mutex_lock(&s->progress_lock);
+    s->seconds += timer_end_r(&start);
+    s->stepping = 0;
+    pthread_mutex_unlock(&s->progress_lock);
+
+    return s->stop;
+}
+
+/*
+ * Makes a running session_step() return at the next step boundary, and
+ * later ones return at once, until session_rebind(). Safe to call from any
+ * thread (but not from a signal handler).
+ */
+void session_cancel(sim_session_t *s)
+{
+    pthread_mutex_lock(&s->progress_lock);
+    s->cancel = 1;
+    pthread_mutex_unlock(&s->progress_lock);
+}
+
+/*
+ * Turns per-worker compute timing (for session_progress() rates) on or
+ * off. Costs two clock reads per worker per step. Only while idle.
+ */
+void session_set_tracking(sim_session_t *s, int on)
+{
+    s->tracking = on;
+    s->tracking_since = s->t;
+    memset(s->busy, 0, s->num_threads * sizeof(double));
+    memset(s->published_busy, 0, s->num_threads * sizeof(double));
+}
+
+/*
+ * Progress snapshot for a monitor thread, taken without pausing the
+ * workers: returns the steps completed and stores the wall time spent
+ * stepping in *seconds. With tracking on, rates[thr] receives each
+ * worker's compute rate in point updates per second (0 before the first
+ * step); rates needs session_threads() entries and may be NULL.
+ */
+long session_progress(sim_session_t *s, double *seconds, double *rates)
+{
+    long t;
+
+    pthread_mutex_lock(&s->progress_lock);
+    t = s->published_t;
+    *seconds = s->seconds + (s->stepping ? timer_end_r(&s->step_start) : 0);
+    if (rates != NULL) {
+        for (int thr = 0; thr < s->num_threads; thr++) {
+            const SessionWorker *w = &s->workers[thr];
+            double busy = s->published_busy[thr];
+
+            rates[thr] = busy > 0 ?
+                (double) (w->end - w->start) * (t - s->tracking_since) / busy : 0;
+        }
+    }
+    pthread_mutex_unlock(&s->progress_lock);
+
+    return t;
+}
+
+int session_threads(const sim_session_t *s)
+{
+    return s->num_threads;
+}
+
+/*
+ * Returns the current level, valid until the next session_step(), and
+ * stores the number of steps taken so far in *t unless t is NULL.
+ */
+double *session_peek(const sim_session_t *s, long *t)
+{
+    if (t != NULL)
+        *t = s->t;
+    return s->current_array;
+}
+
+/*
+ * Returns the level before the current one, which together with
+ * session_peek() is the full state of the scheme.
+ */
+double *session_previous(const sim_session_t *s)
+{
+    return s->old_array;
+}
+
+double session_seconds(const sim_session_t *s)
+{
+    return s->seconds;
+}
+
+void session_destroy(sim_session_t *s)
+{
+    if (s == NULL)
+        return;
+
+    if (s->threads != NULL && s->workers != NULL && s->partials != NULL &&
+            s->busy != NULL && s->published_busy != NULL) {
+        pthread_mutex_lock(&s->lock);
+        s->quit = 1;
+        pthread_cond_broadcast(&s->start);
+        pthread_mutex_unlock(&s->lock);
+
+        for (int thr = 0; thr < s->num_started; thr++)
+            pthread_join(s->threads[thr], NULL);
+
+        pthread_cond_destroy(&s->done);
+        pthread_cond_destroy(&s->start);
+        pthread_mutex_destroy(&s->progress_lock);
+        pthread_mutex_destroy(&s->lock);
+        pthread_barrier_destroy(&s->barrier);
+    }
+
+    if (s->owns_buffers)
+        arena_destroy(&s->arena);
+    free(s->threads);
+    free(s->workers);
+    free(s->partials);
+    free(s->busy);
+    free(s->published_busy);
+    free(s);
+}
@@ -0,0 +1,40 @@
+/*
+ * session.h
+ *
+ * Resumable simulation sessions. A session owns its worker threads (and,
+ * when made with session_create(), its buffers), so a caller can advance a
+ * simulation in increments without paying the setup again. Sessions share
+ * no state, so any number of them can run in one process.
+ *
+ */
+
+#pragma once
+
+#include "simulate.h"
+#include "probe.h"
+#include "raster.h"
+
+typedef struct sim_session sim_session_t;
+
+sim_session_t *session_create(long i_max, int num_threads,
+        const double *old_array, const double *current_array);
+sim_session_t *session_wrap(long i_max, int num_threads,
+        double *old_array, double *current_array, double *next_array);
+int session_rebind(sim_session_t *session, long i_max,
+        double *old_array, double *current_array, double *next_array);
+
+void session_set_diag(sim_session_t *session, const sim_diag_t *diag);
+int session_set_probes(sim_session_t *session, probe_set_t *probes);
+int session_set_raster(sim_session_t *session, raster_t *raster);
+int session_step(sim_session_t *session, long steps);
+double *session_peek(const sim_session_t *session, long *t);
+double *session_previous(const sim_session_t *session);
+double session_seconds(const sim_session_t *session);
+
+/* Monitoring and cancellation from other threads. */
+void session_cancel(sim_session_t *session);
+void session_set_tracking(sim_session_t *session, int on);
+long session_progress(sim_session_t *session, double *seconds, double *rates);
+int session_threads(const sim_session_t *session);
+
+void session_destroy(sim_session_t *session);
@@ -0,0 +1,18 @@
+# Builds the `wavesim' Python module (python/wavemodule.c) against the
+# engines in this directory:
+#
+#     python3 setup.py build_ext --inplace     (or: make python)
+
+from setuptools import setup, Extension
+
+wavesim = Extension(
+    "wavesim",
+    sources=["python/wavemodule.c", "simulate.c", "session.c", "spectral.c",
+             "probe.c", "raster.c", "kernel.c", "arena.c", "timer.c"],
+    # Same value as pyconfig.h, so Python.h does not redefine it.
+    define_macros=[("_POSIX_C_SOURCE", "200809L")],
+    extra_compile_args=["-std=c99", "-O2", "-Wall", "-Wshadow"],
+    libraries=["m", "rt", "pthread"],
+)
+
+setup(name="wavesim", version="1.0", ext_modules=[wavesim])
@@ -8,11 +8,14 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include "simulate.h"
+#include "session.h"
+#include "kernel.h"
+#include "trace.h"
 
 
 
 /* Add any global variables you may need. */
-static const double c = 0.15;
+static const double c = STENCIL_C;
 
 /* Add any functions you may need (like a worker) here. */
     void rotate_arrays(double **old_array, double **current_array, double **next_array) {
@@ -37,7 +40,7 @@ static const double c = 0.15;
 
 
 /**-----------TEMPLATE-----------*/
-// double *simulate(const int i_max, const int t_max, const int num_threads,
+// double *simulate(const long i_max, const long t_max, const int num_threads,
 //         double *old_array, double *current_array, double *next_array)
 // {
 //     /*
@@ -56,14 +59,13 @@ static const double c = 0.15;
 /**-----------Sequential Implementation-----------*/
 //EXPERIMENT: Sequential code
 
-double *simulateSequential_v1(const int i_max, const int t_max, const int num_threads,
+double *simulateSequential_v1(const long i_max, const long t_max, const int num_threads,
         double *old_array, double *current_array, double *next_array)
 {
-        for (int t = 0; t < t_max; t++) {
-            for (int i = 1; i < i_max - 1; i++) {
-                next_array[i] = 2 * current_array[i] - old_array[i]
-                                + c * (current_array[i-1] - 2*current_array[i] + current_array[i+1]);
-            }
+        stencil_func_t stencil = kernel_select(i_max);
+
+        for (long t = 0; t < t_max; t++) {
+            stencil(next_array, current_array, old_array, 1, i_max - 1);
 
             rotate_arrays(&old_array, &current_array, &next_array);
         }
@@ -72,44 +74,110 @@ double *simulateSequential_v1(const int i_max, const int t_max, const int num_th
 /**----------------------------------------*/
 
 
+/**-----------Cache-Oblivious Sequential Implementation-----------*/
+//EXPERIMENT: Frigo-Strumpen trapezoidal space-time recursion
+// Level s of the wave lives in bufs[s % 3] (old = level 0, current = level 1),
+// the same buffer simulateSequential_v1 ends up using, so boundaries and
+// results are bit-identical. Any order that respects the stencil dependencies
+// may overwrite level s-3 when writing level s.
+
+// Leaves are swept directly once they are this many steps tall. This only
+// amortises the recursion overhead; it is far below any cache size.
+#define TRAPEZOID_LEAF_STEPS 32
+
+typedef struct {
+    double *bufs[3];
+} Trapezoid;
+
+static void trapezoid_walk(const Trapezoid *tz, long t0, long t1,
+        long x0, long dx0, long x1, long dx1)
+{
+    long dt = t1 - t0;
+
+    if (dt <= TRAPEZOID_LEAF_STEPS) {
+        // small trapezoid: sweep it row by row
+        for (long t = t0; t < t1; t++) {
+            double *next = tz->bufs[(t + 2) % 3];
+            const double *cur = tz->bufs[(t + 1) % 3];
+            const double *old = tz->bufs[t % 3];
+            long lo = x0 + dx0 * (t - t0);
+            long hi = x1 + dx1 * (t - t0);
+
+            for (long i = lo; i < hi; i++) {
+                next[i] = 2 * cur[i] - old[i]
+                          + c * (cur[i-1] - 2*cur[i] + cur[i+1]);
+            }
+        }
+    } else if (2 * (x1 - x0) + (dx1 - dx0) * dt >= 4 * dt) {
+        // wide enough: cut in space along a slope -1 line
+        long xm = (2 * (x0 + x1) + (2 + dx0 + dx1) * dt) / 4;
+        trapezoid_walk(tz, t0, t1, x0, dx0, xm, -1);
+        trapezoid_walk(tz, t0, t1, xm, -1, x1, dx1);
+    } else {
+        // too tall: cut in time
+        long s = dt / 2;
+        trapezoid_walk(tz, t0, t0 + s, x0, dx0, x1, dx1);
+        trapezoid_walk(tz, t0 + s, t1, x0 + dx0 * s, dx0, x1 + dx1 * s, dx1);
+    }
+}
+
+double *simulateSequential_trapezoid(const long i_max, const long t_max, const int num_threads,
+        double *old_array, double *current_array, double *next_array)
+{
+    Trapezoid tz = { { old_array, current_array, next_array } };
+
+    // step t writes level t+2 on the interior [1, i_max-1)
+    trapezoid_walk(&tz, 0, t_max, 1, 0, i_max - 1, 0);
+
+    return tz.bufs[(t_max + 1) % 3];
+}
+/**----------------------------------------*/
+
+
 /**-----------Concurrent Implementation Without Barriers-----------*/
 //EXPERIMENT: Chunk_Threading Approach: threads are not reused
 typedef struct {
-    int start, end;
+    int id;
+    long t;
+    long start, end;
     double *prev_array;
     double *current_array;
     double *next_array;
+    stencil_func_t stencil;
 } WorkerArgs_v2;
 
 void* worker_v2(void* arg) {
     WorkerArgs_v2 *args = (WorkerArgs_v2*) arg;
-    for (int i = args->start; i < args->end; i++) {
-       args->next_array[i] = 2  * args->current_array[i]
-                                - args->prev_array[i]
-                                +  c * (args->current_array[i-1] - 2*args->current_array[i] +  args->current_array[i+1]);
-    }
+    TRACE_THREAD("chunk", args->id);
+    TRACE_BEGIN(compute);
+    args->stencil(args->next_array, args->current_array, args->prev_array,
+                  args->start, args->end);
+    TRACE_END(compute, "compute", args->t);
     return NULL;
 }
 
-double *simulate_v2(const int i_max, const int t_max, const int num_threads,
+double *simulate_v2(const long i_max, const long t_max, const int num_threads,
         double *old_array, double *current_array, double *next_array)
 {
     pthread_t threads[num_threads];
     WorkerArgs_v2 args[num_threads];
 
-    const int total_interior_points = i_max - 2;  // Points we actually compute
-    const int chunk_size = total_interior_points / num_threads;
-    const int remainder = total_interior_points % num_threads;
+    const long total_interior_points = i_max - 2;  // Points we actually compute
+    const long chunk_size = total_interior_points / num_threads;
+    const long remainder = total_interior_points % num_threads;
+    const stencil_func_t stencil = kernel_select(i_max);
 
-    for (int t = 0; t < t_max; t++) {
-        int start_index = 1;
+    for (long t = 0; t < t_max; t++) {
+        long start_index = 1;
 
         for (int thr = 0; thr < num_threads; thr++) {
-            int range = chunk_size;
+            long range = chunk_size;
             if (thr < remainder) {
                 range++;
             }
 
+            args[thr].id = thr;
+            args[thr].t = t;
             args[thr].start = start_index;
             args[thr].end = start_index + range;
 
@@ -120,13 +188,16 @@ double *simulate_v2(const int i_max, const int t_max, const int num_threads,
             args[thr].prev_array = old_array;
             args[thr].current_array = current_array;
             args[thr].next_array = next_array;
+            args[thr].stencil = stencil;
 
             pthread_create(&threads[thr], NULL, worker_v2, &args[thr]);
 
             start_index+=range;
         }
+        TRACE_BEGIN(join);
         for (int th = 0; th < num_threads; th++)
             pthread_join(threads[th], NULL);
+        TRACE_END(join, "join", t);
         rotate_arrays(&old_array, &current_array, &next_array);
     }
     return current_array;
@@ -139,102 +210,31 @@ double *simulate_v2(const int i_max, const int t_max, const int num_threads,
 
 /**-----------Concurrent Implementation With Barriers-----------*/
 //EXPERIMENT: Chunk_Threading Approach with Barriers
-typedef struct {
-    int id;
-    int i_max;
-    int t_max;
-    int start, end;
-
-    double **old_array;
-    double **current_array;
-    double **next_array;
-
-    pthread_barrier_t *barrier;
-} WorkerArgs;
-
-void* worker(void* arg) {
-    WorkerArgs *args = (WorkerArgs*) arg;
-    for (int t = 0; t < args->t_max; t++) {
-        pthread_barrier_wait(args->barrier);
-
-        // worker chunk computation
-        for (int i = args->start; i < args->end; i++) {
-            if (i > 0 && i < args->i_max - 1) {
-                (*args->next_array)[i] = 2 * (*args->current_array)[i]
-                                       - (*args->old_array)[i]
-                                       + c * ((*args->current_array)[i-1]
-                                            - 2 * (*args->current_array)[i]
-                                            + (*args->current_array)[i+1]);
-            }
-        }
-
-        // wait for other computations
-        pthread_barrier_wait(args->barrier);
-
-        if (args->id == 0) {
-            rotate_arrays(args->old_array, args->current_array, args->next_array);
-        }
-
-        // wait for rotation
-        pthread_barrier_wait(args->barrier);
-    }
-
-    return NULL;
-}
-
-double *simulate(const int i_max, const int t_max, const int num_threads,
+// The workers live in session.c; these run a throwaway session to the end.
+double *simulate(const long i_max, const long t_max, const int num_threads,
         double *old_array, double *current_array, double *next_array)
 {
-    pthread_t threads[num_threads];
-    WorkerArgs args[num_threads];
-    pthread_barrier_t barrier;
-
-    // create barrier for all threads
-    pthread_barrier_init(&barrier, NULL, num_threads);
-
-    const int total_interior_points = i_max - 2;
-    const int chunk_size = total_interior_points / num_threads;
-    const int remainder = total_interior_points % num_threads;
-
-    int start_index = 1;
-
-    // worker threads
-    for (int thr = 0; thr < num_threads; thr++) {
-        int range = chunk_size;
-        if (thr < remainder) {
-            range++;
-        }
-
-        args[thr].id = thr;
-        args[thr].i_max = i_max;
-        args[thr].t_max = t_max;
-        args[thr].start = start_index;
-        args[thr].end = start_index + range;
-
-        // edge case
-        if (thr == num_threads - 1) {
-            args[thr].end = i_max - 1;
-        }
+    return simulate_diag(i_max, t_max, num_threads,
+                         old_array, current_array, next_array, NULL);
+}
 
-        // Pass pointers to array pointers for swapping
-        args[thr].old_array = &old_array;
-        args[thr].current_array = &current_array;
-        args[thr].next_array = &next_array;
-        args[thr].barrier = &barrier;
+double *simulate_diag(const long i_max, const long t_max, const int num_threads,
+        double *old_array, double *current_array, double *next_array,
+        const sim_diag_t *diag)
+{
+    sim_session_t *session;
+    double *result;
 
-        // start worker thread
-        pthread_create(&threads[thr], NULL, worker, &args[thr]);
-        start_index += range;
-    }
+    session = session_wrap(i_max, num_threads, old_array, current_array, next_array);
+    if (session == NULL)
+        return NULL;
 
-    // for all threads to complete all timesteps
-    for (int th = 0; th < num_threads; th++) {
-        pthread_join(threads[th], NULL);
-    }
+    session_set_diag(session, diag);
+    session_step(session, t_max);
+    result = session_peek(session, NULL);
+    session_destroy(session);
 
-    // clean barrier
-    pthread_barrier_destroy(&barrier);
-    return current_array;
+    return result;
 }
 // 1000 100 2 sin
 // Took 0.00164351 seconds
@@ -4,14 +4,40 @@
 
 #pragma once
 
-double *simulate(const int i_max, const int t_max, const int num_cpus,
+#include <stdio.h>
+
+typedef double *(*simulate_func_t)(const long, const long, const int,
+                                   double *, double *, double *);
+
+double *simulate(const long i_max, const long t_max, const int num_cpus,
         double *old_array, double *current_array, double *next_array);
 
+/*
+ * Diagnostics fused into simulate()'s sweep. Every `every' steps one CSV row
+ * (step, energy, l2_norm, max_abs, max_index) describing the current wave is
+ * written to `fp'. The per-thread sums are reduced in thread order, so a
+ * given thread count always produces the same output.
+ */
+typedef struct {
+    int every;
+    FILE *fp;
+} sim_diag_t;
+
+double *simulate_diag(const long i_max, const long t_max, const int num_cpus,
+        double *old_array, double *current_array, double *next_array,
+        const sim_diag_t *diag);
+
 
 // added for testing
-double *simulateSequential_v1(const int i_max, const int t_max, const int num_threads,
+double *simulateSequential_v1(const long i_max, const long t_max, const int num_threads,
                               double *old_array, double *current_array, double *next_array);
 
-double *simulate_v2(const int i_max, const int t_max, const int num_threads,
+double *simulateSequential_trapezoid(const long i_max, const long t_max, const int num_threads,
+                                     double *old_array, double *current_array, double *next_array);
+
+double *simulate_v2(const long i_max, const long t_max, const int num_threads,
                     double *old_array, double *current_array, double *next_array);
 
+// spectral.c: jumps t_max steps in O(i_max log i_max), zero boundaries only
+double *simulate_spectral(const long i_max, const long t_max, const int num_threads,
+                          double *old_array, double *current_array, double *next_array);
@@ -0,0 +1,249 @@
+/*
+ * spectral.c
+ *
+ * Spectral fast-forward engine.
+ *
+ * With zero boundaries the stencil in simulate.c is diagonalised by the
+ * discrete sine transform (DST-I) of the n = i_max - 2 interior points. Sine
+ * mode k then obeys the scalar two-term recurrence
+ *
+ *     u_k(t+1) = 2 a_k u_k(t) - u_k(t-1),   a_k = 1 - 2c sin^2(pi k / 2(n+1))
+ *
+ * whose solution after t steps is a Chebyshev polynomial of the second kind
+ * in a_k. We transform old/current once, jump every mode t_max steps ahead
+ * in closed form and transform back: O(n log n) instead of O(n * t_max).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include "simulate.h"
+#include "kernel.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static const double c = STENCIL_C;
+
+typedef double complex cplx;
+
+
+/*
+ * In-place iterative radix-2 FFT of length n (a power of two). `roots' holds
+ * exp(-2 pi i k / n) for k < n/2. Set `inverse' for the unscaled inverse.
+ */
+static void fft_pow2(cplx *a, long n, const cplx *roots, int inverse)
+{
+    long i, j, len;
+
+    for (i = 1, j = 0; i < n; i++) {
+        long bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            cplx tmp = a[i];
+            a[i] = a[j];
+            a[j] = tmp;
+        }
+    }
+
+    for (len = 2; len <= n; len <<= 1) {
+        long half = len >> 1;
+        long stride = n / len;
+        for (i = 0; i < n; i += len) {
+            for (j = 0; j < half; j++) {
+                cplx w = inverse ? conj(roots[j * stride]) : roots[j * stride];
+                cplx u = a[i + j];
+                cplx v = a[i + j + half] * w;
+                a[i + j] = u + v;
+                a[i + j + half] = u - v;
+            }
+        }
+    }
+}
+
+/*
+ * Forward DFT of arbitrary length m, using Bluestein's chirp-z algorithm on
+ * top of a power-of-two FFT when m itself is not a power of two.
+ */
+typedef struct {
+    long m, p;
+    cplx *roots;    /* p/2 twiddles for the power-of-two FFT */
+    cplx *chirp;    /* exp(-i pi k^2 / m), k < m */
+    cplx *kernel;   /* FFT of the conjugate chirp, wrapped to length p */
+    cplx *work;     /* length p scratch */
+} dft_plan;
+
+static int dft_plan_init(dft_plan *plan, long m)
+{
+    long k;
+
+    memset(plan, 0, sizeof(*plan));
+    plan->m = m;
+    plan->p = 1;
+    if (m & (m - 1)) {
+        while (plan->p < 2 * m - 1)
+            plan->p <<= 1;
+    } else {
+        plan->p = m;
+    }
+
+    plan->roots = malloc((plan->p / 2 + 1) * sizeof(cplx));
+    plan->work = malloc(plan->p * sizeof(cplx));
+    if (plan->roots == NULL || plan->work == NULL)
+        return -1;
+
+    for (k = 0; k < plan->p / 2; k++) {
+        double angle = -2 * M_PI * k / plan->p;
+        plan->roots[k] = cos(angle) + I * sin(angle);
+    }
+
+    if (plan->p == m)
+        return 0;
+
+    plan->chirp = malloc(m * sizeof(cplx));
+    plan->kernel = calloc(plan->p, sizeof(cplx));
+    if (plan->chirp == NULL || plan->kernel == NULL)
+        return -1;
+
+    /* Reduce k^2 modulo 2m first so the angle stays small and exact. */
+    for (k = 0; k < m; k++) {
+        long sq = (long) ((unsigned long long) k * k % (2 * m));
+        double angle = -M_PI * sq / m;
+        plan->chirp[k] = cos(angle) + I * sin(angle);
+    }
+
+    plan->kernel[0] = conj(plan->chirp[0]);
+    for (k = 1; k < m; k++) {
+        plan->kernel[k] = conj(plan->chirp[k]);
+        plan->kernel[plan->p - k] = conj(plan->chirp[k]);
+    }
+    fft_pow2(plan->kernel, plan->p, plan->roots, 0);
+
+    return 0;
+}
+
+static void dft_plan_destroy(dft_plan *plan)
+{
+    free(plan->roots);
+    free(plan->work);
+    free(plan->chirp);
+    free(plan->kernel);
+}
+
+/* Forward DFT of plan->work[0..m) in place. */
+static void dft_execute(dft_plan *plan)
+{
+    cplx *a = plan->work;
+    long k;
+
+    if (plan->p == plan->m) {
+        fft_pow2(a, plan->p, plan->roots, 0);
+        return;
+    }
+
+    for (k = 0; k < plan->m; k++)
+        a[k] *= plan->chirp[k];
+    for (k = plan->m; k < plan->p; k++)
+        a[k] = 0;
+
+    fft_pow2(a, plan->p, plan->roots, 0);
+    for (k = 0; k < plan->p; k++)
+        a[k] *= plan->kernel[k];
+    fft_pow2(a, plan->p, plan->roots, 1);
+
+    for (k = 0; k < plan->m; k++)
+        a[k] *= plan->chirp[k] / plan->p;
+}
+
+/*
+ * DST-I of the n values in `in' into `out':
+ *     out[k-1] = sum_{j=1..n} in[j-1] sin(pi j k / (n+1)),  k = 1..n
+ * computed from the DFT of the odd extension of length 2(n+1).
+ */
+static void dst1(dft_plan *plan, const double *in, double *out, long n)
+{
+    cplx *a = plan->work;
+    long j;
+
+    a[0] = 0;
+    a[n + 1] = 0;
+    for (j = 1; j <= n; j++) {
+        a[j] = in[j - 1];
+        a[2 * (n + 1) - j] = -in[j - 1];
+    }
+
+    dft_execute(plan);
+
+    for (j = 1; j <= n; j++)
+        out[j - 1] = -cimag(a[j]) / 2;
+}
+
+
+/*
+ * Jumps the simulation t_max steps ahead in sine space. Falls back to the
+ * stencil engine when any boundary value is non-zero, since the sine basis
+ * only diagonalises the homogeneous problem.
+ */
+double *simulate_spectral(const long i_max, const long t_max, const int num_threads,
+        double *old_array, double *current_array, double *next_array)
+{
+    const long n = i_max - 2;
+    double *old_hat, *cur_hat;
+    dft_plan plan;
+    long k;
+
+    if (old_array[0] != 0 || old_array[i_max - 1] != 0 ||
+            current_array[0] != 0 || current_array[i_max - 1] != 0 ||
+            next_array[0] != 0 || next_array[i_max - 1] != 0) {
+        fprintf(stderr, "spectral: non-zero boundaries, using the stencil.\n");
+        return simulate(i_max, t_max, num_threads,
+                        old_array, current_array, next_array);
+    }
+
+    old_hat = malloc(n * sizeof(double));
+    cur_hat = malloc(n * sizeof(double));
+    if (dft_plan_init(&plan, 2 * (n + 1)) != 0 ||
+            old_hat == NULL || cur_hat == NULL) {
+        fprintf(stderr, "spectral: out of memory, using the stencil.\n");
+        free(old_hat);
+        free(cur_hat);
+        dft_plan_destroy(&plan);
+        return simulate(i_max, t_max, num_threads,
+                        old_array, current_array, next_array);
+    }
+
+    dst1(&plan, old_array + 1, old_hat, n);
+    dst1(&plan, current_array + 1, cur_hat, n);
+
+    /*
+     * With a_k = cos(phi_k): u(t+1) = U_t(a) u(1) - U_{t-1}(a) u(0) and
+     * U_m(cos phi) = sin((m+1) phi) / sin(phi). phi_k comes from the half
+     * angle, sin(phi/2) = sqrt(c) sin(pi k / 2(n+1)), to keep small modes
+     * accurate.
+     */
+    for (k = 1; k <= n; k++) {
+        double s = sqrt(c) * sin(M_PI * k / (2.0 * (n + 1)));
+        double phi = 2 * asin(s);
+        double sin_phi = sin(phi);
+        double u_t = sin((t_max + 1.0) * phi) / sin_phi;
+        double u_tm1 = sin((double) t_max * phi) / sin_phi;
+
+        cur_hat[k - 1] = u_t * cur_hat[k - 1] - u_tm1 * old_hat[k - 1];
+    }
+
+    /* DST-I is its own inverse up to a factor 2 / (n+1). */
+    dst1(&plan, cur_hat, next_array + 1, n);
+    for (k = 1; k <= n; k++)
+        next_array[k] *= 2.0 / (n + 1);
+
+    dft_plan_destroy(&plan);
+    free(old_hat);
+    free(cur_hat);
+
+    return next_array;
+}
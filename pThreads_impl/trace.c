@@ -0,0 +1,206 @@
+/*
+ * trace.c
+ *
+ * Per-thread trace rings and the Chrome trace writer. Only built with
+ * `make TRACE=1'.
+ *
+ * A thread that calls TRACE_THREAD(label, id) is given the ring of that
+ * (label, id) pair if no live thread holds it, so worker 3 of successive
+ * simulate() calls shows up as one timeline row. Threads that record
+ * without naming themselves get an anonymous ring. The rings are only
+ * read by trace_dump(), after the traced threads are gone.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+#define TRACE_RING_EVENTS (1 << 15)
+#define TRACE_MAX_RINGS 256
+#define DEFAULT_TRACE_FILE "trace.json"
+
+typedef struct {
+    const char *name;
+    double start, duration;   /* microseconds */
+    long step;
+} TraceEvent;
+
+typedef struct {
+    const char *label;
+    int id;
+    int in_use;
+    unsigned long head;       /* events ever recorded */
+    TraceEvent events[TRACE_RING_EVENTS];
+} TraceRing;
+
+static TraceRing *rings[TRACE_MAX_RINGS];
+static int num_rings;
+static unsigned long rings_full;   /* threads that got no ring */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static struct timespec epoch;
+
+
+/* Thread-specific value of threads that could not get a ring. */
+#define NO_RING ((void *) &rings_full)
+
+static void release_ring(void *arg)
+{
+    TraceRing *ring = (TraceRing *) arg;
+
+    if (arg == NO_RING)
+        return;
+    pthread_mutex_lock(&rings_lock);
+    ring->in_use = 0;
+    pthread_mutex_unlock(&rings_lock);
+}
+
+static void make_ring_key(void)
+{
+    pthread_key_create(&ring_key, release_ring);
+    clock_gettime(CLOCK_MONOTONIC, &epoch);
+}
+
+/* Takes a free ring for (label, id) or makes one. Needs rings_lock. */
+static TraceRing *claim_ring(const char *label, int id)
+{
+    TraceRing *ring;
+    int r;
+
+    for (r = 0; r < num_rings; r++) {
+        ring = rings[r];
+        if (!ring->in_use && ring->id == id && ring->label != NULL &&
+                label != NULL && strcmp(ring->label, label) == 0) {
+            ring->in_use = 1;
+            return ring;
+        }
+    }
+
+    if (num_rings == TRACE_MAX_RINGS || (ring = calloc(1, sizeof(*ring))) == NULL) {
+        rings_full++;
+        return NULL;
+    }
+    ring->label = label;
+    ring->id = id;
+    ring->in_use = 1;
+    rings[num_rings++] = ring;
+    return ring;
+}
+
+double trace_now(void)
+{
+    struct timespec now;
+
+    pthread_once(&ring_key_once, make_ring_key);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return 1e6 * (now.tv_sec - epoch.tv_sec) + 1e-3 * (now.tv_nsec - epoch.tv_nsec);
+}
+
+/*
+ * Names the calling thread's timeline row "label id".
+ */
+void trace_thread(const char *label, int id)
+{
+    TraceRing *ring;
+
+    pthread_once(&ring_key_once, make_ring_key);
+    ring = pthread_getspecific(ring_key);
+    if ((void *) ring == NO_RING)
+        ring = NULL;
+    if (ring != NULL && ring->id == id && ring->label != NULL &&
+            strcmp(ring->label, label) == 0)
+        return;
+
+    pthread_mutex_lock(&rings_lock);
+    if (ring != NULL)
+        ring->in_use = 0;
+    ring = claim_ring(label, id);
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, ring != NULL ? ring : NO_RING);
+}
+
+/*
+ * Records a span from `start' (a trace_now() value) until now.
+ */
+void trace_span(const char *name, double start, long step)
+{
+    TraceRing *ring = pthread_getspecific(ring_key);
+    TraceEvent *ev;
+
+    if ((void *) ring == NO_RING)
+        return;
+    if (ring == NULL) {
+        pthread_mutex_lock(&rings_lock);
+        ring = claim_ring(NULL, num_rings);
+        pthread_mutex_unlock(&rings_lock);
+        pthread_setspecific(ring_key, ring != NULL ? ring : NO_RING);
+        if (ring == NULL)
+            return;
+    }
+
+    ev = &ring->events[ring->head++ % TRACE_RING_EVENTS];
+    ev->name = name;
+    ev->start = start;
+    ev->duration = trace_now() - start;
+    ev->step = step;
+}
+
+/*
+ * Writes all rings to $WAVE_TRACE_FILE (default trace.json).
+ */
+void trace_dump(void)
+{
+    const char *path = getenv("WAVE_TRACE_FILE");
+    unsigned long written = 0, lost = 0;
+    FILE *fp;
+    int r;
+
+    if (path == NULL)
+        path = DEFAULT_TRACE_FILE;
+    fp = fopen(path, "w");
+    if (!fp) {
+        perror(path);
+        return;
+    }
+
+    pthread_mutex_lock(&rings_lock);
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (r = 0; r < num_rings; r++) {
+        const TraceRing *ring = rings[r];
+        unsigned long e = ring->head > TRACE_RING_EVENTS ?
+                          ring->head - TRACE_RING_EVENTS : 0;
+
+        fprintf(fp, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\","
+                "\"args\":{\"name\":\"%s %d\"}}", r ? ",\n" : "", r,
+                ring->label ? ring->label : "thread", ring->id);
+        fprintf(fp, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":%d}}", r, r);
+
+        lost += e;
+        for (; e < ring->head; e++) {
+            const TraceEvent *ev = &ring->events[e % TRACE_RING_EVENTS];
+
+            fprintf(fp, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"name\":\"%s\","
+                    "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"step\":%ld}}",
+                    r, ev->name, ev->start, ev->duration, ev->step);
+            written++;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    pthread_mutex_unlock(&rings_lock);
+
+    fclose(fp);
+    printf("Trace: %lu events from %d threads written to %s", written,
+            num_rings, path);
+    if (lost > 0 || rings_full > 0)
+        printf(" (%lu overwritten, %lu threads untraced)", lost, rings_full);
+    printf("\n");
+}
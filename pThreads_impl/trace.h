@@ -0,0 +1,36 @@
+/*
+ * trace.h
+ *
+ * Opt-in timeline tracing of the threaded engines, written out as Chrome
+ * trace JSON (chrome://tracing, ui.perfetto.dev). Build with `make TRACE=1'
+ * to enable it; otherwise every macro below compiles to nothing.
+ *
+ * Each thread records into its own fixed-size ring, so recording takes no
+ * lock and the memory per thread is bounded; when a ring wraps, the oldest
+ * events are overwritten. A span is opened with TRACE_BEGIN(var) and closed
+ * with TRACE_END(var, "name", step); names must be string literals.
+ *
+ */
+
+#pragma once
+
+#ifdef WAVE_TRACE
+
+double trace_now(void);
+void trace_thread(const char *label, int id);
+void trace_span(const char *name, double start, long step);
+void trace_dump(void);
+
+#define TRACE_THREAD(label, id) trace_thread(label, id)
+#define TRACE_BEGIN(var) double var = trace_now()
+#define TRACE_END(var, name, step) trace_span(name, var, step)
+#define TRACE_DUMP() trace_dump()
+
+#else
+
+#define TRACE_THREAD(label, id) ((void) 0)
+#define TRACE_BEGIN(var) ((void) 0)
+#define TRACE_END(var, name, step) ((void) 0)
+#define TRACE_DUMP() ((void) 0)
+
+#endif
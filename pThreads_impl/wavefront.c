@@ -0,0 +1,199 @@
+/*
+ * wavefront.c
+ *
+ * Pipelined wavefront engine.
+ *
+ * Each level is cut into tiles. Step s (computing level s + 1) belongs
+ * to worker (s - 1) % num_threads, so the workers take consecutive steps
+ * and then wrap around to the next num_threads. Tile j of step s reads
+ * level s on tile j and one point of tile j + 1, so it may start once
+ * step s - 1 has finished tiles 0 .. j + lag - 1 (lag >= 1). That single
+ * dependency also makes the in-place update safe: level s + 1 overwrites
+ * level s - 2 in the third buffer, whose readers (steps s - 1 and s) are
+ * then past the tile.
+ *
+ * Workers publish the number of tiles they have finished, over all their
+ * steps, in a counter of their own (one cache line each) and wait on
+ * their predecessor's counter, spinning briefly and then yielding. There
+ * is no barrier. The counters only grow, so a worker that has moved on to
+ * its next step never hides progress the one behind it still waits for.
+ *
+ * The tile size keeps the live window, about lag + 1 tiles of each of the
+ * three levels per worker, within half the last-level cache. The leading
+ * step then reads its two levels from DRAM and the others find theirs in
+ * cache: a pass of num_threads steps streams the grid in and out once.
+ * The stencil is the plain kernel, since the next step wants the new level
+ * in cache; results are bit-identical to the other engines.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "wavefront.h"
+#include "kernel.h"
+#include "trace.h"
+
+#define CACHE_LINE 64
+
+/* Tiles a step keeps between itself and the step before it. */
+#define WAVEFRONT_LAG 2
+
+/* Smallest tile, in points, unless the grid is too small to pipeline. */
+#define WAVEFRONT_MIN_TILE 512
+
+/* Polls of a counter before a waiting worker yields its CPU. */
+#define WAVEFRONT_SPINS 256
+
+typedef struct {
+    long done;                            /* tiles finished, all steps */
+    char pad[CACHE_LINE - sizeof(long)];
+} Progress;
+
+typedef struct {
+    long i_max, t_max;
+    int num_threads;
+    wavefront_plan_t plan;
+    double *bufs[3];                      /* level s lives in bufs[s % 3] */
+    Progress *progress;
+    int abort;                            /* a worker failed to start */
+} Wavefront;
+
+typedef struct {
+    int id;
+    Wavefront *wf;
+} Worker;
+
+
+/*
+ * Picks the tile size for a grid and thread count, and models the DRAM
+ * traffic per point update of this engine and the barrier engine.
+ */
+void wavefront_plan(long i_max, int num_threads, wavefront_plan_t *plan)
+{
+    const long llc = kernel_llc_bytes(), interior = i_max - 2;
+    const long live = 3 * (long) sizeof(double) * num_threads * (WAVEFRONT_LAG + 1);
+    const int depth = num_threads < 3 ? num_threads : 3;
+    long tile = llc / 2 / live / 8 * 8;
+
+    if (tile < WAVEFRONT_MIN_TILE)
+        tile = WAVEFRONT_MIN_TILE;
+    /* Enough tiles that every worker has some in flight. */
+    if (tile * 4 * num_threads * (WAVEFRONT_LAG + 1) > interior)
+        tile = interior / (4 * num_threads * (WAVEFRONT_LAG + 1));
+    if (tile < 1)
+        tile = 1;
+
+    plan->tile = tile;
+    plan->tiles = (interior + tile - 1) / tile;
+    plan->lag = WAVEFRONT_LAG;
+    plan->window_bytes = (double) live * tile;
+
+    /*
+     * Beyond the cache, a barrier step reads old and cur, reads next for
+     * ownership and writes it back: 32 bytes, 24 with streaming stores.
+     * A pass here reads the first two levels and the third buffer once
+     * and writes back the (up to three) buffers it dirtied.
+     */
+    if (3 * i_max * (double) sizeof(double) <= llc) {
+        plan->dram_bytes = plan->barrier_bytes = 0;
+    } else {
+        plan->dram_bytes = (24.0 + 8.0 * depth) / num_threads;
+        plan->barrier_bytes = kernel_select(i_max) == stencil_stream ? 24 : 32;
+    }
+}
+
+/* Waits until *p reaches count. Returns -1 if the run was aborted. */
+static int wait_for(const Wavefront *wf, const Progress *p, long count)
+{
+    int spins = 0;
+
+    while (__atomic_load_n(&p->done, __ATOMIC_ACQUIRE) < count) {
+        if (++spins == WAVEFRONT_SPINS) {
+            if (__atomic_load_n(&wf->abort, __ATOMIC_RELAXED))
+                return -1;
+            sched_yield();
+            spins = 0;
+        }
+    }
+    return 0;
+}
+
+static void *worker(void *arg)
+{
+    const Worker *w = arg;
+    const Wavefront *wf = w->wf;
+    const long tiles = wf->plan.tiles, tile = wf->plan.tile;
+    const int P = wf->num_threads;
+    const Progress *prev = &wf->progress[(w->id + P - 1) % P];
+    Progress *mine = &wf->progress[w->id];
+    long done = 0;
+
+    TRACE_THREAD("wavefront", w->id);
+    for (long s = w->id + 1; s <= wf->t_max; s += P) {
+        double *next = wf->bufs[(s + 1) % 3];
+        const double *cur = wf->bufs[s % 3];
+        const double *old = wf->bufs[(s - 1) % 3];
+        /* Tiles the predecessor had finished before starting step s - 1. */
+        const long base = (s - 2) / P * tiles;
+
+        TRACE_BEGIN(step);
+        for (long j = 0; j < tiles; j++) {
+            const long start = 1 + j * tile;
+            const long end = start + tile < wf->i_max - 1 ? start + tile : wf->i_max - 1;
+
+            if (s > 1) {
+                const long need = j + wf->plan.lag < tiles ? j + wf->plan.lag : tiles;
+
+                if (wait_for(wf, prev, base + need) != 0)
+                    return NULL;
+            }
+            stencil_plain(next, cur, old, start, end);
+            __atomic_store_n(&mine->done, ++done, __ATOMIC_RELEASE);
+        }
+        TRACE_END(step, "step", s);
+    }
+    return NULL;
+}
+
+/*
+ * Runs t_max steps with num_threads pipelined workers and returns the
+ * buffer holding the last level, like simulate().
+ */
+double *simulate_wavefront(const long i_max, const long t_max,
+        const int num_threads, double *old_array, double *current_array,
+        double *next_array)
+{
+    Wavefront wf = { i_max, t_max, num_threads };
+    pthread_t threads[num_threads];
+    Worker workers[num_threads];
+    void *progress;
+    int started;
+
+    wavefront_plan(i_max, num_threads, &wf.plan);
+    wf.bufs[0] = old_array;
+    wf.bufs[1] = current_array;
+    wf.bufs[2] = next_array;
+    if (posix_memalign(&progress, CACHE_LINE, num_threads * sizeof(Progress)) != 0)
+        return NULL;
+    wf.progress = progress;
+    for (int k = 0; k < num_threads; k++)
+        wf.progress[k].done = 0;
+
+    for (started = 0; started < num_threads; started++) {
+        workers[started].id = started;
+        workers[started].wf = &wf;
+        if (pthread_create(&threads[started], NULL, worker, &workers[started]) != 0)
+            break;
+    }
+    /* Without all workers the pipeline stalls: release the others. */
+    if (started < num_threads)
+        __atomic_store_n(&wf.abort, 1, __ATOMIC_RELAXED);
+    for (int k = 0; k < started; k++)
+        pthread_join(threads[k], NULL);
+    free(progress);
+
+    return started == num_threads ? wf.bufs[(t_max + 1) % 3] : NULL;
+}
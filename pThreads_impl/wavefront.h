@@ -0,0 +1,24 @@
+/*
+ * wavefront.h
+ *
+ * Pipelined wavefront engine: thread k runs timestep t + k, a few tiles
+ * behind thread k - 1, so one pass over memory advances the grid by
+ * num_threads steps.
+ *
+ */
+
+#pragma once
+
+typedef struct {
+    long tile;            /* points per tile */
+    long tiles;           /* tiles per level */
+    int lag;              /* tiles a step stays behind the one before it */
+    double window_bytes;  /* the sliding window the pipeline keeps live */
+    double dram_bytes;    /* modelled DRAM traffic per point update */
+    double barrier_bytes; /* the same for the barrier engine */
+} wavefront_plan_t;
+
+void wavefront_plan(long i_max, int num_threads, wavefront_plan_t *plan);
+double *simulate_wavefront(const long i_max, const long t_max,
+        const int num_threads, double *old_array, double *current_array,
+        double *next_array);
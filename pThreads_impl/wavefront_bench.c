@@ -0,0 +1,134 @@
+/*
+ * wavefront_bench.c
+ *
+ * wave_wavefront: times the barrier and the pipelined wavefront engine on
+ * grids below and above the last-level cache.
+ *
+ * Both columns of bytes per point update are the model of
+ * wavefront_plan(); the bandwidth columns are those models over the
+ * measured time. Without hardware counters this is how the DRAM saving
+ * shows: where the wavefront's modelled bandwidth stays near the barrier
+ * engine's, the time it saves is the traffic it no longer moves. Both
+ * engines must produce identical results.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "simulate.h"
+#include "wavefront.h"
+#include "kernel.h"
+#include "timer.h"
+
+/* Point updates per timed run. */
+#define BENCH_UPDATES 4e8
+
+static double run(simulate_func_t engine, long i_max, long steps, int threads,
+        const double *old, const double *cur, double *result)
+{
+    double *bufs[3], *ret, seconds;
+    struct timespec start;
+
+    for (int b = 0; b < 3; b++)
+        bufs[b] = calloc(i_max, sizeof(double));
+    if (!bufs[0] || !bufs[1] || !bufs[2]) {
+        for (int b = 0; b < 3; b++)
+            free(bufs[b]);
+        return -1;
+    }
+    memcpy(bufs[0], old, i_max * sizeof(double));
+    memcpy(bufs[1], cur, i_max * sizeof(double));
+    engine(i_max, 1, threads, bufs[0], bufs[1], bufs[2]);   /* fault in */
+    memcpy(bufs[0], old, i_max * sizeof(double));
+    memcpy(bufs[1], cur, i_max * sizeof(double));
+
+    timer_start_r(&start);
+    ret = engine(i_max, steps, threads, bufs[0], bufs[1], bufs[2]);
+    seconds = timer_end_r(&start);
+    if (ret != NULL)
+        memcpy(result, ret, i_max * sizeof(double));
+    else
+        seconds = -1;
+
+    for (int b = 0; b < 3; b++)
+        free(bufs[b]);
+    return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    const long llc = kernel_llc_bytes();
+    long default_sizes[2], *sizes = default_sizes;
+    int num_sizes = 2, threads = argc > 1 ? atoi(argv[1]) : 4, k;
+
+    if (threads < 1) {
+        printf("Usage: %s [threads [i_max ...]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Default: a grid well inside the cache and one four times past it. */
+    default_sizes[0] = llc / 24 / 4;
+    default_sizes[1] = 4 * (llc / 24);
+    if (argc > 2) {
+        num_sizes = argc - 2;
+        sizes = malloc(num_sizes * sizeof(long));
+        if (sizes == NULL)
+            return EXIT_FAILURE;
+        for (k = 0; k < num_sizes; k++)
+            sizes[k] = strtol(argv[2 + k], NULL, 10);
+    }
+
+    printf("last-level cache %ld KiB, %d threads\n", llc >> 10, threads);
+    printf("%12s %8s %10s %10s %8s %8s %10s %10s %8s\n", "i_max", "MiB",
+            "bar ns/pt", "wave ns/pt", "bar B/pt", "wave B/pt", "bar GB/s",
+            "wave GB/s", "speedup");
+
+    for (k = 0; k < num_sizes; k++) {
+        const long i_max = sizes[k];
+        const long steps = i_max > 0 ? (long) fmax(3, BENCH_UPDATES / i_max) : 0;
+        double *old = malloc(i_max * sizeof(double));
+        double *cur = malloc(i_max * sizeof(double));
+        double *barrier = malloc(i_max * sizeof(double));
+        double *wave = malloc(i_max * sizeof(double));
+        double t_barrier, t_wave, updates;
+        wavefront_plan_t plan;
+
+        if (i_max < 3 || !old || !cur || !barrier || !wave) {
+            fprintf(stderr, "skipping i_max %ld\n", i_max);
+            free(old);
+            free(cur);
+            free(barrier);
+            free(wave);
+            continue;
+        }
+        for (long i = 0; i < i_max; i++) {
+            old[i] = sin(1e-3 * i);
+            cur[i] = sin(1e-3 * (i + 1));
+        }
+
+        wavefront_plan(i_max, threads, &plan);
+        t_barrier = run(simulate, i_max, steps, threads, old, cur, barrier);
+        t_wave = run(simulate_wavefront, i_max, steps, threads, old, cur, wave);
+        updates = (double) (i_max - 2) * steps;
+
+        printf("%12ld %8.1f %10.3f %10.3f %8.1f %8.1f %10.2f %10.2f %8.3f%s\n",
+                i_max, 3.0 * i_max * sizeof(double) / (1 << 20),
+                1e9 * t_barrier / updates, 1e9 * t_wave / updates,
+                plan.barrier_bytes, plan.dram_bytes,
+                plan.barrier_bytes * updates / t_barrier * 1e-9,
+                plan.dram_bytes * updates / t_wave * 1e-9, t_barrier / t_wave,
+                memcmp(barrier, wave, i_max * sizeof(double)) ? "  MISMATCH" : "");
+
+        free(old);
+        free(cur);
+        free(barrier);
+        free(wave);
+    }
+
+    if (sizes != default_sizes)
+        free(sizes);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+/*
+ * zstate.h
+ *
+ * Simulation on block-compressed time levels, for grids that do not fit in
+ * memory uncompressed.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* zstate_create() modes. */
+enum {
+    ZSTATE_LOSSLESS,       /* XOR-delta coding, bit-identical to simulate() */
+    ZSTATE_LOSSY,          /* quantised to within +-eps, delta coded */
+};
+
+typedef struct zstate zstate_t;
+
+typedef struct {
+    size_t raw_bytes;      /* three uncompressed levels */
+    size_t peak_bytes;     /* most memory held, staging level included */
+    double ratio;          /* raw_bytes / peak_bytes */
+    double max_error;      /* largest |stored - exact| of any single store */
+} zstate_stats_t;
+
+zstate_t *zstate_create(long i_max, int num_threads, int mode, double eps);
+int zstate_load(zstate_t *zs, int level, const double *array);
+double *zstate_run(zstate_t *zs, long t_max, double *result);
+void zstate_stats(const zstate_t *zs, zstate_stats_t *stats);
+void zstate_destroy(zstate_t *zs);